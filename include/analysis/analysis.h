@@ -1,11 +1,15 @@
 #ifndef REDSHOW_ANALYSIS_ANALYSIS_H
 #define REDSHOW_ANALYSIS_ANALYSIS_H
 
+#include <list>
 #include <queue>
 #include <string>
 
 #include "binutils/cubin.h"
 #include "common/map.h"
+#include "common/segment_file.h"
+#include "common/serialize.h"
+#include "common/vector.h"
 #include "operation/kernel.h"
 #include "operation/memory.h"
 #include "operation/operation.h"
@@ -16,7 +20,12 @@ namespace redshow {
 struct Trace {
   Kernel kernel;
 
-  Trace() = default;
+  // REDSHOW_SAMPLING_ADAPTIVE, running totals reported by Analysis::kernel_summary
+  bool summarize;
+  u64 summary_count;
+  u64 summary_total_count;
+
+  Trace() : summarize(false), summary_count(0), summary_total_count(0) {}
 
   virtual ~Trace() = 0;
 };
@@ -56,6 +65,9 @@ class Analysis {
 
   virtual void block_exit(const ThreadId &thread_id) = 0;
 
+  // Whether results depend on the order of records in a trace
+  virtual bool order_sensitive() const { return true; }
+
   /**
    * @brief A callback for every unit
    *
@@ -73,6 +85,18 @@ class Analysis {
                            const Memory &memory, u64 pc, u64 value, u64 addr, u32 index,
                            GPUPatchFlags flags) = 0;
 
+  /**
+   * @brief Summarize the results of a kernel so far, used to detect convergence across
+   * invocations. Analyses keep the totals of a trace as units arrive if Trace::summarize is set
+   *
+   * @param cpu_thread
+   * @param kernel_id kernel context id
+   * @param count redundant or distinct accesses
+   * @param total_count all accesses
+   * @return false if the analysis has no summary for the kernel
+   */
+  bool kernel_summary(u32 cpu_thread, i32 kernel_id, u64 &count, u64 &total_count);
+
   // Flush
   virtual void flush_thread(u32 cpu_thread, const std::string &output_dir,
                             const LockableMap<u32, Cubin> &cubins,
@@ -81,12 +105,93 @@ class Analysis {
   virtual void flush(const std::string &output_dir, const LockableMap<u32, Cubin> &cubins,
                      redshow_record_data_callback_func record_data_callback) = 0;
 
+  /**
+   * @brief Report the results of a kernel before the thread is flushed and release its trace. A
+   * later launch of the kernel starts a new trace, which is reported on its own. Only called by
+   * cpu_thread, which owns the spilled traces and the outputs of the thread.
+   *
+   * @param cpu_thread
+   * @param kernel_id
+   * @param output_dir
+   * @param cubins
+   * @param record_data_callback
+   */
+  virtual void flush_kernel(u32 cpu_thread, i32 kernel_id, const std::string &output_dir,
+                            const LockableMap<u32, Cubin> &cubins,
+                            redshow_record_data_callback_func record_data_callback) {}
+
+  /**
+   * @brief Load the trace of a kernel back if it was spilled, called before analysis_begin
+   *
+   * @param cpu_thread
+   * @param kernel_id
+   */
+  void trace_begin(u32 cpu_thread, i32 kernel_id);
+
+  /**
+   * @brief Account the trace of a kernel after analysis_end. While traces of the thread exceed
+   * the budget, the least recently analyzed ones are spilled, see redshow_trace_budget_config
+   *
+   * @param cpu_thread
+   * @param kernel_id
+   */
+  void trace_end(u32 cpu_thread, i32 kernel_id);
+
+ protected:
+  // Estimated bytes of a trace, 0 if it is never spilled
+  virtual size_t trace_size(const Trace &trace) const { return 0; }
+
+  virtual void save_trace(const Trace &trace, BinaryWriter &writer) const {}
+
+  virtual std::shared_ptr<Trace> load_trace(BinaryReader &reader) const { return nullptr; }
+
+  // Kernels of a thread with a trace in memory or spilled, in order
+  Vector<i32> trace_kernels(u32 cpu_thread);
+
+  // The trace of a kernel, a spilled trace is read for the caller and stays spilled
+  std::shared_ptr<Trace> thread_trace(u32 cpu_thread, i32 kernel_id);
+
+  // Take the trace of a kernel out of the analysis, NULL if there is none
+  std::shared_ptr<Trace> release_trace(u32 cpu_thread, i32 kernel_id);
+
+ private:
+  // Spilled and in-memory traces of a thread, only accessed by the thread, see redshow_flush_kernel
+  struct TraceSpill {
+    // Kernels in memory, the least recently analyzed first
+    std::list<i32> lru;
+    Map<i32, std::list<i32>::iterator> lru_iters;
+    // Estimated bytes of kernels in memory
+    Map<i32, size_t> sizes;
+    size_t total_size;
+    // <kernel, buffers analyzed>, and the count at which the size of a kernel is estimated again
+    Map<i32, u64> buffers;
+    Map<i32, u64> estimates;
+    Map<i32, SegmentFile::Segment> segments;
+    SegmentFile file;
+
+    TraceSpill() : total_size(0) {}
+  };
+
+  // A trace is estimated again after its buffers grow by 1 / 2^_TRACE_SIZE_SHIFT, so the cost of
+  // estimates stays linear in the buffers of a kernel
+  static constexpr u64 _TRACE_SIZE_SHIFT = 3;
+
+  TraceSpill *trace_spill(u32 cpu_thread);
+
+  bool spill_trace(u32 cpu_thread, TraceSpill &spill, i32 kernel_id, const char *dir);
+
+  // Decode a spilled trace, release its segment if it is kept in memory again
+  std::shared_ptr<Trace> read_trace(TraceSpill &spill, i32 kernel_id, bool release);
+
  protected:
   Map<u32, Map<i32, std::shared_ptr<Trace>>> _kernel_trace;
   Map<redshow_analysis_config_type_t, bool> _configs;
   redshow_tool_dtoh_func _dtoh;
   redshow_analysis_type_t _type;
   std::mutex _lock;
+
+ private:
+  Map<u32, TraceSpill> _trace_spills;
 };
 
 struct CompareView {
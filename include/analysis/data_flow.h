@@ -118,9 +118,23 @@ class DataFlow final : public Analysis {
     virtual ~DataFlowTrace() {}
   };
 
+  // Metrics of a memory touched by a kernel, computed outside of the graph lock
+  struct DataFlowUpdate {
+    std::shared_ptr<Memory> memory;
+    const Set<MemoryRange> *ranges;
+    u64 redundancy;
+    u64 overwrite;
+    std::string hash;
+
+    DataFlowUpdate(std::shared_ptr<Memory> memory, const Set<MemoryRange> *ranges)
+        : memory(memory), ranges(ranges), redundancy(0), overwrite(0) {}
+  };
+
  private:
   void init();
 
+  void add_op_node(OperationPtr op);
+
   void kernel_op_callback(std::shared_ptr<Kernel> op);
 
   void memory_op_callback(std::shared_ptr<Memory> op);
@@ -129,17 +143,21 @@ class DataFlow final : public Analysis {
 
   void memcpy_op_callback(std::shared_ptr<Memcpy> op);
 
-  void link_op_node(u64 op_id, i32 ctx_id, i32 mem_ctx_id);
+  bool find_op_node(u64 op_id, u64 host_op_id, i32 &ctx_id);
+
+  void link_op_node(u64 op_id, u64 host_op_id, i32 ctx_id, i32 mem_ctx_id);
 
   void link_ctx_node(i32 src_ctx_id, i32 dst_ctx_id, i32 mem_ctx_id, EdgeType type);
 
   void update_edge_metrics(i32 src_ctx_id, i32 dst_ctx_id, i32 mem_ctx_id, u64 redundancy,
                            u64 overwrite, u64 count, EdgeType type);
 
-  void update_op_metrics(u64 op_id, i32 ctx_id, i32 mem_ctx_id, u64 redundancy, u64 overwrite,
-                         u64 count, EdgeType type = DATA_FLOW_EDGE_ORDER);
+  void update_op_metrics(u64 op_id, u64 host_op_id, i32 ctx_id, i32 mem_ctx_id, u64 redundancy,
+                         u64 overwrite, u64 count, EdgeType type = DATA_FLOW_EDGE_ORDER);
+
+  void update_op_node(u64 op_id, u64 host_op_id, i32 ctx_id);
 
-  void update_op_node(u64 op_id, i32 ctx_id);
+  std::mutex &memory_lock(u64 op_id) { return _memory_locks[op_id % _MEMORY_LOCK_NUM]; }
 
   void analyze_duplicate(Map<i32, Map<i32, bool>> &duplicate);
 
@@ -155,22 +173,30 @@ class DataFlow final : public Analysis {
   };
 
  private:
-  // Multi-threading is not allowable for data flow profiling
-  std::shared_ptr<DataFlowTrace> _trace;
+  // <cpu_thread, trace>: traces waiting for their kernel operations
+  Map<u32, std::shared_ptr<DataFlowTrace>> _thread_trace;
 
   DataFlowGraph _graph;
-  Map<u64, i32> _op_node;
+  // <memory_op_id, <host_op_id, ctx_id>>
+  Map<u64, Map<u64, i32>> _op_node;
   Map<i32, Set<std::string>> _node_hash;
   Map<i32, u64> _node_count;
   Map<u64, std::shared_ptr<Memory>> _memories;
 
-  Path<MemoryRange> _ranges;
+  // Shadow memories are guarded by striped locks
+  static const size_t _MEMORY_LOCK_NUM = 64;
+  std::mutex _memory_locks[_MEMORY_LOCK_NUM];
+
+  const size_t _OP_NODE_HISTORY_LIMIT = 16;
 
   const double _FRAGMENT_RATIO_LIMIT = 0.1;
   // 128MB
   const size_t _FRAGMENT_SIZE_LIMIT = 128 * 1024 * 1024;
   // 
   const size_t _FRAGMENT_LEN_LIMIT = 10000;
+
+ private:
+  static inline thread_local std::shared_ptr<DataFlowTrace> _trace;
 };
 
 }  // namespace redshow
@@ -0,0 +1,266 @@
+#ifndef REDSHOW_ANALYSIS_ITEMS_VALUE_COUNT_H
+#define REDSHOW_ANALYSIS_ITEMS_VALUE_COUNT_H
+
+#include "common/map.h"
+#include "common/serialize.h"
+#include "common/utils.h"
+#include "common/vector.h"
+
+namespace redshow {
+
+/*
+ * Value counts of the items of an array: <offset, <value, count>>
+ *
+ * Most items only ever hold one value, so each item keeps a single (value, count) slot inline and
+ * spills to a side table once a second value shows up. Adjacent items with the same slot are
+ * kept as a run, so zero-filled or single-valued arrays take a few runs. Runs switch to a vector
+ * of slots indexed by offset once they are not smaller than it.
+ *
+ * Memory can be bounded by limits on items and values. Past max_items, only items at a doubling
+ * stride of offsets are tracked; past max_values of an item, the least counted value is replaced
+ * and its count inherited (space-saving). Accesses dropped this way are counted for the report.
+ */
+class ItemsValueCount {
+ public:
+  // <Value, Count>
+  typedef Map<u64, u64> ValueCount;
+
+  // Values of one item
+  class Item {
+   public:
+    Item(u64 value, u64 count) : _value(value), _count(count), _values(NULL) {}
+
+    explicit Item(const ValueCount *values) : _value(0), _count(0), _values(values) {}
+
+    size_t size() const noexcept { return _values == NULL ? 1 : _values->size(); }
+
+    // The smallest value
+    u64 value() const noexcept { return _values == NULL ? _value : _values->begin()->first; }
+
+    // f(value, count) in value order
+    template <typename F>
+    void for_each(F &&f) const {
+      if (_values == NULL) {
+        f(_value, _count);
+      } else {
+        for (auto &iter : *_values) {
+          f(iter.first, iter.second);
+        }
+      }
+    }
+
+   private:
+    u64 _value;
+    u64 _count;
+    const ValueCount *_values;
+  };
+
+  ItemsValueCount() : ItemsValueCount(0) {}
+
+  /**
+   * @brief Construct a new ItemsValueCount object
+   *
+   * @param capacity number of items of the array, 0 if unknown
+   * @param max_items maximum number of tracked items, 0 if unlimited
+   * @param max_values maximum number of values per item, 0 if unlimited
+   */
+  explicit ItemsValueCount(u64 capacity, u64 max_items = 0, u64 max_values = 0)
+      : _capacity(capacity),
+        _size(0),
+        _max_items(max_items),
+        _max_values(max_values),
+        _shift(0),
+        _untracked(0),
+        _evicted(0),
+        _spill_values(0) {}
+
+  void add(u64 offset, u64 value, u64 count = 1) {
+    if (offset & (stride() - 1)) {
+      _untracked += count;
+      return;
+    }
+    // Items are indexed by their position in the stride
+    auto index = offset >> _shift;
+
+    if (_slots.empty()) {
+      add_run(index, value, count);
+    } else {
+      if (index >= _slots.size()) {
+        _slots.resize(index + 1);
+      }
+      auto &slot = _slots[index];
+      if (slot.count == 0) {
+        slot.value = value;
+        slot.count = count;
+        ++_size;
+      } else if (slot.count == _SPILLED) {
+        add_spilled(index, value, count);
+      } else if (slot.value == value) {
+        slot.count += count;
+      } else {
+        spill(index, slot, value, count);
+      }
+    }
+
+    if (_max_items != 0 && _size > _max_items) {
+      resample(_shift + 1);
+    }
+  }
+
+  // Values are masked, e.g., to approximate floats
+  void merge(const ItemsValueCount &other, u64 value_mask = 0xffffffffffffffffu);
+
+  // f(offset, item) in offset order
+  template <typename F>
+  void for_each(F &&f) const {
+    if (_slots.empty()) {
+      for (auto &iter : _runs) {
+        for (u64 index = iter.first; index < iter.second.end; ++index) {
+          visit(index, iter.second.slot, f);
+        }
+      }
+    } else {
+      for (u64 index = 0; index < _slots.size(); ++index) {
+        if (_slots[index].count != 0) {
+          visit(index, _slots[index], f);
+        }
+      }
+    }
+  }
+
+  // Number of accessed items
+  size_t size() const noexcept { return _size; }
+
+  bool empty() const noexcept { return _size == 0; }
+
+  u64 capacity() const noexcept { return _capacity; }
+
+  // Number of items with more than one value
+  size_t spilled() const noexcept { return _spill.size(); }
+
+  // Number of runs, 0 once items are indexed by offset
+  size_t runs() const noexcept { return _runs.size(); }
+
+  // Offsets between tracked items, 1 unless max_items was exceeded
+  u64 stride() const noexcept { return static_cast<u64>(1) << _shift; }
+
+  // Accesses to items off the stride
+  u64 untracked() const noexcept { return _untracked; }
+
+  // Accesses whose values were replaced past max_values
+  u64 evicted() const noexcept { return _evicted; }
+
+  bool sampled() const noexcept { return _shift != 0 || _evicted != 0; }
+
+  // Bytes held outside of the object
+  size_t bytes() const noexcept;
+
+  void save(BinaryWriter &writer) const;
+
+  void load(BinaryReader &reader);
+
+ private:
+  struct Slot {
+    u64 value;
+    u64 count;
+
+    Slot() : value(0), count(0) {}
+
+    Slot(u64 value, u64 count) : value(value), count(count) {}
+
+    bool operator==(const Slot &other) const {
+      return value == other.value && count == other.count;
+    }
+  };
+
+  // Items [start, end) share a slot, spilled items of a run keep their values in _spill
+  struct Run {
+    u64 end;
+    Slot slot;
+
+    Run() : end(0) {}
+
+    Run(u64 end, const Slot &slot) : end(end), slot(slot) {}
+  };
+
+  // Move a second value of an item to the side table
+  void spill(u64 index, Slot &slot, u64 value, u64 count) {
+    if (_max_values == 1) {
+      _evicted += slot.count;
+      slot = Slot(value, slot.count + count);
+      return;
+    }
+    auto &values = _spill[index];
+    values[slot.value] = slot.count;
+    values[value] += count;
+    _spill_values += values.size();
+    slot = Slot(0, _SPILLED);
+  }
+
+  void add_spilled(u64 index, u64 value, u64 count) {
+    auto &values = _spill[index];
+    if (values.has(value)) {
+      values[value] += count;
+    } else if (_max_values == 0 || values.size() < _max_values) {
+      values[value] = count;
+      ++_spill_values;
+    } else {
+      evict(values, value, count);
+    }
+  }
+
+  // Replace the least counted value of an item
+  void evict(ValueCount &values, u64 value, u64 count);
+
+  // Keep only items at offsets of 1 << shift
+  void resample(u32 shift);
+
+  void add_run(u64 index, u64 value, u64 count);
+
+  // Give the item at index its own slot within the run that covers it
+  Map<u64, Run>::iterator split_run(Map<u64, Run>::iterator iter, u64 index, const Slot &slot);
+
+  // Merge a run with its neighbors holding the same slot
+  void merge_run(Map<u64, Run>::iterator iter);
+
+  template <typename F>
+  void visit(u64 index, const Slot &slot, F &f) const {
+    if (slot.count == _SPILLED) {
+      f(index << _shift, Item(&_spill.at(index)));
+    } else {
+      f(index << _shift, Item(slot.value, slot.count));
+    }
+  }
+
+  void densify();
+
+ private:
+  u64 _capacity;
+  size_t _size;
+  u64 _max_items;
+  u64 _max_values;
+  u32 _shift;
+  u64 _untracked;
+  u64 _evicted;
+  // Values of spilled items
+  u64 _spill_values;
+  // Indexed by offset >> _shift
+  Vector<Slot> _slots;
+  // <start, run>
+  Map<u64, Run> _runs;
+  Map<u64, ValueCount> _spill;
+
+  static constexpr u64 _SPILLED = static_cast<u64>(-1);
+  // Switch to indexed slots once there is a run for 1/_DENSITY of the items
+  static constexpr u64 _DENSITY = 4;
+};
+
+inline void serialize(BinaryWriter &writer, const ItemsValueCount &items) { items.save(writer); }
+
+inline void deserialize(BinaryReader &reader, ItemsValueCount &items) { items.load(reader); }
+
+inline size_t heap_size(const ItemsValueCount &items) { return items.bytes(); }
+
+}  // namespace redshow
+
+#endif  // REDSHOW_ANALYSIS_ITEMS_VALUE_COUNT_H
@@ -0,0 +1,151 @@
+#ifndef REDSHOW_ANALYSIS_RECORD_FILE_H
+#define REDSHOW_ANALYSIS_RECORD_FILE_H
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+
+#include "binutils/instruction.h"
+#include "common/map.h"
+#include "common/utils.h"
+#include "common/vector.h"
+
+namespace redshow {
+
+/*
+ * Binary output of analysis results, see REDSHOW_OUTPUT_BINARY.
+ *
+ * A file starts with a schema: magic, version, the name of the analysis, and its tables. Each
+ * table has a fixed record size and fields at fixed offsets. The rest of the file is a sequence
+ * of blocks, each holds u32 table, u64 count, and count records of the table. Records are in
+ * host byte order and written as they are laid out in memory, so a reader may load the fields
+ * of a block as columns.
+ *
+ * Table 0 is a dictionary of access kinds. Records refer to access kinds by their ids, and a kind
+ * is written to the dictionary before the first block that refers to it.
+ */
+enum RecordFieldType : u32 {
+  RECORD_FIELD_U8 = 0,
+  RECORD_FIELD_U32 = 1,
+  RECORD_FIELD_I32 = 2,
+  RECORD_FIELD_U64 = 3,
+  RECORD_FIELD_F64 = 4,
+  // u32 id in the access kind table
+  RECORD_FIELD_ACCESS_KIND = 5,
+  // u64 bits of a value, typed by the first access kind field of the record
+  RECORD_FIELD_VALUE = 6,
+};
+
+struct RecordField {
+  std::string name;
+  RecordFieldType type;
+  u32 offset;
+
+  RecordField() = default;
+
+  RecordField(const std::string &name, RecordFieldType type, u32 offset)
+      : name(name), type(type), offset(offset) {}
+};
+
+struct RecordTable {
+  std::string name;
+  u32 size;
+  Vector<RecordField> fields;
+
+  RecordTable() : size(0) {}
+
+  RecordTable(const std::string &name, u32 size) : name(name), size(size) {}
+};
+
+struct AccessKindRecord {
+  u32 id;
+  u32 data_type;
+  u32 vec_size;
+  u32 unit_size;
+};
+
+static constexpr char RECORD_FILE_MAGIC[4] = {'R', 'S', 'R', 'F'};
+static constexpr u32 RECORD_FILE_VERSION = 1;
+static constexpr u32 RECORD_TABLE_ACCESS_KIND = 0;
+
+// Bytes of a field
+u32 record_field_size(RecordFieldType type);
+
+// Records are written with their padding, which value-initialization does not reliably zero once
+// fields are assigned, so every record is cleared before its fields are set
+template <typename T>
+inline void clear_record(T &record) {
+  static_assert(std::is_trivially_copyable<T>::value, "records are written as bytes");
+  memset(&record, 0, sizeof(T));
+}
+
+class RecordWriter {
+ public:
+  RecordWriter() = default;
+
+  /**
+   * @brief Create a file and write its schema
+   *
+   * @param path
+   * @param name name of the analysis
+   * @param tables tables of the analysis, numbered from 1
+   * @return false if the file cannot be created
+   */
+  bool open(const std::string &path, const std::string &name, const Vector<RecordTable> &tables);
+
+  bool is_open() const { return _out.is_open(); }
+
+  // Dictionary id of an access kind, a new kind is written to the access kind table first
+  u32 access_kind_id(const AccessKind &access_kind);
+
+  void write(u32 table, const void *records, u64 count);
+
+  template <typename T>
+  void write(u32 table, const Vector<T> &records) {
+    write(table, records.data(), records.size());
+  }
+
+  void close() { _out.close(); }
+
+ private:
+  std::ofstream _out;
+  Vector<u32> _sizes;
+  Map<AccessKind, u32> _access_kinds;
+};
+
+class RecordReader {
+ public:
+  RecordReader() = default;
+
+  // Read the schema, false if the file is not a record file
+  bool open(const std::string &path);
+
+  const std::string &name() const { return _name; }
+
+  // Tables of the file, the access kind table first
+  const Vector<RecordTable> &tables() const { return _tables; }
+
+  /**
+   * @brief Read the next block, access kinds are kept for access_kind
+   *
+   * @param table
+   * @param count
+   * @param records count records of the table
+   * @return false at the end of the file or on a truncated block
+   */
+  bool next(u32 &table, u64 &count, std::string &records);
+
+  // An access kind read so far, an unknown one if id was not read
+  AccessKind access_kind(u32 id) const;
+
+ private:
+  std::ifstream _in;
+  std::string _name;
+  Vector<RecordTable> _tables;
+  Map<u32, AccessKind> _access_kinds;
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_ANALYSIS_RECORD_FILE_H
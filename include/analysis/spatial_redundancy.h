@@ -13,6 +13,7 @@
 #include <tuple>
 
 #include "analysis.h"
+#include "analysis/record_file.h"
 #include "binutils/instruction.h"
 #include "binutils/real_pc.h"
 #include "common/map.h"
@@ -40,6 +41,9 @@ class SpatialRedundancy final : public Analysis {
 
   virtual void block_exit(const ThreadId &thread_id);
 
+  // Units are counted per (pc, memory, value), and the sums do not depend on order
+  virtual bool order_sensitive() const { return false; }
+
   virtual void unit_access(i32 kernel_id, const ThreadId &thread_id, const AccessKind &access_kind,
                            const Memory &memory, u64 pc, u64 value, u64 addr, u32 index,
                            GPUPatchFlags flags);
@@ -52,10 +56,25 @@ class SpatialRedundancy final : public Analysis {
   virtual void flush(const std::string &output_dir, const LockableMap<u32, Cubin> &cubins,
                      redshow_record_data_callback_func record_data_callback);
 
+  virtual void flush_kernel(u32 cpu_thread, i32 kernel_id, const std::string &output_dir,
+                            const LockableMap<u32, Cubin> &cubins,
+                            redshow_record_data_callback_func record_data_callback);
+
+ protected:
+  // Spilling of traces, see Analysis::trace_end
+  virtual size_t trace_size(const Trace &trace) const;
+
+  virtual void save_trace(const Trace &trace, BinaryWriter &writer) const;
+
+  virtual std::shared_ptr<Trace> load_trace(BinaryReader &reader) const;
+
  private:
   // {<memory_op_id, AccessKind> : {pc: {value: count}}}
   typedef Map<std::pair<u64, AccessKind>, Map<u64, Map<u64, u64>>> SpatialTrace;
 
+  // {<memory_op_id, AccessKind> : {pc: max count of a value}}
+  typedef Map<std::pair<u64, AccessKind>, Map<u64, u64>> SpatialMaxCount;
+
   // {<memory_op_id> : {pc: [RealPCPair]}}
   typedef Map<u64, Map<u64, Vector<RealPCPair>>> SpatialStatistics;
 
@@ -67,6 +86,11 @@ class SpatialRedundancy final : public Analysis {
   void show_spatial_trace(u32 cpu_thread, i32 kernel_id, u64 total_red_count, u64 total_count,
                           SpatialStatistics &spatial_stats, bool is_thread, std::ofstream &out);
 
+  // REDSHOW_OUTPUT_BINARY counterpart of show_spatial_trace
+  void write_spatial_records(u32 cpu_thread, i32 kernel_id, u64 total_red_count, u64 total_count,
+                             SpatialStatistics &spatial_stats, bool is_thread,
+                             RecordWriter &records);
+
   /**
    * @brief Update the spatial trace object
    *
@@ -75,13 +99,29 @@ class SpatialRedundancy final : public Analysis {
    * @param memory_op_id Current record's memory identifier
    * @param access_kind How a thread accesses memory (e.g. float/int, vector/scalar)
    * @param spatial_trace
+   * @return u64 Count of the value at pc after the update
    */
-  void update_spatial_trace(u64 pc, u64 value, u64 memory_op_id, AccessKind access_kind,
-                            SpatialTrace &spatial_trace);
+  u64 update_spatial_trace(u64 pc, u64 value, u64 memory_op_id, AccessKind access_kind,
+                           SpatialTrace &spatial_trace);
+
+  // Add a unit of count to the running kernel summary, see Trace::summarize
+  void update_summary(u64 pc, u64 memory_op_id, AccessKind access_kind, u64 count,
+                      SpatialMaxCount &max_count);
 
   void transform_spatial_statistics(u32 cubin_id, const SymbolVector &symbols,
                                     SpatialStatistics &spatial_stats);
 
+  /**
+   * @brief Scale sampled counts back to estimates of full counts
+   *
+   * @param scale see redshow_sampling_scale_get
+   * @param record_data views already picked
+   * @param spatial_stats
+   * @param kernel_spatial_count
+   */
+  void scale_spatial_statistics(double scale, redshow_record_data_t &record_data,
+                                SpatialStatistics &spatial_stats, u64 &kernel_spatial_count);
+
  private:
   struct RedundancyTrace final : public Trace {
     // Spatial redundancy
@@ -91,13 +131,79 @@ class SpatialRedundancy final : public Analysis {
     PCAccessCount read_pc_count;
     PCAccessCount write_pc_count;
 
+    // Only kept for Trace::summarize
+    SpatialMaxCount read_max_count;
+    SpatialMaxCount write_max_count;
+
     RedundancyTrace() = default;
 
     virtual ~RedundancyTrace() {}
   };
 
+  // Records of REDSHOW_OUTPUT_BINARY, see record_tables
+  enum RecordTableId : u32 {
+    RECORD_TABLE_KERNEL = 1,
+    RECORD_TABLE_THREAD = 2,
+    RECORD_TABLE_SPATIAL = 3,
+  };
+
+  struct KernelRecord {
+    u64 redundant_access_count;
+    u64 total_access_count;
+    i32 kernel_id;
+  };
+
+  struct ThreadRecord {
+    u64 redundant_access_count;
+    u64 total_access_count;
+    u32 cpu_thread;
+  };
+
+  // rate is count / access_count, norm_rate is count / total_access_count of the kernel
+  struct SpatialRecord {
+    u64 memory_op_id;
+    u64 pc_offset;
+    u64 value;
+    u64 count;
+    u64 access_count;
+    u32 cubin_id;
+    u32 function_index;
+    u32 access_kind;
+  };
+
+  static Vector<RecordTable> record_tables();
+
+  // Outputs of a thread, kernels flushed early and at flush_thread append to the same files
+  struct ThreadResult {
+    // REDSHOW_OUTPUT_BINARY
+    bool binary;
+    std::ofstream out_read;
+    std::ofstream out_write;
+    RecordWriter records_read;
+    RecordWriter records_write;
+    u64 count;
+    u64 read_spatial_count;
+    u64 write_spatial_count;
+
+    ThreadResult() : binary(false), count(0), read_spatial_count(0), write_spatial_count(0) {}
+  };
+
+  ThreadResult &thread_result(u32 cpu_thread, const std::string &output_dir);
+
+  // Show or write the results of a kernel or a thread in the output format of thread_result
+  void output_spatial_trace(u32 cpu_thread, i32 kernel_id, u64 total_red_count, u64 total_count,
+                            SpatialStatistics &spatial_stats, bool is_thread, bool read,
+                            ThreadResult &thread_result);
+
+  void flush_trace(u32 cpu_thread, i32 kernel_id, RedundancyTrace &trace,
+                   const LockableMap<u32, Cubin> &cubins,
+                   redshow_record_data_callback_func record_data_callback,
+                   ThreadResult &thread_result);
+
  private:
   static inline thread_local std::shared_ptr<RedundancyTrace> _trace;
+
+  Map<u32, ThreadResult> _thread_results;
 };
 
 }  // namespace redshow
@@ -17,6 +17,7 @@
 #include <tuple>
 
 #include "analysis.h"
+#include "analysis/record_file.h"
 #include "binutils/instruction.h"
 #include "binutils/real_pc.h"
 #include "common/map.h"
@@ -56,6 +57,18 @@ class TemporalRedundancy final : public Analysis {
   virtual void flush(const std::string &output_dir, const LockableMap<u32, Cubin> &cubins,
                      redshow_record_data_callback_func record_data_callback);
 
+  virtual void flush_kernel(u32 cpu_thread, i32 kernel_id, const std::string &output_dir,
+                            const LockableMap<u32, Cubin> &cubins,
+                            redshow_record_data_callback_func record_data_callback);
+
+ protected:
+  // Spilling of traces, see Analysis::trace_end
+  virtual size_t trace_size(const Trace &trace) const;
+
+  virtual void save_trace(const Trace &trace, BinaryWriter &writer) const;
+
+  virtual std::shared_ptr<Trace> load_trace(BinaryReader &reader) const;
+
  private:
   // {ThreadId : {address : {<pc, value>}}}
   typedef Map<ThreadId, Map<u64, std::pair<u64, u64>>> TemporalTrace;
@@ -71,6 +84,11 @@ class TemporalRedundancy final : public Analysis {
   void show_temporal_trace(u32 cpu_thread, i32 kernel_id, u64 total_red_count, u64 total_count,
                            TemporalStatistics &temporal_stats, bool is_thread, std::ofstream &out);
 
+  // REDSHOW_OUTPUT_BINARY counterpart of show_temporal_trace
+  void write_temporal_records(u32 cpu_thread, i32 kernel_id, u64 total_red_count, u64 total_count,
+                              TemporalStatistics &temporal_stats, bool is_thread,
+                              RecordWriter &records);
+
   /**
    * @brief Update the temporal trace object
    *
@@ -81,13 +99,25 @@ class TemporalRedundancy final : public Analysis {
    * @param access_kind
    * @param temporal_trace
    * @param pc_pairs
+   * @return bool Whether the access repeats the previous value at addr
    */
-  void update_temporal_trace(u64 pc, ThreadId tid, u64 addr, u64 value, AccessKind access_kind,
+  bool update_temporal_trace(u64 pc, ThreadId tid, u64 addr, u64 value, AccessKind access_kind,
                              TemporalTrace &temporal_trace, PCPairs &pc_pairs);
 
   void transform_temporal_statistics(uint32_t cubin_id, const SymbolVector &symbols,
                                      TemporalStatistics &temporal_stats);
 
+  /**
+   * @brief Scale sampled counts back to estimates of full counts
+   *
+   * @param scale see redshow_sampling_scale_get
+   * @param record_data views already picked
+   * @param temporal_stats
+   * @param kernel_temporal_count
+   */
+  void scale_temporal_statistics(double scale, redshow_record_data_t &record_data,
+                                 TemporalStatistics &temporal_stats, u64 &kernel_temporal_count);
+
  private:
   struct RedundancyTrace final : public Trace {
     // Temporal redundancy
@@ -103,8 +133,71 @@ class TemporalRedundancy final : public Analysis {
     virtual ~RedundancyTrace() {}
   };
 
+  // Records of REDSHOW_OUTPUT_BINARY, see record_tables
+  enum RecordTableId : u32 {
+    RECORD_TABLE_KERNEL = 1,
+    RECORD_TABLE_THREAD = 2,
+    RECORD_TABLE_TEMPORAL = 3,
+  };
+
+  struct KernelRecord {
+    u64 redundant_access_count;
+    u64 total_access_count;
+    i32 kernel_id;
+  };
+
+  struct ThreadRecord {
+    u64 redundant_access_count;
+    u64 total_access_count;
+    u32 cpu_thread;
+  };
+
+  // rate is count / access_count, norm_rate is count / total_access_count of the kernel
+  struct TemporalRecord {
+    u64 from_pc_offset;
+    u64 to_pc_offset;
+    u64 value;
+    u64 count;
+    u64 access_count;
+    u32 cubin_id;
+    u32 from_function_index;
+    u32 to_function_index;
+    u32 access_kind;
+  };
+
+  static Vector<RecordTable> record_tables();
+
+  // Outputs of a thread, kernels flushed early and at flush_thread append to the same files
+  struct ThreadResult {
+    // REDSHOW_OUTPUT_BINARY
+    bool binary;
+    std::ofstream out_read;
+    std::ofstream out_write;
+    RecordWriter records_read;
+    RecordWriter records_write;
+    u64 count;
+    u64 read_temporal_count;
+    u64 write_temporal_count;
+
+    ThreadResult() : binary(false), count(0), read_temporal_count(0), write_temporal_count(0) {}
+  };
+
+  ThreadResult &thread_result(u32 cpu_thread, const std::string &output_dir);
+
+  // Show or write the results of a kernel or a thread in the output format of thread_result
+  void output_temporal_trace(u32 cpu_thread, i32 kernel_id, u64 total_red_count, u64 total_count,
+                             TemporalStatistics &temporal_stats, bool is_thread, bool read,
+                             ThreadResult &thread_result);
+
+  void flush_trace(u32 cpu_thread, i32 kernel_id, RedundancyTrace &trace,
+                   const LockableMap<u32, Cubin> &cubins,
+                   redshow_record_data_callback_func record_data_callback,
+                   ThreadResult &thread_result);
+
  private:
   static inline thread_local std::shared_ptr<RedundancyTrace> _trace;
+
+  Map<u32, ThreadResult> _thread_results;
 };
 
 }  // namespace redshow
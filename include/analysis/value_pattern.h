@@ -13,8 +13,11 @@
 #include <tuple>
 
 #include "analysis.h"
+#include "analysis/items_value_count.h"
+#include "analysis/record_file.h"
 #include "binutils/instruction.h"
 #include "binutils/real_pc.h"
+#include "common/distinct_sketch.h"
 #include "common/map.h"
 #include "common/utils.h"
 #include "common/vector.h"
@@ -41,6 +44,9 @@ class ValuePattern final : public Analysis {
 
   virtual void block_exit(const ThreadId &thread_id);
 
+  // Online accumulators and bounded items evict by counts seen so far, which depend on order
+  virtual bool order_sensitive() const;
+
   virtual void unit_access(i32 kernel_id, const ThreadId &thread_id, const AccessKind &access_kind,
                            const Memory &memory, u64 pc, u64 value, u64 addr, u32 index,
                            GPUPatchFlags flags);
@@ -53,16 +59,32 @@ class ValuePattern final : public Analysis {
   virtual void flush(const std::string &output_dir, const LockableMap<u32, Cubin> &cubins,
                      redshow_record_data_callback_func record_data_callback);
 
+  virtual void flush_kernel(u32 cpu_thread, i32 kernel_id, const std::string &output_dir,
+                            const LockableMap<u32, Cubin> &cubins,
+                            redshow_record_data_callback_func record_data_callback);
+
   ~ValuePattern() {}
 
+ protected:
+  // Spilling of traces, see Analysis::trace_end
+  virtual size_t trace_size(const Trace &trace) const;
+
+  virtual void save_trace(const Trace &trace, BinaryWriter &writer) const;
+
+  virtual std::shared_ptr<Trace> load_trace(BinaryReader &reader) const;
+
  private:
+  // Values reported per array
+  static constexpr size_t _TOP_NUM_VALUE = 10;
+  // Values tracked per array in the online mode
+  static constexpr size_t _TOP_VALUES = 32;
+
   struct ValueDistMemoryComp {
     bool operator()(const Memory &l, const Memory &r) const { return l.op_id < r.op_id; }
   };
 
-  // <Offset, <Value, Count>>
-  typedef Map<u64, u64> ValueCount;
-  typedef Map<u64, ValueCount> ItemsValueCount;
+  // <Value, Count>
+  typedef ItemsValueCount::ValueCount ValueCount;
   typedef std::map<Memory, Map<AccessKind, ItemsValueCount>, ValueDistMemoryComp> ValueDist;
   typedef std::map<Memory, Map<AccessKind, ValueCount>, ValueDistMemoryComp> ValueDistCompact;
 
@@ -101,18 +123,189 @@ class ValuePattern final : public Analysis {
     int unique_item_count;
     //  The sum access number of unique value
     u64 unique_item_access_count;
-    Vector<std::pair<u64, u64>> unqiue_value_count_vec;
+    //  How many distinct values unique items have
+    u64 unique_value_count;
     u64 total_access_count;
     //    for structured pattern
     double k, b, mse;
+    // Sampling past the value pattern limits, see ItemsValueCount
+    u64 sampling_stride;
+    u64 untracked_access_count;
+    u64 evicted_access_count;
     Vector<ValuePatternType> vpts;
 
     ArrayPatternInfo() = default;
 
     uint8_t read_flag;
 
+    // Counts are reported even if no pattern analysis runs, e.g., for shared memory
     ArrayPatternInfo(const AccessKind &access_kind, const Memory &memory)
-        : access_kind(access_kind), memory(memory) {}
+        : access_kind(access_kind),
+          memory(memory),
+          unique_item_count(0),
+          unique_item_access_count(0),
+          unique_value_count(0),
+          total_access_count(0),
+          k(0),
+          b(0),
+          mse(0),
+          sampling_stride(1),
+          untracked_access_count(0),
+          evicted_access_count(0),
+          read_flag(0) {}
+  };
+
+  // Records of REDSHOW_OUTPUT_BINARY, see record_tables
+  enum RecordTableId : u32 {
+    RECORD_TABLE_KERNEL = 1,
+    RECORD_TABLE_ARRAY = 2,
+    // Patterns of each allocation over all kernels
+    RECORD_TABLE_ARRAY_SUMMARY = 3,
+  };
+
+  struct KernelRecord {
+    i32 kernel_id;
+  };
+
+  // An ArrayPatternInfo, with a bit per ValuePatternType in patterns
+  struct ArrayPatternRecord {
+    u64 memory_size;
+    u64 total_access_count;
+    u64 unique_item_access_count;
+    u64 unique_value_count;
+    u64 sampling_stride;
+    u64 untracked_access_count;
+    u64 evicted_access_count;
+    double k;
+    double b;
+    double mse;
+    u64 top_values[_TOP_NUM_VALUE];
+    u64 top_counts[_TOP_NUM_VALUE];
+    i32 array_id;
+    i32 unique_item_count;
+    u32 access_kind;
+    u32 patterns;
+    u32 narrow_signed_unit_size;
+    u32 narrow_unsigned_unit_size;
+    u32 narrow_tail_unit_size;
+    u32 top_value_count;
+    u8 read;
+    u8 approximate;
+  };
+
+  static Vector<RecordTable> record_tables();
+
+  // Accumulated over the items of an array by dense_value_item, reused across arrays
+  struct DenseValueState {
+    u64 number_of_items;
+    int unique_item_count;
+    u64 total_access_count;
+    u64 total_unique_item_access_count;
+    ValueCount unique_value_count;
+    Vector<std::pair<u64, u64>> unique_value_count_vec;
+    //     <signed_leading_zero_bits, unsigned_leading_zero_bits, tail_zero_bits>
+    std::tuple<int, int, int> redundant_zero_bits;
+    bool inappropriate_float_type;
+    bool possible_float_type_overuse;
+    bool all_first_20bits_double_same;
+    bool all_first_9bits_float_same;
+    u64 last_first_20bits_double;
+    u64 last_first_9bits_float;
+    int max_exponents_double;
+    int max_exponents_float;
+
+    void clear(const AccessKind &access_kind) {
+      number_of_items = 0;
+      unique_item_count = 0;
+      total_access_count = 0;
+      total_unique_item_access_count = 0;
+      unique_value_count.clear();
+      unique_value_count_vec.clear();
+      redundant_zero_bits =
+          std::make_tuple(access_kind.unit_size, access_kind.unit_size, access_kind.unit_size);
+      inappropriate_float_type = true;
+      possible_float_type_overuse = true;
+      all_first_20bits_double_same = true;
+      all_first_9bits_float_same = true;
+      last_first_20bits_double = 0;
+      last_first_9bits_float = 0;
+      max_exponents_double = 0;
+      max_exponents_float = 0;
+    }
+  };
+
+  // Single-pass accumulators of the values of an array, memory is bounded regardless of the trace
+  struct ArrayValueSummary {
+    AccessKind access_kind;
+    u64 total_access_count;
+    // Minimum <signed_leading_zero_bits, unsigned_leading_zero_bits, tail_zero_bits>
+    std::tuple<int, int, int> redundant_zero_bits;
+    bool float_no_decimal;
+    // See check_exponent_and_fraction
+    bool possible_float_type_overuse;
+    bool all_first_Xbits_same;
+    u64 last_first_Xbits;
+    int max_exponents;
+    bool single_value;
+    u64 first_value;
+    DistinctSketch items;
+    DistinctSketch values;
+    DistinctSketch item_values;
+    // Heavy hitters by the space-saving algorithm, <Value, Count>
+    ValueCount top_values;
+    // Least squares of values over offsets
+    double sum_x, sum_y, sum_xx, sum_xy, sum_yy;
+    // Values of float arrays at REDSHOW_APPROX_MAX
+    std::shared_ptr<ArrayValueSummary> approx;
+
+    ArrayValueSummary(const AccessKind &access_kind)
+        : access_kind(access_kind),
+          total_access_count(0),
+          redundant_zero_bits(access_kind.unit_size, access_kind.unit_size, access_kind.unit_size),
+          float_no_decimal(true),
+          possible_float_type_overuse(true),
+          all_first_Xbits_same(true),
+          last_first_Xbits(0),
+          max_exponents(0),
+          single_value(true),
+          first_value(0),
+          sum_x(0),
+          sum_y(0),
+          sum_xx(0),
+          sum_xy(0),
+          sum_yy(0) {}
+  };
+
+  typedef std::map<Memory, Map<AccessKind, ArrayValueSummary>, ValueDistMemoryComp>
+      ValueSummaryDist;
+
+  // Scratch buffers of check_pattern_for_value_dist, one per flush thread
+  struct DenseValueScratch {
+    DenseValueState state;
+    DenseValueState state_approx;
+    Vector<std::pair<u64, u64>> values;
+    Vector<std::pair<u64, u64>> values_approx;
+  };
+
+  // An array classified at flush, arrays are independent and their reports are written in order
+  struct ArrayPatternTask {
+    const Memory *memory;
+    const AccessKind *access_kind;
+    const ItemsValueCount *array_items;
+    const ArrayValueSummary *summary;
+    // Built from array_items for the summary of all kernels
+    std::shared_ptr<ArrayValueSummary> array_summary;
+    uint8_t read_flag;
+    std::string report;
+    // REDSHOW_OUTPUT_BINARY, access kinds are resolved when records are written in order
+    Vector<ArrayPatternRecord> records;
+
+    ArrayPatternTask(const Memory &memory, const AccessKind &access_kind, uint8_t read_flag)
+        : memory(&memory),
+          access_kind(&access_kind),
+          array_items(NULL),
+          summary(NULL),
+          read_flag(read_flag) {}
   };
 
   struct ValuePatternTrace final : public Trace {
@@ -120,43 +313,145 @@ class ValuePattern final : public Analysis {
     ValueDist r_value_dist;
     ValueDistCompact w_value_dist_compact;
     ValueDistCompact r_value_dist_compact;
-
-    ValuePatternTrace() = default;
+    // REDSHOW_VALUE_PATTERN_ONLINE
+    bool online;
+    ValueSummaryDist w_value_summary;
+    ValueSummaryDist r_value_summary;
+    // Approximation of float units, resolved at analysis_begin
+    u64 float_mask;
+    u64 double_mask;
+    // Limits of array items, 0 if unlimited
+    u64 max_items;
+    u64 max_values;
+    // Distinct <array, offset, value> of both directions, only kept for Trace::summarize
+    DistinctSketch summary_item_values;
+
+    ValuePatternTrace()
+        : online(false),
+          float_mask(0xffffffffffffffffu),
+          double_mask(0xffffffffffffffffu),
+          max_items(0),
+          max_values(0) {}
 
     virtual ~ValuePatternTrace() {}
   };
 
+  // Output of a thread, kernels flushed early and at flush_thread append to the same file
+  struct ThreadResult {
+    // REDSHOW_OUTPUT_BINARY
+    bool binary;
+    std::ofstream out;
+    RecordWriter records;
+    // Patterns of each allocation over all kernels
+    ValueSummaryDist r_value_summary_sum;
+    ValueSummaryDist w_value_summary_sum;
+
+    ThreadResult() : binary(false) {}
+  };
+
  private:
-  void dense_value_pattern(ItemsValueCount &array_items, ArrayPatternInfo &array_pattern_info);
+  // Get or create the items of an array, sized by the memory it belongs to
+  ItemsValueCount &array_items(ValueDist &value_dist, const Memory &memory,
+                               const AccessKind &access_kind, u64 max_items, u64 max_values);
+
+  // Accumulate the values of an item, sorted by value
+  void dense_value_item(DenseValueState &state, const AccessKind &access_kind,
+                        const Vector<std::pair<u64, u64>> &values);
+
+  // Classify patterns of accumulated items, approx if their values were approximated
+  void dense_value_pattern(DenseValueState &state, const ItemsValueCount &array_items, bool approx,
+                           ArrayPatternInfo &array_pattern_info);
+
+  u64 approximate_value(u64 value, const AccessKind &access_kind);
+
+  // Summarize a unit, units of unknown types are summarized as both int and float
+  void summarize_access(ValueSummaryDist &value_summary, const Memory &memory,
+                        const AccessKind &access_kind, u64 offset, u64 value);
+
+  ArrayValueSummary &array_summary(ValueSummaryDist &value_summary, const Memory &memory,
+                                   const AccessKind &access_kind);
+
+  // Float arrays of 32 and 64 bits are also summarized at REDSHOW_APPROX_MAX
+  void init_approx(ArrayValueSummary &summary);
 
-  bool approximate_value_pattern(ItemsValueCount &array_items, ArrayPatternInfo &array_pattern_info,
-                                 ArrayPatternInfo &array_pattern_info_approx);
+  void summarize_value(ArrayValueSummary &summary, u64 offset, u64 value, u64 count = 1);
 
-  void show_value_pattern(ArrayPatternInfo &array_pattern_info, std::ofstream &out,
+  // Fold other into summary, e.g., the same array of another kernel
+  void merge_value_summary(ArrayValueSummary &summary, const ArrayValueSummary &other);
+
+  // Classify patterns from accumulators, distinct counts are estimates
+  void online_value_pattern(const ArrayValueSummary &summary, ArrayPatternInfo &array_pattern_info);
+
+  // Classify a summarized array, return whether its approximate patterns are reported
+  bool check_pattern_for_value_summary(const ArrayPatternTask &task,
+                                       ArrayPatternInfo &array_pattern_info,
+                                       ArrayPatternInfo &array_pattern_info_approx);
+
+  bool same_value_patterns(Vector<ValuePatternType> vpts, Vector<ValuePatternType> new_vpts);
+
+  void show_value_pattern(const ArrayPatternInfo &array_pattern_info, std::ostream &out,
                           uint8_t read_flag);
 
-  void detect_type_overuse(std::tuple<int, int, int> &redundant_zero_bits, AccessKind &accessKind,
+  void add_pattern_record(const ArrayPatternInfo &array_pattern_info, bool approximate,
+                          ArrayPatternTask &task);
+
+  void detect_type_overuse(const std::tuple<int, int, int> &redundant_zero_bits,
+                           const AccessKind &accessKind,
                            std::tuple<int, int, int> &narrow_down_to_unit_size);
 
   void inline check_zeros_bits(int zeros_bits, int full, int &narrow_down_to);
 
   bool check_exponent_and_fraction(bool &all_first_Xbits_same, u64 &all_first_Xbits,
-                                   int &max_exponents_X, u64 value, AccessKind &accessKind);
+                                   int &max_exponents_X, u64 value, const AccessKind &accessKind);
+
+  bool detect_structrued_pattern(const ItemsValueCount &array_items, bool approx,
+                                 u64 number_of_items, ArrayPatternInfo &array_pattern_info);
+
+  bool float_no_decimal(u64 a, const AccessKind &accessKind);
 
-  bool detect_structrued_pattern(ItemsValueCount &array_items,
-                                 ArrayPatternInfo &array_pattern_info);
+  /**
+   * @brief Interpret arrays of unknown types as both int and float arrays
+   *
+   * @param value_dist
+   * @param float_mask approximation of 32-bit floats
+   * @param double_mask approximation of 64-bit floats
+   */
+  void resolve_unknown_types(ValueDist &value_dist, u64 float_mask, u64 double_mask,
+                             u64 max_items, u64 max_values);
 
-  bool float_no_decimal(u64 a, AccessKind &accessKind);
+  // Classify an array of full values, return whether its approximate patterns are reported
+  bool check_pattern_for_value_dist(const ArrayPatternTask &task, DenseValueScratch &scratch,
+                                    ArrayPatternInfo &array_pattern_info,
+                                    ArrayPatternInfo &array_pattern_info_approx);
 
-  void check_pattern_for_value_dist(ValueDist &value_dist, std::ofstream &out, uint8_t read_flag);
+  void add_pattern_tasks(const ValueDist &value_dist, uint8_t read_flag, bool summarize,
+                         Vector<ArrayPatternTask> &tasks);
 
-  std::tuple<int, int, int> get_redundant_zeros_bits(u64 a, AccessKind &accessKind);
+  void add_pattern_tasks(const ValueSummaryDist &value_summary, uint8_t read_flag,
+                         Vector<ArrayPatternTask> &tasks);
+
+  // Classify arrays in parallel, each task keeps its own report, or records if binary
+  void check_pattern_tasks(Vector<ArrayPatternTask> &tasks, bool binary);
+
+  // Write the reports of tasks [begin, end) in order
+  void write_pattern_tasks(Vector<ArrayPatternTask> &tasks, size_t begin, size_t end, u32 table,
+                           ThreadResult &thread_result);
+
+  // Report the arrays of traces in kernel order, and fold their summaries if summarize
+  void check_pattern_traces(Vector<std::shared_ptr<ValuePatternTrace>> &traces, bool summarize,
+                            ThreadResult &thread_result);
+
+  ThreadResult &thread_result(u32 cpu_thread, const std::string &output_dir);
+
+  std::tuple<int, int, int> get_redundant_zeros_bits(u64 a, const AccessKind &accessKind);
 
   void vp_approx_level_config(redshow_approx_level_t level, int &decimal_degree_f32,
                               int &decimal_degree_f64);
 
  private:
   static inline thread_local std::shared_ptr<ValuePatternTrace> _trace;
+
+  Map<u32, ThreadResult> _thread_results;
 };
 
 }  // namespace redshow
@@ -1,6 +1,7 @@
 #ifndef REDSHOW_BINUTILS_CUBIN_H
 #define REDSHOW_BINUTILS_CUBIN_H
 
+#include <future>
 #include <memory>
 #include <string>
 
@@ -8,6 +9,8 @@
 #include "common/utils.h"
 #include "common/vector.h"
 #include "instruction.h"
+#include "lazy_instruction_graph.h"
+#include "pc_table.h"
 #include "symbol.h"
 
 namespace redshow {
@@ -17,11 +20,18 @@ struct Cubin {
   std::string path;
   // <mod_id, [symbols]>
   Map<u32, SymbolVector> symbols;
-  InstructionGraph inst_graph;
+  // Shared with trace analysis threads, NULL until the graph is available
+  std::shared_ptr<InstructionGraph> inst_graph;
+  // Only set in lazy mode
+  std::shared_ptr<LazyInstructionGraph> lazy_inst_graph;
+  // Only set in async mode, ready once inst_graph is published
+  std::shared_future<std::shared_ptr<InstructionGraph>> inst_graph_future;
+  // <mod_id, pc table>, built on first trace once inst_graph is available
+  Map<u32, std::shared_ptr<PCTable>> pc_tables;
 
   Cubin() = default;
 
-  Cubin(u32 cubin_id, const std::string &path, InstructionGraph &inst_graph)
+  Cubin(u32 cubin_id, const std::string &path, std::shared_ptr<InstructionGraph> inst_graph)
       : cubin_id(cubin_id), path(path), inst_graph(inst_graph) {}
 };
 
@@ -6,10 +6,12 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "common/graph.h"
 #include "common/utils.h"
+#include "common/vector.h"
 #include "redshow.h"
 
 namespace redshow {
@@ -28,20 +30,24 @@ struct AccessKind {
 
   u64 value_to_basic_type(u64 a, int decimal_degree_f32, int decimal_degree_f64);
 
-  std::string value_to_string(u64 a, bool is_signed);
+  // value_to_basic_type(a) == a & value_mask(), resolve it once to canonicalize many values
+  u64 value_mask(int decimal_degree_f32, int decimal_degree_f64) const;
 
-  std::string to_string() {
-    std::stringstream ss;
+  std::string value_to_string(u64 a, bool is_signed) const;
+
+  // Called once per output row, no stream is built
+  std::string to_string() const {
+    std::string str;
     if (data_type == REDSHOW_DATA_UNKNOWN) {
-      ss << "UNKNOWN";
+      str = "UNKNOWN";
     } else if (data_type == REDSHOW_DATA_INT) {
-      ss << "INTEGER";
+      str = "INTEGER";
     } else if (data_type == REDSHOW_DATA_FLOAT) {
-      ss << "FLOAT";
+      str = "FLOAT";
     }
-    ss << ",v:" << vec_size;
-    ss << ",u:" << unit_size;
-    return ss.str();
+    str += ",v:" + std::to_string(vec_size);
+    str += ",u:" + std::to_string(unit_size);
+    return str;
   }
 
   bool operator<(const AccessKind &other) const {
@@ -55,12 +61,44 @@ struct AccessKind {
   }
 };
 
+/*
+ * Opcode tokens decoded once from Instruction::op. Each flag records whether the token appears in
+ * the opcode string, so INST_WIDTH_* may be set together, e.g., for F2F.F64.F32.
+ */
+enum InstructionFlag : u32 {
+  INST_NONE = 0,
+  INST_MEMORY = 0x1,         // MEMORY
+  INST_LOAD = 0x2,           // .LOAD
+  INST_STORE = 0x4,          // .STORE
+  INST_STORE_ANY = 0x8,      // STORE
+  INST_SHARED = 0x10,        // .SHARED
+  INST_LOCAL = 0x20,         // .LOCAL
+  INST_MOVE = 0x40,          // MOVE
+  INST_UNIFORM = 0x80,       // UNIFORM
+  INST_INTEGER = 0x100,      // INTEGER
+  INST_FLOAT = 0x200,        // FLOAT
+  INST_CONVERT = 0x400,      // CONVERT
+  INST_I2F = 0x800,          // .I2F
+  INST_F2F = 0x1000,         // .F2F
+  INST_F2I = 0x2000,         // .F2I
+  INST_I2I = 0x4000,         // .I2I
+  INST_64_TO_32 = 0x8000,    // ._64_TO_32
+  INST_32_TO_64 = 0x10000,   // ._32_TO_64
+  INST_WIDTH_8 = 0x20000,    // .8
+  INST_WIDTH_16 = 0x40000,   // .16
+  INST_WIDTH_32 = 0x80000,   // .32
+  INST_WIDTH_64 = 0x100000,  // .64
+  INST_WIDTH_128 = 0x200000  // .128
+};
+
 /*
  * A copy-paste struct from hpctoolkit
  */
 
 struct Instruction {
   std::string op;
+  // InstructionFlag bits of op
+  u32 flags;
   unsigned int pc;
   int predicate;           // P0-P6
   std::vector<int> dsts;   // R0-R255: only records normal registers
@@ -75,6 +113,7 @@ struct Instruction {
   Instruction(const std::string &op, unsigned int pc, int predicate, std::vector<int> &dsts,
               std::vector<int> &srcs, std::map<int, std::vector<int> > &assign_pcs)
       : op(op),
+        flags(decode_op(op)),
         pc(pc),
         predicate(predicate),
         dsts(dsts),
@@ -87,6 +126,7 @@ struct Instruction {
               std::map<int, std::vector<int> > &assign_pcs,
               std::map<int, std::vector<int> > &uassign_pcs)
       : op(op),
+        flags(decode_op(op)),
         pc(pc),
         predicate(predicate),
         dsts(dsts),
@@ -97,7 +137,32 @@ struct Instruction {
         uassign_pcs(uassign_pcs),
         access_kind(NULL) {}
 
-  Instruction() : access_kind(NULL) {}
+  Instruction() : flags(INST_NONE), access_kind(NULL) {}
+
+  void set_op(const std::string_view &op) {
+    this->op.assign(op.data(), op.size());
+    this->flags = decode_op(op);
+  }
+
+  bool has(u32 flag) const noexcept { return (flags & flag) != 0; }
+
+  // Width of the widest token, .128 first
+  u32 vec_size() const noexcept {
+    if (flags & INST_WIDTH_128) {
+      return 128;
+    } else if (flags & INST_WIDTH_64) {
+      return 64;
+    } else if (flags & INST_WIDTH_32) {
+      return 32;
+    } else if (flags & INST_WIDTH_16) {
+      return 16;
+    } else if (flags & INST_WIDTH_8) {
+      return 8;
+    }
+    return 0;
+  }
+
+  static u32 decode_op(const std::string_view &op) noexcept;
 
   bool operator<(const Instruction &other) const { return this->pc < other.pc; }
 };
@@ -126,10 +191,28 @@ struct InstructionDependencyIndex {
   }
 };
 
-typedef Graph<u64, Instruction, InstructionDependencyIndex, InstructionDependency> InstructionGraph;
+// Instruction graphs are frozen after parsing
+typedef CSRGraph<u64, Instruction, InstructionDependencyIndex, InstructionDependency>
+    InstructionGraph;
+
+// Location of a function object in an .inst file
+struct InstructionFunctionRange {
+  u32 function_index;
+  u64 cubin_offset;
+  // [begin, end) byte offsets in the file
+  u64 begin;
+  u64 end;
+
+  InstructionFunctionRange() = default;
+
+  InstructionFunctionRange(u32 function_index, u64 cubin_offset, u64 begin, u64 end)
+      : function_index(function_index), cubin_offset(cubin_offset), begin(begin), end(end) {}
+};
 
 class SymbolVector;
 
+class JsonReader;
+
 class InstructionParser {
  public:
   InstructionParser() = default;
@@ -144,7 +227,45 @@ class InstructionParser {
    */
   static bool parse(const std::string &file_path, SymbolVector &symbols, InstructionGraph &graph);
 
+  /**
+   * @brief Locate functions in an .inst buffer without reading their instructions
+   *
+   * @param begin
+   * @param end
+   * @param symbols filled with function symbols
+   * @param ranges byte ranges of function objects relative to begin
+   * @return true
+   * @return false
+   */
+  static bool index(const char *begin, const char *end, SymbolVector &symbols,
+                    Vector<InstructionFunctionRange> &ranges);
+
+  /**
+   * @brief Parse a single function object located by index() and analyze its access kinds
+   *
+   * @param begin
+   * @param end
+   * @param graph a frozen graph of the function's instructions
+   * @return true
+   * @return false
+   */
+  static bool parse_function(const char *begin, const char *end, InstructionGraph &graph);
+
  private:
+  // Build dependencies, freeze, and infer access kinds of memory instructions
+  static void analyze(InstructionGraph &inst_graph);
+
+  // Streaming readers over the mmap'd .inst file, return false on malformed input
+  static bool read_function(JsonReader &reader, int &function_index, int &cubin_offset,
+                            std::vector<Instruction> &insts);
+
+  static bool read_instruction(JsonReader &reader, Instruction &inst);
+
+  static bool read_sources(JsonReader &reader, const std::string_view &assign_key,
+                           std::vector<int> &srcs, std::map<int, std::vector<int> > &assign_pcs);
+
+  static bool read_registers(JsonReader &reader, std::vector<int> &regs);
+
   static void default_access_kind(Instruction &inst);
 
   static AccessKind init_access_kind(Instruction &inst, InstructionGraph &inst_graph,
@@ -0,0 +1,121 @@
+#ifndef REDSHOW_BINUTILS_INSTRUCTION_CACHE_H
+#define REDSHOW_BINUTILS_INSTRUCTION_CACHE_H
+
+#include <string>
+
+#include "binutils/instruction.h"
+#include "binutils/symbol.h"
+#include "common/utils.h"
+#include "common/vector.h"
+#include "redshow.h"
+
+namespace redshow {
+
+/*
+ * Identifies the .inst file a cache was built from. Access kinds depend on the default data type
+ * at the time of inference, so it is part of the key.
+ */
+struct InstructionCacheKey {
+  u64 content_hash;
+  u64 content_size;
+  redshow_data_type_t default_data_type;
+
+  InstructionCacheKey() : InstructionCacheKey(0, 0, REDSHOW_DATA_UNKNOWN) {}
+
+  InstructionCacheKey(u64 content_hash, u64 content_size, redshow_data_type_t default_data_type)
+      : content_hash(content_hash),
+        content_size(content_size),
+        default_data_type(default_data_type) {}
+};
+
+/*
+ * A binary image of a parsed .inst file, stored next to it as <name>.inst.cache.
+ *
+ * Layout, all sections are 8-byte aligned fixed-width arrays in host byte order:
+ *   Header
+ *   Entry    symbols[num_symbols]
+ *   Node     nodes[num_nodes]       sorted by pc
+ *   Edge     edges[num_edges]       sorted by <from, to>
+ *   char     ops[ops_size]          op strings referenced by nodes
+ *
+ * Register operands are not stored, they are only used by access kind inference.
+ */
+class InstructionCache {
+ public:
+  static const u32 VERSION = 1;
+
+  /**
+   * @brief Load a cache if it exists and matches the key
+   *
+   * @param cache_path
+   * @param key
+   * @param symbols filled with function symbols
+   * @param inst_graph filled and frozen, only touched on success
+   * @return true on a cache hit
+   */
+  static bool load(const std::string &cache_path, const InstructionCacheKey &key,
+                   SymbolVector &symbols, InstructionGraph &inst_graph);
+
+  /**
+   * @brief Write a cache atomically, failures are ignored by callers
+   *
+   * @param cache_path
+   * @param key
+   * @param functions function symbols read from the .inst file
+   * @param inst_graph a frozen graph
+   * @return true if the cache is written
+   */
+  static bool store(const std::string &cache_path, const InstructionCacheKey &key,
+                    const Vector<Symbol> &functions, const InstructionGraph &inst_graph);
+
+ private:
+  struct Header {
+    char magic[8];
+    u32 version;
+    u32 header_size;
+    u64 content_hash;
+    u64 content_size;
+    i32 default_data_type;
+    u32 reserved;
+    u64 num_symbols;
+    u64 num_nodes;
+    u64 num_edges;
+    u64 ops_size;
+  };
+
+  struct Entry {
+    u64 index;
+    u64 offset;
+  };
+
+  // Symbol tables of cubins are far smaller, a larger index comes from a corrupt cache
+  static const u64 MAX_SYMBOL_INDEX = 1 << 20;
+
+  static const u32 NODE_ACCESS_KIND = 0x1;
+
+  struct Node {
+    u64 pc;
+    u32 op_offset;
+    u32 op_size;
+    i32 predicate;
+    u32 flags;
+    u32 vec_size;
+    u32 unit_size;
+    i32 data_type;
+    u32 reserved;
+  };
+
+  static const u32 EDGE_INTER_FUNCTION = 0x1;
+
+  struct Edge {
+    u64 from;
+    u64 to;
+    u64 flags;
+  };
+
+  static const char MAGIC[8];
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_BINUTILS_INSTRUCTION_CACHE_H
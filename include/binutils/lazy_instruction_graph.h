@@ -0,0 +1,73 @@
+#ifndef REDSHOW_BINUTILS_LAZY_INSTRUCTION_GRAPH_H
+#define REDSHOW_BINUTILS_LAZY_INSTRUCTION_GRAPH_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "binutils/instruction.h"
+#include "binutils/symbol.h"
+#include "common/mapped_file.h"
+#include "common/utils.h"
+#include "common/vector.h"
+
+namespace redshow {
+
+/*
+ * Per-function instruction graphs of a cubin, built on first use.
+ *
+ * open() only indexes function boundaries in the .inst file and keeps it mapped. A function is
+ * parsed and its access kinds are inferred the first time function_graph() is called for it.
+ * Dependencies never cross functions, so the results are identical to a full parse.
+ */
+class LazyInstructionGraph {
+ public:
+  LazyInstructionGraph() = default;
+
+  LazyInstructionGraph(const LazyInstructionGraph &other) = delete;
+
+  LazyInstructionGraph &operator=(const LazyInstructionGraph &other) = delete;
+
+  /**
+   * @brief Map an .inst file and index its functions
+   *
+   * @param file_path
+   * @param symbols filled with function symbols
+   * @return true
+   * @return false
+   */
+  bool open(const std::string &file_path, SymbolVector &symbols);
+
+  /**
+   * @brief Get the instruction graph of a function, analyzing it on first use
+   *
+   * @param function_index
+   * @return NULL if the function is not in the file, the graph is empty if it failed to parse
+   *
+   * @thread-safe: YES
+   */
+  const InstructionGraph *function_graph(u32 function_index);
+
+  // Number of functions analyzed so far
+  size_t analyzed() const noexcept { return _num_analyzed.load(std::memory_order_relaxed); }
+
+  size_t size() const noexcept { return _ranges.size(); }
+
+ private:
+  MappedFile _file;
+  Vector<InstructionFunctionRange> _ranges;
+  // <function_index, range position>
+  Vector<u32> _function_ranges;
+  // Graphs are published once and never freed before destruction
+  std::unique_ptr<std::atomic<const InstructionGraph *>[]> _graphs;
+  Vector<std::unique_ptr<InstructionGraph>> _owned_graphs;
+  std::atomic<size_t> _num_analyzed = 0;
+  std::mutex _lock;
+
+  static constexpr u32 _NO_RANGE = static_cast<u32>(-1);
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_BINUTILS_LAZY_INSTRUCTION_GRAPH_H
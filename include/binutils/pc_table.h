@@ -0,0 +1,78 @@
+#ifndef REDSHOW_BINUTILS_PC_TABLE_H
+#define REDSHOW_BINUTILS_PC_TABLE_H
+
+#include <memory>
+
+#include "binutils/instruction.h"
+#include "binutils/symbol.h"
+#include "common/utils.h"
+#include "common/vector.h"
+
+namespace redshow {
+
+/*
+ * A resolved pc: its function and its AccessKind packed into four bytes
+ */
+struct PCTableEntry {
+  u32 function_index;
+  u8 vec_size;
+  u8 unit_size;
+  u8 data_type;
+  u8 flags;
+
+  static constexpr u8 VALID = 0x1;
+  static constexpr u8 ACCESS_KIND = 0x2;
+
+  PCTableEntry() : function_index(0), vec_size(0), unit_size(0), data_type(0), flags(0) {}
+
+  bool has_access_kind() const noexcept { return flags & ACCESS_KIND; }
+
+  AccessKind access_kind() const noexcept {
+    return AccessKind(unit_size, vec_size, static_cast<redshow_data_type_t>(data_type));
+  }
+};
+
+/*
+ * Resolves runtime pcs of a (cubin, mod) pair with a single indexed load.
+ *
+ * Slots cover [base, base + size * INST_SIZE) and hold the result of
+ * SymbolVector::transform_pc followed by an instruction graph lookup.
+ * lookup() returns NULL for pcs the table cannot answer, callers fall back to the slow path.
+ */
+class PCTable {
+ public:
+  // SASS instructions are 16 bytes since Volta
+  static constexpr u64 INST_SIZE = 16;
+
+  PCTable() : _base(0) {}
+
+  /**
+   * @brief Build a table, empty if the pc range is too sparse for the instruction count
+   *
+   * @param symbols symbols of a module, sorted by pc
+   * @param inst_graph a frozen instruction graph of the cubin
+   */
+  void build(const SymbolVector &symbols, const InstructionGraph &inst_graph);
+
+  const PCTableEntry *lookup(u64 pc) const noexcept {
+    auto slot = (pc - _base) / INST_SIZE;
+    if (pc < _base || slot >= _entries.size() || (pc - _base) % INST_SIZE != 0) {
+      return NULL;
+    }
+    auto *entry = _entries.data() + slot;
+    return (entry->flags & PCTableEntry::VALID) ? entry : NULL;
+  }
+
+  size_t size() const noexcept { return _entries.size(); }
+
+ private:
+  u64 _base;
+  Vector<PCTableEntry> _entries;
+
+  // Maximum slots per instruction before giving up
+  static constexpr u64 _SPARSITY = 4;
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_BINUTILS_PC_TABLE_H
@@ -2,6 +2,8 @@
 #define REDSHOW_BINUTILS_SYMBOL_H
 
 #include <algorithm>
+#include <array>
+#include <limits>
 #include <optional>
 #include <tuple>
 
@@ -74,6 +76,51 @@ class SymbolVector : public Vector<Symbol> {
   }
 };
 
+/*
+ * A direct-mapped pc -> RealPC cache in front of SymbolVector::transform_pc.
+ *
+ * Meant to live for a single trace buffer, in which a few pcs repeat for every warp.
+ * Only successful resolutions are cached.
+ */
+class RealPCCache {
+ public:
+  static constexpr size_t SIZE = 256;
+
+  explicit RealPCCache(const SymbolVector &symbols) : _symbols(symbols), _hits(0), _misses(0) {
+    _pcs.fill(_EMPTY);
+  }
+
+  std::optional<RealPC> transform_pc(u64 pc) {
+    // Instructions are 16 bytes aligned
+    auto slot = (pc >> 4) & (SIZE - 1);
+    if (_pcs[slot] == pc) {
+      ++_hits;
+      return _real_pcs[slot];
+    }
+
+    ++_misses;
+    auto ret = _symbols.transform_pc(pc);
+    if (ret.has_value()) {
+      _pcs[slot] = pc;
+      _real_pcs[slot] = ret.value();
+    }
+    return ret;
+  }
+
+  u64 hits() const noexcept { return _hits; }
+
+  u64 misses() const noexcept { return _misses; }
+
+ private:
+  const SymbolVector &_symbols;
+  std::array<u64, SIZE> _pcs;
+  std::array<RealPC, SIZE> _real_pcs;
+  u64 _hits;
+  u64 _misses;
+
+  static constexpr u64 _EMPTY = std::numeric_limits<u64>::max();
+};
+
 }  // namespace redshow
 
 #endif  // REDSHOW_BINUTILS_SYMBOL_H
@@ -0,0 +1,92 @@
+#ifndef REDSHOW_COMMON_DISTINCT_SKETCH_H
+#define REDSHOW_COMMON_DISTINCT_SKETCH_H
+
+#include <iterator>
+
+#include "common/hash.h"
+#include "common/serialize.h"
+#include "common/set.h"
+#include "common/utils.h"
+
+namespace redshow {
+
+/*
+ * Estimates the number of distinct keys from the K smallest hashes seen (k minimum values).
+ * The count is exact until more than K distinct keys are added, memory is bounded by K.
+ */
+class DistinctSketch {
+ public:
+  DistinctSketch() : _dropped(false) {}
+
+  void add(u64 key) { add_hash(hash_mix64(key)); }
+
+  void merge(const DistinctSketch &other) {
+    for (auto hash : other._hashes) {
+      add_hash(hash);
+    }
+    _dropped |= other._dropped;
+  }
+
+  u64 estimate() const {
+    if (!_dropped) {
+      return _hashes.size();
+    }
+    // The K-th smallest of n uniform hashes is expected at K / n of the hash space
+    auto kth = static_cast<double>(*_hashes.rbegin()) / 18446744073709551616.0;
+    return static_cast<u64>((K - 1) / kth);
+  }
+
+  // Bytes held outside of the object
+  size_t bytes() const noexcept { return _hashes.size() * (MAP_NODE_OVERHEAD + sizeof(u64)); }
+
+  void save(BinaryWriter &writer) const {
+    u64 size = _hashes.size();
+    serialize(writer, _dropped);
+    serialize(writer, size);
+    for (auto hash : _hashes) {
+      serialize(writer, hash);
+    }
+  }
+
+  void load(BinaryReader &reader) {
+    DistinctSketch sketch;
+    u64 size = 0;
+    deserialize(reader, sketch._dropped);
+    deserialize(reader, size);
+    for (u64 i = 0; i < size && reader.good(); ++i) {
+      u64 hash = 0;
+      deserialize(reader, hash);
+      sketch.add_hash(hash);
+    }
+    *this = std::move(sketch);
+  }
+
+  static constexpr size_t K = 256;
+
+ private:
+  void add_hash(u64 hash) {
+    if (_hashes.size() == K && hash > *_hashes.rbegin()) {
+      _dropped = true;
+      return;
+    }
+    if (_hashes.insert(hash).second && _hashes.size() > K) {
+      _hashes.erase(std::prev(_hashes.end()));
+      _dropped = true;
+    }
+  }
+
+ private:
+  Set<u64> _hashes;
+  // Whether a hash of a distinct key was not kept, the count is exact until then
+  bool _dropped;
+};
+
+inline void serialize(BinaryWriter &writer, const DistinctSketch &sketch) { sketch.save(writer); }
+
+inline void deserialize(BinaryReader &reader, DistinctSketch &sketch) { sketch.load(reader); }
+
+inline size_t heap_size(const DistinctSketch &sketch) { return sketch.bytes(); }
+
+}  // namespace redshow
+
+#endif  // REDSHOW_COMMON_DISTINCT_SKETCH_H
@@ -1,8 +1,14 @@
 #ifndef REDSHOW_COMMON_GRAPH_H
 #define REDSHOW_COMMON_GRAPH_H
 
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
 #include "common/map.h"
 #include "common/set.h"
+#include "common/utils.h"
+#include "common/vector.h"
 
 namespace redshow {
 
@@ -113,6 +119,332 @@ class Graph {
   NodeMap _nodes;
 };
 
+/**
+ * @brief A frozen graph in compressed sparse row format for read-mostly graphs.
+ *
+ * Nodes and edges are staged with add_node/add_edge, then freeze() sorts them into contiguous
+ * arrays. After freezing, the topology cannot be changed, but nodes and edges are still mutable.
+ * Every edge index is stored once; incoming edges refer to it by position.
+ * Nodes are looked up in O(1) through a dense table when Index is an integral type with a regular
+ * stride (e.g., instruction pcs), otherwise through a binary search.
+ */
+template <typename Index, typename Node, typename EdgeIndex, typename Edge>
+class CSRGraph {
+ public:
+  typedef u32 Position;
+
+  static constexpr Position npos = std::numeric_limits<Position>::max();
+
+  class EdgeView {
+   public:
+    class iterator {
+     public:
+      iterator(const EdgeIndex *edges, const Position *positions, size_t i)
+          : _edges(edges), _positions(positions), _i(i) {}
+
+      const EdgeIndex &operator*() const {
+        return _positions == NULL ? _edges[_i] : _edges[_positions[_i]];
+      }
+
+      const EdgeIndex *operator->() const { return &(this->operator*()); }
+
+      iterator &operator++() {
+        ++_i;
+        return *this;
+      }
+
+      bool operator==(const iterator &other) const { return _i == other._i; }
+
+      bool operator!=(const iterator &other) const { return _i != other._i; }
+
+     private:
+      const EdgeIndex *_edges;
+      const Position *_positions;
+      size_t _i;
+    };
+
+    EdgeView(const EdgeIndex *edges, const Position *positions, size_t begin, size_t end)
+        : _edges(edges), _positions(positions), _begin(begin), _end(end) {}
+
+    iterator begin() const { return iterator(_edges, _positions, _begin); }
+
+    iterator end() const { return iterator(_edges, _positions, _end); }
+
+    size_t size() const { return _end - _begin; }
+
+   private:
+    const EdgeIndex *_edges;
+    const Position *_positions;
+    size_t _begin;
+    size_t _end;
+  };
+
+ public:
+  CSRGraph() : _frozen(false), _base(0), _stride(1) {}
+
+  // Construction methods, only valid before freeze()
+  template <typename... Args>
+  void add_node(const Index &index, Args &&... args) noexcept {
+    assert(!_frozen);
+    _indices.push_back(index);
+    _nodes.emplace_back(std::forward<Args>(args)...);
+  }
+
+  void reserve(size_t num_nodes, size_t num_edges) {
+    _indices.reserve(num_nodes);
+    _nodes.reserve(num_nodes);
+    _edge_indices.reserve(num_edges);
+    _edges.reserve(num_edges);
+  }
+
+  template <typename... Args>
+  void add_edge(const EdgeIndex &edge_index, Args &&... edge) noexcept {
+    assert(!_frozen);
+    _edge_indices.push_back(edge_index);
+    _edges.emplace_back(std::forward<Args>(edge)...);
+  }
+
+  /**
+   * @brief Sort staged nodes and edges into CSR arrays. Duplicate nodes and edges keep the first
+   * one added, edges whose endpoints are not nodes are dropped.
+   */
+  void freeze() {
+    if (_frozen) {
+      return;
+    }
+
+    // Sort nodes by index
+    Vector<Position> order(_indices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    if (!std::is_sorted(_indices.begin(), _indices.end())) {
+      std::stable_sort(order.begin(), order.end(),
+                       [&](Position l, Position r) { return _indices[l] < _indices[r]; });
+    }
+    Vector<Index> indices;
+    Vector<Node> nodes;
+    indices.reserve(order.size());
+    nodes.reserve(order.size());
+    for (auto i : order) {
+      if (!indices.empty() && !(indices.back() < _indices[i])) {
+        continue;
+      }
+      indices.push_back(_indices[i]);
+      nodes.emplace_back(std::move(_nodes[i]));
+    }
+    _indices.swap(indices);
+    _nodes.swap(nodes);
+    build_lookup();
+
+    // Sort edges by <from, to>
+    order.resize(_edge_indices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    if (!std::is_sorted(_edge_indices.begin(), _edge_indices.end())) {
+      std::stable_sort(order.begin(), order.end(), [&](Position l, Position r) {
+        return _edge_indices[l] < _edge_indices[r];
+      });
+    }
+    Vector<EdgeIndex> edge_indices;
+    Vector<Edge> edges;
+    edge_indices.reserve(order.size());
+    edges.reserve(order.size());
+    _outgoing_offsets.assign(_indices.size() + 1, 0);
+    _incoming_offsets.assign(_indices.size() + 1, 0);
+    for (auto i : order) {
+      auto &edge_index = _edge_indices[i];
+      if (!edge_indices.empty() && !(edge_indices.back() < edge_index)) {
+        continue;
+      }
+      auto from = position(edge_index.from);
+      auto to = position(edge_index.to);
+      if (from == npos || to == npos) {
+        continue;
+      }
+      edge_indices.push_back(edge_index);
+      edges.emplace_back(std::move(_edges[i]));
+      _outgoing_offsets[from + 1]++;
+      _incoming_offsets[to + 1]++;
+    }
+    _edge_indices.swap(edge_indices);
+    _edges.swap(edges);
+
+    for (size_t i = 0; i < _indices.size(); ++i) {
+      _outgoing_offsets[i + 1] += _outgoing_offsets[i];
+      _incoming_offsets[i + 1] += _incoming_offsets[i];
+    }
+
+    // Incoming edges point to the outgoing edge array
+    Vector<Position> cursor;
+    cursor.assign(_incoming_offsets.begin(), _incoming_offsets.end() - 1);
+    _incoming.resize(_edge_indices.size());
+    for (size_t i = 0; i < _edge_indices.size(); ++i) {
+      auto to = position(_edge_indices[i].to);
+      _incoming[cursor[to]++] = i;
+    }
+
+    _frozen = true;
+  }
+
+  bool frozen() const noexcept { return _frozen; }
+
+  // Node methods
+  bool has_node(const Index &index) const noexcept { return position(index) != npos; }
+
+  Position position(const Index &index) const noexcept {
+    if (!_lookup.empty()) {
+      return lookup(index);
+    }
+    auto iter = std::lower_bound(_indices.begin(), _indices.end(), index);
+    if (iter == _indices.end() || *iter != index) {
+      return npos;
+    }
+    return iter - _indices.begin();
+  }
+
+  Node &node(const Index &index) noexcept {
+    auto pos = position(index);
+    assert(pos != npos);
+    return _nodes[pos];
+  }
+
+  const Node &node(const Index &index) const noexcept {
+    auto pos = position(index);
+    assert(pos != npos);
+    return _nodes[pos];
+  }
+
+  Node &node_at(Position pos) noexcept { return _nodes[pos]; }
+
+  const Node &node_at(Position pos) const noexcept { return _nodes[pos]; }
+
+  const Index &index_at(Position pos) const noexcept { return _indices[pos]; }
+
+  size_t size() const noexcept { return _nodes.size(); }
+
+  // Edge methods
+  size_t edge_size() const noexcept { return _edge_indices.size(); }
+
+  size_t outgoing_edge_size(const Index &index) const noexcept {
+    auto pos = position(index);
+    if (pos == npos || !_frozen) {
+      return 0;
+    }
+    return _outgoing_offsets[pos + 1] - _outgoing_offsets[pos];
+  }
+
+  EdgeView outgoing_edges(const Index &index) const noexcept {
+    auto pos = position(index);
+    if (pos == npos || !_frozen) {
+      return EdgeView(_edge_indices.data(), NULL, 0, 0);
+    }
+    return EdgeView(_edge_indices.data(), NULL, _outgoing_offsets[pos],
+                    _outgoing_offsets[pos + 1]);
+  }
+
+  size_t incoming_edge_size(const Index &index) const noexcept {
+    auto pos = position(index);
+    if (pos == npos || !_frozen) {
+      return 0;
+    }
+    return _incoming_offsets[pos + 1] - _incoming_offsets[pos];
+  }
+
+  EdgeView incoming_edges(const Index &index) const noexcept {
+    auto pos = position(index);
+    if (pos == npos || !_frozen) {
+      return EdgeView(_edge_indices.data(), _incoming.data(), 0, 0);
+    }
+    return EdgeView(_edge_indices.data(), _incoming.data(), _incoming_offsets[pos],
+                    _incoming_offsets[pos + 1]);
+  }
+
+  bool has_edge(const EdgeIndex &edge_index) const noexcept {
+    return std::binary_search(_edge_indices.begin(), _edge_indices.end(), edge_index);
+  }
+
+  Edge &edge(const EdgeIndex &edge_index) noexcept {
+    auto iter = std::lower_bound(_edge_indices.begin(), _edge_indices.end(), edge_index);
+    assert(iter != _edge_indices.end() && !(edge_index < *iter));
+    return _edges[iter - _edge_indices.begin()];
+  }
+
+  const EdgeIndex &edge_index_at(Position pos) const noexcept { return _edge_indices[pos]; }
+
+  const Edge &edge_at(Position pos) const noexcept { return _edges[pos]; }
+
+ private:
+  template <typename I = Index>
+  typename std::enable_if<std::is_integral<I>::value>::type build_lookup() {
+    _lookup.clear();
+    if (_indices.size() < 2) {
+      return;
+    }
+    // Regular stride of indices
+    Index stride = 0;
+    for (size_t i = 1; i < _indices.size(); ++i) {
+      Index a = _indices[i] - _indices[i - 1];
+      while (a != 0) {
+        Index t = stride % a;
+        stride = a;
+        a = t;
+      }
+    }
+    auto slots = (_indices.back() - _indices.front()) / stride + 1;
+    if (slots > _LOOKUP_SPARSITY * _indices.size()) {
+      // Too sparse, fall back to binary search
+      return;
+    }
+    _base = _indices.front();
+    _stride = stride;
+    _lookup.assign(slots, npos);
+    for (size_t i = 0; i < _indices.size(); ++i) {
+      _lookup[(_indices[i] - _base) / _stride] = i;
+    }
+  }
+
+  template <typename I = Index>
+  typename std::enable_if<!std::is_integral<I>::value>::type build_lookup() {}
+
+  template <typename I = Index>
+  typename std::enable_if<std::is_integral<I>::value, Position>::type lookup(
+      const Index &index) const noexcept {
+    if (index < _base || (index - _base) % _stride != 0) {
+      return npos;
+    }
+    auto slot = (index - _base) / _stride;
+    return slot < _lookup.size() ? _lookup[slot] : npos;
+  }
+
+  template <typename I = Index>
+  typename std::enable_if<!std::is_integral<I>::value, Position>::type lookup(
+      const Index &index) const noexcept {
+    return npos;
+  }
+
+ private:
+  bool _frozen;
+  // Sorted node indices and the corresponding nodes
+  Vector<Index> _indices;
+  Vector<Node> _nodes;
+  // Edges sorted by <from, to>
+  Vector<EdgeIndex> _edge_indices;
+  Vector<Edge> _edges;
+  // [_outgoing_offsets[i], _outgoing_offsets[i + 1]) in the edge arrays
+  Vector<Position> _outgoing_offsets;
+  // [_incoming_offsets[i], _incoming_offsets[i + 1]) in _incoming
+  Vector<Position> _incoming_offsets;
+  Vector<Position> _incoming;
+  // Dense table <(index - _base) / _stride, position>
+  u64 _base;
+  u64 _stride;
+  Vector<Position> _lookup;
+
+  static const size_t _LOOKUP_SPARSITY = 4;
+};
+
 }  // namespace redshow
 
 #endif  // REDSHOW_COMMON_GRAPH_H
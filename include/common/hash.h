@@ -3,8 +3,36 @@
 
 #include <string>
 
+#include "common/utils.h"
+
 namespace redshow {
 
+/**
+ * @brief Fast non-cryptographic 64-bit hash, used to fingerprint large files
+ *
+ * @param input input bytes
+ * @param length number of bytes
+ * @param seed
+ * @return u64 hash value
+ */
+u64 hash64(const void *input, size_t length, u64 seed = 0);
+
+/**
+ * @brief Mix the bits of a 64-bit integer, used to pick pseudo-random subsets of ids
+ *
+ * @param x
+ * @return u64 hash value
+ */
+inline u64 hash_mix64(u64 x) {
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
 /**
  * @brief sha256 hash interface
  *
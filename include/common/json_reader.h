@@ -0,0 +1,207 @@
+#ifndef REDSHOW_COMMON_JSON_READER_H
+#define REDSHOW_COMMON_JSON_READER_H
+
+#include <string_view>
+#include <type_traits>
+
+namespace redshow {
+
+/**
+ * @brief A zero-copy pull parser over a JSON buffer.
+ *
+ * The caller walks the document in order; nothing is allocated and strings are returned as views
+ * into the buffer. Escape sequences are kept as is. The reader is lenient about separators, it
+ * is meant for machine generated files such as hpcstruct's .inst output.
+ *
+ * Typical use:
+ *   if (reader.begin_object()) {
+ *     std::string_view key;
+ *     while (reader.next_key(key)) {
+ *       if (key == "pc") reader.read_int(pc); else reader.skip_value();
+ *     }
+ *   }
+ */
+class JsonReader {
+ public:
+  JsonReader(const char *begin, const char *end) : _cur(begin), _end(end), _error(false) {}
+
+  // Set once any read fails, all following reads fail
+  bool error() const noexcept { return _error; }
+
+  // Consume whitespace and check if the whole buffer has been read
+  bool done() noexcept {
+    skip_whitespace();
+    return _cur == _end;
+  }
+
+  // Current position in the buffer
+  const char *position() const noexcept { return _cur; }
+
+  char peek() noexcept {
+    skip_whitespace();
+    return _cur == _end ? '\0' : *_cur;
+  }
+
+  // Enter an object, fails if the next value is not an object
+  bool begin_object() noexcept { return consume('{'); }
+
+  // Enter an array, fails if the next value is not an array
+  bool begin_array() noexcept { return consume('['); }
+
+  /**
+   * @brief Read the next key of the current object
+   *
+   * @return false at the end of the object or on error
+   */
+  bool next_key(std::string_view &key) noexcept {
+    if (!next('}')) {
+      return false;
+    }
+    if (!read_string(key) || !consume(':')) {
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Move to the next element of the current array
+   *
+   * @return false at the end of the array or on error
+   */
+  bool next_element() noexcept { return next(']'); }
+
+  bool read_string(std::string_view &value) noexcept {
+    if (!consume('"')) {
+      return false;
+    }
+    auto *begin = _cur;
+    while (_cur != _end && *_cur != '"') {
+      if (*_cur == '\\' && ++_cur == _end) {
+        break;
+      }
+      ++_cur;
+    }
+    if (_cur == _end) {
+      return fail();
+    }
+    value = std::string_view(begin, _cur - begin);
+    ++_cur;
+    return true;
+  }
+
+  template <typename T>
+  bool read_int(T &value) noexcept {
+    static_assert(std::is_integral<T>::value, "read_int requires an integral type");
+    skip_whitespace();
+    if (_error || _cur == _end) {
+      return fail();
+    }
+    bool negative = false;
+    if (*_cur == '-') {
+      negative = true;
+      ++_cur;
+    }
+    auto *begin = _cur;
+    unsigned long long v = 0;
+    while (_cur != _end && *_cur >= '0' && *_cur <= '9') {
+      v = v * 10 + (*_cur - '0');
+      ++_cur;
+    }
+    if (_cur == begin || (_cur != _end && (*_cur == '.' || *_cur == 'e' || *_cur == 'E'))) {
+      return fail();
+    }
+    value = static_cast<T>(negative ? -static_cast<long long>(v) : static_cast<long long>(v));
+    return true;
+  }
+
+  // Skip over the next value, including nested objects and arrays
+  bool skip_value() noexcept {
+    auto c = peek();
+    if (_error) {
+      return false;
+    }
+    if (c == '"') {
+      std::string_view unused;
+      return read_string(unused);
+    } else if (c == '{') {
+      ++_cur;
+      std::string_view key;
+      while (next_key(key)) {
+        if (!skip_value()) {
+          return false;
+        }
+      }
+    } else if (c == '[') {
+      ++_cur;
+      while (next_element()) {
+        if (!skip_value()) {
+          return false;
+        }
+      }
+    } else {
+      // Numbers and literals
+      auto *begin = _cur;
+      while (_cur != _end && *_cur != ',' && *_cur != '}' && *_cur != ']' && !whitespace(*_cur)) {
+        ++_cur;
+      }
+      if (_cur == begin) {
+        return fail();
+      }
+    }
+    return !_error;
+  }
+
+ private:
+  static bool whitespace(char c) noexcept {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+  }
+
+  void skip_whitespace() noexcept {
+    while (_cur != _end && whitespace(*_cur)) {
+      ++_cur;
+    }
+  }
+
+  bool fail() noexcept {
+    _error = true;
+    return false;
+  }
+
+  bool consume(char c) noexcept {
+    skip_whitespace();
+    if (_error || _cur == _end || *_cur != c) {
+      return fail();
+    }
+    ++_cur;
+    return true;
+  }
+
+  // Skip a separator and check for the closing character
+  bool next(char close) noexcept {
+    skip_whitespace();
+    if (_error || _cur == _end) {
+      return fail();
+    }
+    if (*_cur == ',') {
+      ++_cur;
+      skip_whitespace();
+      if (_cur == _end) {
+        return fail();
+      }
+    }
+    if (*_cur == close) {
+      ++_cur;
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  const char *_cur;
+  const char *_end;
+  bool _error;
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_COMMON_JSON_READER_H
@@ -0,0 +1,46 @@
+#ifndef REDSHOW_COMMON_MAPPED_FILE_H
+#define REDSHOW_COMMON_MAPPED_FILE_H
+
+#include <string>
+
+namespace redshow {
+
+/**
+ * @brief A read-only memory mapped file, unmapped on destruction
+ */
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  MappedFile(const MappedFile &other) = delete;
+
+  MappedFile &operator=(const MappedFile &other) = delete;
+
+  ~MappedFile() { close(); }
+
+  /**
+   * @brief Map the whole file into memory
+   *
+   * @param path file path
+   * @return true if the file is mapped, an empty file is mapped with a NULL data pointer
+   */
+  bool open(const std::string &path);
+
+  void close();
+
+  const char *data() const noexcept { return _data; }
+
+  size_t size() const noexcept { return _size; }
+
+  const char *begin() const noexcept { return _data; }
+
+  const char *end() const noexcept { return _data + _size; }
+
+ private:
+  const char *_data = NULL;
+  size_t _size = 0;
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_COMMON_MAPPED_FILE_H
@@ -0,0 +1,85 @@
+#ifndef REDSHOW_COMMON_SEGMENT_FILE_H
+#define REDSHOW_COMMON_SEGMENT_FILE_H
+
+#include <string>
+
+#include "common/map.h"
+#include "common/utils.h"
+
+namespace redshow {
+
+/**
+ * @brief A scratch file of variable-sized segments. Segments are written once and mapped to be
+ * read back, the space of freed segments is reused. The file is removed once opened, so it
+ * never outlives the process.
+ */
+class SegmentFile {
+ public:
+  struct Segment {
+    u64 offset;
+    u64 size;
+
+    Segment() : offset(0), size(0) {}
+
+    Segment(u64 offset, u64 size) : offset(offset), size(size) {}
+  };
+
+  SegmentFile() = default;
+
+  SegmentFile(const SegmentFile &other) = delete;
+
+  SegmentFile &operator=(const SegmentFile &other) = delete;
+
+  ~SegmentFile() { close(); }
+
+  bool open(const std::string &path);
+
+  void close();
+
+  bool is_open() const noexcept { return _fd != -1; }
+
+  /**
+   * @brief Reserve a free range or the end of the file for a segment
+   *
+   * @param size
+   * @param segment
+   */
+  void allocate(u64 size, Segment &segment);
+
+  /**
+   * @brief Write data into a segment
+   *
+   * @param segment
+   * @param offset offset of data in the segment
+   * @param data
+   * @param size
+   * @return true if all bytes are written
+   */
+  bool write(const Segment &segment, u64 offset, const char *data, size_t size);
+
+  /**
+   * @brief Map a segment read-only
+   *
+   * @param segment
+   * @return const char* start of the segment, NULL on failure, see unmap
+   */
+  const char *map(const Segment &segment);
+
+  void unmap(const Segment &segment, const char *data);
+
+  // Make the range of a segment available to later writes
+  void free(const Segment &segment);
+
+  // Bytes of the file, including freed segments
+  u64 size() const noexcept { return _size; }
+
+ private:
+  int _fd = -1;
+  u64 _size = 0;
+  // <offset, size> of freed ranges, adjacent ranges are coalesced
+  Map<u64, u64> _free;
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_COMMON_SEGMENT_FILE_H
@@ -0,0 +1,241 @@
+#ifndef REDSHOW_COMMON_SERIALIZE_H
+#define REDSHOW_COMMON_SERIALIZE_H
+
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "common/utils.h"
+
+namespace redshow {
+
+/*
+ * Binary encoding of traces. Trivially copyable values are copied as they are, containers are
+ * written as their size followed by their elements. Types with other members provide their own
+ * serialize, deserialize, and heap_size overloads in the redshow namespace.
+ */
+class BinaryWriter {
+ public:
+  typedef std::function<void(const char *data, size_t size)> Sink;
+
+  // Bytes are only counted
+  BinaryWriter() : _size(0) {}
+
+  // Bytes are passed to sink in chunks, see flush
+  explicit BinaryWriter(Sink sink) : _sink(sink), _size(0) {}
+
+  ~BinaryWriter() { flush(); }
+
+  void write(const void *data, size_t size) {
+    _size += size;
+    if (_sink) {
+      _buffer.append(reinterpret_cast<const char *>(data), size);
+      if (_buffer.size() >= _CHUNK_SIZE) {
+        flush();
+      }
+    }
+  }
+
+  void flush() {
+    if (!_buffer.empty()) {
+      _sink(_buffer.data(), _buffer.size());
+      _buffer.clear();
+    }
+  }
+
+  // Bytes written so far
+  u64 size() const noexcept { return _size; }
+
+ private:
+  Sink _sink;
+  std::string _buffer;
+  u64 _size;
+
+  static constexpr size_t _CHUNK_SIZE = 1 << 20;
+};
+
+class BinaryReader {
+ public:
+  BinaryReader(const char *data, size_t size) : _data(data), _end(data + size), _good(true) {}
+
+  // Reads past the end fail and leave data zeroed
+  bool read(void *data, size_t size) {
+    if (static_cast<size_t>(_end - _data) < size) {
+      memset(data, 0, size);
+      _data = _end;
+      _good = false;
+      return false;
+    }
+    memcpy(data, _data, size);
+    _data += size;
+    return true;
+  }
+
+  bool good() const noexcept { return _good; }
+
+  size_t remaining() const noexcept { return _end - _data; }
+
+ private:
+  const char *_data;
+  const char *_end;
+  bool _good;
+};
+
+// Bytes of a std::map node besides its value
+static constexpr size_t MAP_NODE_OVERHEAD = 48;
+
+// Whether values of a type may hold bytes outside of themselves
+template <typename T>
+struct has_heap : std::integral_constant<bool, !std::is_trivially_copyable<T>::value> {};
+
+template <typename F, typename S>
+struct has_heap<std::pair<F, S>>
+    : std::integral_constant<bool, has_heap<F>::value || has_heap<S>::value> {};
+
+template <typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value> serialize(BinaryWriter &writer,
+                                                                 const T &value) {
+  writer.write(&value, sizeof(T));
+}
+
+template <typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value> deserialize(BinaryReader &reader,
+                                                                   T &value) {
+  reader.read(&value, sizeof(T));
+}
+
+// Bytes held outside of the value itself
+template <typename T>
+std::enable_if_t<std::is_trivially_copyable<T>::value, size_t> heap_size(const T &value) {
+  return 0;
+}
+
+template <typename F, typename S>
+void serialize(BinaryWriter &writer, const std::pair<F, S> &value);
+
+template <typename F, typename S>
+void deserialize(BinaryReader &reader, std::pair<F, S> &value);
+
+template <typename F, typename S>
+size_t heap_size(const std::pair<F, S> &value);
+
+template <typename K, typename V, typename C, typename A>
+void serialize(BinaryWriter &writer, const std::map<K, V, C, A> &value);
+
+template <typename K, typename V, typename C, typename A>
+void deserialize(BinaryReader &reader, std::map<K, V, C, A> &value);
+
+template <typename K, typename V, typename C, typename A>
+size_t heap_size(const std::map<K, V, C, A> &value);
+
+template <typename V, typename A>
+void serialize(BinaryWriter &writer, const std::vector<V, A> &value);
+
+template <typename V, typename A>
+void deserialize(BinaryReader &reader, std::vector<V, A> &value);
+
+template <typename V, typename A>
+size_t heap_size(const std::vector<V, A> &value);
+
+template <typename F, typename S>
+void serialize(BinaryWriter &writer, const std::pair<F, S> &value) {
+  serialize(writer, value.first);
+  serialize(writer, value.second);
+}
+
+template <typename F, typename S>
+void deserialize(BinaryReader &reader, std::pair<F, S> &value) {
+  deserialize(reader, value.first);
+  deserialize(reader, value.second);
+}
+
+template <typename F, typename S>
+size_t heap_size(const std::pair<F, S> &value) {
+  return heap_size(value.first) + heap_size(value.second);
+}
+
+template <typename K, typename V, typename C, typename A>
+void serialize(BinaryWriter &writer, const std::map<K, V, C, A> &value) {
+  u64 size = value.size();
+  serialize(writer, size);
+  for (auto &iter : value) {
+    serialize(writer, iter.first);
+    serialize(writer, iter.second);
+  }
+}
+
+template <typename K, typename V, typename C, typename A>
+void deserialize(BinaryReader &reader, std::map<K, V, C, A> &value) {
+  u64 size = 0;
+  deserialize(reader, size);
+  value.clear();
+  for (u64 i = 0; i < size && reader.good(); ++i) {
+    K key;
+    deserialize(reader, key);
+    // Keys are written in order
+    auto iter = value.emplace_hint(value.end(), std::move(key), V());
+    deserialize(reader, iter->second);
+  }
+}
+
+template <typename K, typename V, typename C, typename A>
+size_t heap_size(const std::map<K, V, C, A> &value) {
+  size_t size = value.size() * (MAP_NODE_OVERHEAD + sizeof(K) + sizeof(V));
+  if constexpr (has_heap<K>::value || has_heap<V>::value) {
+    for (auto &iter : value) {
+      size += heap_size(iter.first) + heap_size(iter.second);
+    }
+  }
+  return size;
+}
+
+template <typename V, typename A>
+void serialize(BinaryWriter &writer, const std::vector<V, A> &value) {
+  u64 size = value.size();
+  serialize(writer, size);
+  if constexpr (std::is_trivially_copyable<V>::value) {
+    writer.write(value.data(), size * sizeof(V));
+  } else {
+    for (auto &iter : value) {
+      serialize(writer, iter);
+    }
+  }
+}
+
+template <typename V, typename A>
+void deserialize(BinaryReader &reader, std::vector<V, A> &value) {
+  u64 size = 0;
+  deserialize(reader, size);
+  if constexpr (std::is_trivially_copyable<V>::value) {
+    if (size > reader.remaining() / sizeof(V)) {
+      size = reader.remaining() / sizeof(V) + 1;
+    }
+    value.resize(size);
+    reader.read(value.data(), size * sizeof(V));
+  } else {
+    value.clear();
+    for (u64 i = 0; i < size && reader.good(); ++i) {
+      value.emplace_back();
+      deserialize(reader, value.back());
+    }
+  }
+}
+
+template <typename V, typename A>
+size_t heap_size(const std::vector<V, A> &value) {
+  size_t size = value.capacity() * sizeof(V);
+  if constexpr (has_heap<V>::value) {
+    for (auto &iter : value) {
+      size += heap_size(iter);
+    }
+  }
+  return size;
+}
+
+}  // namespace redshow
+
+#endif  // REDSHOW_COMMON_SERIALIZE_H
@@ -0,0 +1,58 @@
+#ifndef REDSHOW_COMMON_THREAD_POOL_H
+#define REDSHOW_COMMON_THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace redshow {
+
+/**
+ * @brief A fixed set of worker threads consuming a FIFO task queue.
+ * Tasks already submitted are finished before the pool is destroyed.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t num_threads);
+
+  ThreadPool(const ThreadPool &other) = delete;
+
+  ThreadPool &operator=(const ThreadPool &other) = delete;
+
+  ~ThreadPool();
+
+  template <typename F>
+  auto submit(F &&f) -> std::future<decltype(f())> {
+    typedef decltype(f()) Result;
+
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+    auto future = task->get_future();
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      _tasks.emplace([task]() { (*task)(); });
+    }
+    _cond.notify_one();
+    return future;
+  }
+
+  size_t size() const noexcept { return _threads.size(); }
+
+ private:
+  void run();
+
+ private:
+  std::vector<std::thread> _threads;
+  std::queue<std::function<void()>> _tasks;
+  std::mutex _lock;
+  std::condition_variable _cond;
+  bool _stop;
+};
+
+}  // namespace redshow
+
+#endif  // REDSHOW_COMMON_THREAD_POOL_H
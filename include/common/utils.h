@@ -57,6 +57,17 @@ const int MEM_VIEWS_LIMIT = 10;
 
 const int OMP_SEQ_LEN = 100000;
 
+/**
+ * @brief Scale a count measured on samples back to an estimate of the full count
+ *
+ * @param count
+ * @param scale see redshow_sampling_scale_get
+ * @return u64
+ */
+inline u64 scale_count(u64 count, double scale) {
+  return static_cast<u64>(static_cast<double>(count) * scale + 0.5);
+}
+
 struct ThreadId {
   u32 flat_block_id;
   u32 flat_thread_id;
@@ -19,7 +19,8 @@ typedef enum redshow_analysis_type {
 
 typedef enum redshow_analysis_config_type {
   REDSHOW_ANALYSIS_READ_TRACE_IGNORE = 0,
-  REDSHOW_ANALYSIS_DATA_FLOW_HASH = 1
+  REDSHOW_ANALYSIS_DATA_FLOW_HASH = 1,
+  REDSHOW_ANALYSIS_VALUE_PATTERN_SUMMARY = 2
 } redshow_analysis_config_type_t;
 
 typedef enum redshow_access_type {
@@ -67,6 +68,41 @@ typedef enum redshow_approx_level {
   REDSHOW_APPROX_MAX = 5,
 } redshow_approx_level_t;
 
+typedef enum redshow_cubin_analysis_mode {
+  REDSHOW_CUBIN_ANALYSIS_EAGER = 0,
+  REDSHOW_CUBIN_ANALYSIS_LAZY = 1,
+  REDSHOW_CUBIN_ANALYSIS_ASYNC = 2
+} redshow_cubin_analysis_mode_t;
+
+typedef enum redshow_cubin_async_policy {
+  REDSHOW_CUBIN_ASYNC_WAIT = 0,
+  REDSHOW_CUBIN_ASYNC_FALLBACK = 1
+} redshow_cubin_async_policy_t;
+
+typedef enum redshow_trace_order {
+  REDSHOW_TRACE_ORDER_WARP = 0,
+  REDSHOW_TRACE_ORDER_PC = 1
+} redshow_trace_order_t;
+
+typedef enum redshow_sampling_mode {
+  REDSHOW_SAMPLING_NONE = 0,
+  REDSHOW_SAMPLING_RECORD = 1,
+  REDSHOW_SAMPLING_WARP = 2,
+  REDSHOW_SAMPLING_BLOCK = 3,
+  REDSHOW_SAMPLING_KERNEL = 4,
+  REDSHOW_SAMPLING_ADAPTIVE = 5
+} redshow_sampling_mode_t;
+
+typedef enum redshow_value_pattern_mode {
+  REDSHOW_VALUE_PATTERN_FULL = 0,
+  REDSHOW_VALUE_PATTERN_ONLINE = 1
+} redshow_value_pattern_mode_t;
+
+typedef enum redshow_output_format {
+  REDSHOW_OUTPUT_CSV = 0,
+  REDSHOW_OUTPUT_BINARY = 1
+} redshow_output_format_t;
+
 typedef struct redshow_record_view {
   uint32_t function_index;
   uint64_t pc_offset;
@@ -191,6 +227,209 @@ EXTERNC redshow_result_t redshow_analysis_config(redshow_analysis_type_t analysi
                                                  redshow_analysis_config_type_t config,
                                                  bool enable);
 
+/**
+ * @brief Config when cubin instructions are analyzed. In lazy mode, registration only indexes
+ * function boundaries and a function is analyzed the first time its pcs appear in a trace. In
+ * async mode, registration indexes function boundaries and a worker pool analyzes the cubin.
+ *
+ * @param mode
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_cubin_analysis_mode_config(redshow_cubin_analysis_mode_t mode);
+
+/**
+ * @brief Config async cubin analysis. A trace of a cubin still being analyzed either waits for
+ * the analysis or uses default access kinds.
+ *
+ * @param policy
+ * @param num_workers Number of worker threads, 0 picks a default. Only effective before the
+ * first async registration
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_cubin_async_config(redshow_cubin_async_policy_t policy,
+                                                    uint32_t num_workers);
+
+/**
+ * @brief Config the order in which records of a trace are dispatched to analyses.
+ * REDSHOW_TRACE_ORDER_PC groups records by pc and then by address, so that consecutive units
+ * update the same histogram entries. It only takes effect when every enabled analysis is
+ * insensitive to record order (spatial redundancy, and value pattern in full mode without
+ * limits), otherwise records are dispatched in warp order.
+ *
+ * @param order
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_trace_order_config(redshow_trace_order_t order);
+
+/**
+ * @brief Config sampling of traces. With a period N, one out of N records, warps, blocks, or
+ * invocations of each kernel on a cpu thread is analyzed. Warps and blocks are picked by a hash of
+ * their ids. Block enter and exit records are never dropped. Redundancy counts are scaled back by
+ * redshow_sampling_scale_get when reported.
+ *
+ * REDSHOW_SAMPLING_ADAPTIVE analyzes every invocation of a kernel until its results converge
+ * (see redshow_sampling_adaptive_config), then one out of N invocations to recheck them.
+ *
+ * @param mode
+ * @param period Must be positive, 1 analyzes everything
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_sampling_config(redshow_sampling_mode_t mode, uint32_t period);
+
+/**
+ * @brief Get the sampling mode and period
+ *
+ * @param mode
+ * @param period
+ * @return redshow_result_t
+ */
+EXTERNC redshow_result_t redshow_sampling_get(redshow_sampling_mode_t *mode, uint32_t *period);
+
+/**
+ * @brief Config convergence of REDSHOW_SAMPLING_ADAPTIVE. After each analyzed invocation, every
+ * enabled analysis reports the rate of redundant or distinct accesses of that invocation. A
+ * kernel converges once the rates change by at most tolerance for stable_invocations analyzed
+ * invocations in a row, and is analyzed every invocation again as soon as a recheck exceeds it.
+ *
+ * @param tolerance
+ * @param stable_invocations Must be positive
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_sampling_adaptive_config(double tolerance,
+                                                          uint32_t stable_invocations);
+
+/**
+ * @brief Get the factor that scales sampled counts of a kernel on a cpu thread back to full counts
+ *
+ * @param cpu_thread
+ * @param kernel_id
+ * @param scale
+ * @return redshow_result_t
+ *
+ * @thread-safe: YES
+ */
+EXTERNC redshow_result_t redshow_sampling_scale_get(uint32_t cpu_thread, int32_t kernel_id,
+                                                    double *scale);
+
+/**
+ * @brief Config how value pattern collects values. REDSHOW_VALUE_PATTERN_FULL records the value
+ * distribution of every item and classifies patterns at flush. REDSHOW_VALUE_PATTERN_ONLINE keeps
+ * single-pass accumulators per array, memory does not grow with the trace and distinct counts are
+ * estimated once they exceed a few hundred.
+ *
+ * @param mode
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_value_pattern_mode_config(redshow_value_pattern_mode_t mode);
+
+/**
+ * @brief Get the value pattern mode
+ *
+ * @param mode
+ * @return redshow_result_t
+ */
+EXTERNC redshow_result_t redshow_value_pattern_mode_get(redshow_value_pattern_mode_t *mode);
+
+/**
+ * @brief Bound the memory of REDSHOW_VALUE_PATTERN_FULL. Past max_items of an array, only items at
+ * a doubling stride of offsets are tracked. Past max_values of an item, the least counted value is
+ * replaced. Reports of sampled arrays show the stride and the accesses not tracked exactly.
+ *
+ * @param max_items maximum number of tracked items per array, 0 if unlimited
+ * @param max_values maximum number of distinct values per item, 0 if unlimited
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_value_pattern_limit_config(uint64_t max_items,
+                                                            uint64_t max_values);
+
+/**
+ * @brief Get the value pattern limits
+ *
+ * @param max_items
+ * @param max_values
+ * @return redshow_result_t
+ */
+EXTERNC redshow_result_t redshow_value_pattern_limit_get(uint64_t *max_items, uint64_t *max_values);
+
+/**
+ * @brief Bound the memory of kernel traces kept by each analysis of a cpu thread. Past the budget,
+ * traces of the least recently analyzed kernels are written to a scratch file in dir. A spilled
+ * trace is read back when its kernel is analyzed again or results are flushed. The size of a trace
+ * is estimated again once the buffers of its kernel grow by an eighth, so traces may exceed the
+ * budget by their growth in between.
+ *
+ * @param budget bytes of traces per analysis and cpu thread, 0 if unlimited
+ * @param dir directory of scratch files, ends with '/', the current directory if NULL
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_trace_budget_config(uint64_t budget, const char *dir);
+
+/**
+ * @brief Get the trace budget
+ *
+ * @param budget
+ * @param dir
+ * @return redshow_result_t
+ */
+EXTERNC redshow_result_t redshow_trace_budget_get(uint64_t *budget, const char **dir);
+
+/**
+ * @brief Report the results of a kernel once the cpu thread has launched idle_ops other operations
+ * since its last launch, and free its trace. Results go through the record data callback and are
+ * appended to the thread's outputs, a later launch of the kernel is reported again on its own.
+ *
+ * @param idle_ops host operations since the last launch of a kernel, 0 to report at flush only
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_kernel_flush_config(uint64_t idle_ops);
+
+/**
+ * @brief Get the number of idle operations before a kernel is reported
+ *
+ * @param idle_ops
+ * @return redshow_result_t
+ */
+EXTERNC redshow_result_t redshow_kernel_flush_get(uint64_t *idle_ops);
+
+/**
+ * @brief Config the format of result files. REDSHOW_OUTPUT_CSV writes text files. With
+ * REDSHOW_OUTPUT_BINARY, each file is a schema followed by blocks of fixed-width records, and
+ * access kinds are stored once in a dictionary. Binary files end with .bin instead of .csv and are
+ * printed by redshow_decode.
+ *
+ * @param format
+ * @return redshow_result_t
+ *
+ * @thread-safe: No
+ */
+EXTERNC redshow_result_t redshow_output_format_config(redshow_output_format_t format);
+
+/**
+ * @brief Get the format of result files
+ *
+ * @param format
+ * @return redshow_result_t
+ */
+EXTERNC redshow_result_t redshow_output_format_get(redshow_output_format_t *format);
+
 /**
  * @brief This function is used to register a cubin module. redshow analyzes a cubin module to
  * extract CFGs and instruction statistics.
@@ -428,6 +667,19 @@ EXTERNC redshow_result_t redshow_analysis_begin();
  */
 EXTERNC redshow_result_t redshow_analysis_end();
 
+/**
+ * @brief Flush back the result of a kernel launched by a thread and free its trace, see
+ * redshow_kernel_flush_config. The traces and outputs of a thread are not locked, so it must be
+ * called by cpu_thread itself, between its analyses.
+ *
+ * @param cpu_thread
+ * @param kernel_id
+ * @return reshow_result_t
+ *
+ * @thread-safe NO, only from cpu_thread
+ */
+EXTERNC redshow_result_t redshow_flush_kernel(uint32_t cpu_thread, int32_t kernel_id);
+
 /**
  * @brief Flush back all the result. This function is supposed to be called when all the analysis
  * and kernel launches of each thread is done.
@@ -1,7 +1,290 @@
 #include "analysis/analysis.h"
 
+#include <algorithm>
+
 namespace redshow {
 
 Trace::~Trace() {}
 
+bool Analysis::kernel_summary(u32 cpu_thread, i32 kernel_id, u64 &count, u64 &total_count) {
+  bool summarize = false;
+
+  lock();
+  if (this->_kernel_trace.has(cpu_thread) && this->_kernel_trace.at(cpu_thread).has(kernel_id)) {
+    auto &trace = this->_kernel_trace.at(cpu_thread).at(kernel_id);
+    summarize = trace->summarize;
+    count = trace->summary_count;
+    total_count = trace->summary_total_count;
+  }
+  unlock();
+
+  return summarize;
+}
+
+static void serialize(BinaryWriter &writer, const Kernel &kernel) {
+  serialize(writer, kernel.op_id);
+  serialize(writer, kernel.ctx_id);
+  serialize(writer, kernel.cpu_thread);
+  serialize(writer, kernel.cubin_id);
+  serialize(writer, kernel.mod_id);
+  serialize(writer, kernel.func_index);
+  serialize(writer, kernel.func_addr);
+}
+
+static void deserialize(BinaryReader &reader, Kernel &kernel) {
+  deserialize(reader, kernel.op_id);
+  deserialize(reader, kernel.ctx_id);
+  deserialize(reader, kernel.cpu_thread);
+  deserialize(reader, kernel.cubin_id);
+  deserialize(reader, kernel.mod_id);
+  deserialize(reader, kernel.func_index);
+  deserialize(reader, kernel.func_addr);
+}
+
+// Fields of the base trace, written before those of an analysis
+static void serialize(BinaryWriter &writer, const Trace &trace) {
+  serialize(writer, trace.kernel);
+  serialize(writer, trace.summarize);
+  serialize(writer, trace.summary_count);
+  serialize(writer, trace.summary_total_count);
+}
+
+void Analysis::trace_begin(u32 cpu_thread, i32 kernel_id) {
+  auto *spill = trace_spill(cpu_thread);
+  if (spill == NULL || !spill->segments.has(kernel_id)) {
+    return;
+  }
+
+  auto trace = read_trace(*spill, kernel_id, true);
+
+  // A trace that cannot be read is started over
+  if (trace.get() != NULL) {
+    lock();
+    this->_kernel_trace[cpu_thread][kernel_id] = trace;
+    unlock();
+  }
+}
+
+void Analysis::trace_end(u32 cpu_thread, i32 kernel_id) {
+  uint64_t budget = 0;
+  const char *dir = NULL;
+  redshow_trace_budget_get(&budget, &dir);
+  if (budget == 0) {
+    return;
+  }
+
+  std::shared_ptr<Trace> trace;
+
+  lock();
+  if (this->_kernel_trace.has(cpu_thread) && this->_kernel_trace.at(cpu_thread).has(kernel_id)) {
+    trace = this->_kernel_trace.at(cpu_thread).at(kernel_id);
+  }
+  auto &spill = this->_trace_spills[cpu_thread];
+  unlock();
+
+  if (trace.get() == NULL) {
+    return;
+  }
+
+  auto buffers = ++spill.buffers[kernel_id];
+
+  // The kernel becomes the most recently analyzed, its last estimate is kept until the trace grows
+  if (spill.lru_iters.has(kernel_id)) {
+    spill.lru.splice(spill.lru.end(), spill.lru, spill.lru_iters.at(kernel_id));
+    if (buffers < spill.estimates.at(kernel_id)) {
+      return;
+    }
+  }
+
+  auto size = trace_size(*trace);
+  if (size == 0) {
+    return;
+  }
+  spill.estimates[kernel_id] = buffers + std::max<u64>(1, buffers >> _TRACE_SIZE_SHIFT);
+
+  if (spill.lru_iters.has(kernel_id)) {
+    spill.total_size -= spill.sizes.at(kernel_id);
+  } else {
+    spill.lru_iters[kernel_id] = spill.lru.insert(spill.lru.end(), kernel_id);
+  }
+  spill.sizes[kernel_id] = size;
+  spill.total_size += size;
+
+  while (spill.total_size > budget && spill.lru.front() != kernel_id) {
+    if (!spill_trace(cpu_thread, spill, spill.lru.front(), dir)) {
+      // Keep traces in memory if they cannot be written
+      break;
+    }
+  }
+}
+
+Vector<i32> Analysis::trace_kernels(u32 cpu_thread) {
+  Vector<i32> kernel_ids;
+
+  lock();
+  if (this->_kernel_trace.has(cpu_thread)) {
+    for (auto &iter : this->_kernel_trace.at(cpu_thread)) {
+      kernel_ids.push_back(iter.first);
+    }
+  }
+  if (this->_trace_spills.has(cpu_thread)) {
+    for (auto &iter : this->_trace_spills.at(cpu_thread).segments) {
+      kernel_ids.push_back(iter.first);
+    }
+  }
+  unlock();
+
+  std::sort(kernel_ids.begin(), kernel_ids.end());
+  return kernel_ids;
+}
+
+std::shared_ptr<Trace> Analysis::thread_trace(u32 cpu_thread, i32 kernel_id) {
+  std::shared_ptr<Trace> trace;
+
+  lock();
+  if (this->_kernel_trace.has(cpu_thread) && this->_kernel_trace.at(cpu_thread).has(kernel_id)) {
+    trace = this->_kernel_trace.at(cpu_thread).at(kernel_id);
+  }
+  unlock();
+
+  if (trace.get() == NULL) {
+    auto *spill = trace_spill(cpu_thread);
+    if (spill != NULL && spill->segments.has(kernel_id)) {
+      trace = read_trace(*spill, kernel_id, false);
+    }
+  }
+
+  return trace;
+}
+
+std::shared_ptr<Trace> Analysis::release_trace(u32 cpu_thread, i32 kernel_id) {
+  std::shared_ptr<Trace> trace;
+
+  lock();
+  if (this->_kernel_trace.has(cpu_thread) && this->_kernel_trace.at(cpu_thread).has(kernel_id)) {
+    trace = this->_kernel_trace.at(cpu_thread).at(kernel_id);
+    this->_kernel_trace.at(cpu_thread).erase(kernel_id);
+  }
+  unlock();
+
+  auto *spill = trace_spill(cpu_thread);
+  if (spill == NULL) {
+    return trace;
+  }
+
+  if (trace.get() == NULL) {
+    if (spill->segments.has(kernel_id)) {
+      trace = read_trace(*spill, kernel_id, true);
+    }
+  } else if (spill->lru_iters.has(kernel_id)) {
+    // The trace no longer counts against the budget
+    spill->lru.erase(spill->lru_iters.at(kernel_id));
+    spill->lru_iters.erase(kernel_id);
+    spill->total_size -= spill->sizes.at(kernel_id);
+    spill->sizes.erase(kernel_id);
+  }
+  spill->buffers.erase(kernel_id);
+  spill->estimates.erase(kernel_id);
+
+  return trace;
+}
+
+Analysis::TraceSpill *Analysis::trace_spill(u32 cpu_thread) {
+  TraceSpill *spill = NULL;
+
+  lock();
+  if (this->_trace_spills.has(cpu_thread)) {
+    spill = &this->_trace_spills.at(cpu_thread);
+  }
+  unlock();
+
+  return spill;
+}
+
+bool Analysis::spill_trace(u32 cpu_thread, TraceSpill &spill, i32 kernel_id, const char *dir) {
+  if (!spill.file.is_open()) {
+    auto path = std::string(dir) + "redshow_trace_" + std::to_string(this->_type) + "_t" +
+                std::to_string(cpu_thread) + ".bin";
+    if (!spill.file.open(path)) {
+      return false;
+    }
+  }
+
+  std::shared_ptr<Trace> trace;
+
+  lock();
+  trace = this->_kernel_trace.at(cpu_thread).at(kernel_id);
+  unlock();
+
+  // Bytes are counted first to place the trace, then written in chunks
+  BinaryWriter counter;
+  serialize(counter, *trace);
+  save_trace(*trace, counter);
+
+  SegmentFile::Segment segment;
+  spill.file.allocate(counter.size(), segment);
+
+  bool written = true;
+  u64 offset = 0;
+  {
+    BinaryWriter writer([&](const char *data, size_t size) {
+      written = written && spill.file.write(segment, offset, data, size);
+      offset += size;
+    });
+    serialize(writer, *trace);
+    save_trace(*trace, writer);
+  }
+  if (!written) {
+    spill.file.free(segment);
+    return false;
+  }
+  spill.segments[kernel_id] = segment;
+
+  lock();
+  this->_kernel_trace.at(cpu_thread).erase(kernel_id);
+  unlock();
+
+  spill.lru.erase(spill.lru_iters.at(kernel_id));
+  spill.lru_iters.erase(kernel_id);
+  spill.total_size -= spill.sizes.at(kernel_id);
+  spill.sizes.erase(kernel_id);
+
+  return true;
+}
+
+std::shared_ptr<Trace> Analysis::read_trace(TraceSpill &spill, i32 kernel_id, bool release) {
+  auto segment = spill.segments.at(kernel_id);
+  std::shared_ptr<Trace> trace;
+
+  auto *data = spill.file.map(segment);
+  if (data != NULL) {
+    BinaryReader reader(data, segment.size);
+    Kernel kernel;
+    bool summarize = false;
+    u64 summary_count = 0;
+    u64 summary_total_count = 0;
+    deserialize(reader, kernel);
+    deserialize(reader, summarize);
+    deserialize(reader, summary_count);
+    deserialize(reader, summary_total_count);
+    trace = load_trace(reader);
+    if (!reader.good()) {
+      trace.reset();
+    } else if (trace.get() != NULL) {
+      trace->kernel = kernel;
+      trace->summarize = summarize;
+      trace->summary_count = summary_count;
+      trace->summary_total_count = summary_total_count;
+    }
+    spill.file.unmap(segment, data);
+  }
+
+  if (release) {
+    spill.file.free(segment);
+    spill.segments.erase(kernel_id);
+  }
+
+  return trace;
+}
+
 }  // namespace redshow
@@ -10,6 +10,7 @@
 
 #include "common/hash.h"
 #include "common/utils.h"
+#include "common/vector.h"
 #include "operation/memcpy.h"
 #include "operation/memset.h"
 #include "redshow_graphviz.h"
@@ -25,11 +26,11 @@ std::string DataFlow::get_data_flow_edge_type(EdgeType type) {
 
 void DataFlow::init() {
   // A special context id for untrackable memorys
-  _op_node[REDSHOW_MEMORY_SHARED] = SHARED_MEMORY_CTX_ID;
-  _op_node[REDSHOW_MEMORY_LOCAL] = LOCAL_MEMORY_CTX_ID;
-  _op_node[REDSHOW_MEMORY_CONSTANT] = CONSTANT_MEMORY_CTX_ID;
-  _op_node[REDSHOW_MEMORY_UVM] = UVM_MEMORY_CTX_ID;
-  _op_node[REDSHOW_MEMORY_HOST] = HOST_MEMORY_CTX_ID;
+  _op_node[REDSHOW_MEMORY_SHARED][0] = SHARED_MEMORY_CTX_ID;
+  _op_node[REDSHOW_MEMORY_LOCAL][0] = LOCAL_MEMORY_CTX_ID;
+  _op_node[REDSHOW_MEMORY_CONSTANT][0] = CONSTANT_MEMORY_CTX_ID;
+  _op_node[REDSHOW_MEMORY_UVM][0] = UVM_MEMORY_CTX_ID;
+  _op_node[REDSHOW_MEMORY_HOST][0] = HOST_MEMORY_CTX_ID;
 
   _graph.add_node(SHARED_MEMORY_CTX_ID, SHARED_MEMORY_CTX_ID, OPERATION_TYPE_MEMORY);
   _graph.add_node(CONSTANT_MEMORY_CTX_ID, CONSTANT_MEMORY_CTX_ID, OPERATION_TYPE_MEMORY);
@@ -49,121 +50,172 @@ void DataFlow::init() {
 }
 
 void DataFlow::kernel_op_callback(std::shared_ptr<Kernel> op) {
-  if (_trace.get() == NULL) {
-    // If the kernel is sampled
-    return;
+  std::shared_ptr<DataFlowTrace> trace;
+  Vector<DataFlowUpdate> read_updates;
+  Vector<DataFlowUpdate> write_updates;
+
+  lock();
+
+  add_op_node(op);
+
+  if (_thread_trace.has(op->cpu_thread)) {
+    trace = _thread_trace.at(op->cpu_thread);
+    _thread_trace.erase(op->cpu_thread);
   }
 
-  // data flow analysis must be synchrounous
-  for (auto &mem_iter : _trace->read_memory) {
+  if (trace.get() != NULL) {
     // Avoid local and share memories
-    auto memory = _memories.at(mem_iter.first);
-    if (memory->op_id > REDSHOW_MEMORY_HOST) {
-      auto node_id = _op_node.at(memory->op_id);
-      auto len = 0;
-      if (_configs[REDSHOW_ANALYSIS_READ_TRACE_IGNORE] == false) {
-        for (auto &range_iter : mem_iter.second) {
-          len += range_iter.end - range_iter.start;
-        }
-      } else {
-        len = memory->len;
+    for (auto &mem_iter : trace->read_memory) {
+      auto memory = _memories.at(mem_iter.first);
+      if (memory->op_id > REDSHOW_MEMORY_HOST) {
+        read_updates.emplace_back(memory, &mem_iter.second);
+      }
+    }
+    for (auto &mem_iter : trace->write_memory) {
+      auto memory = _memories.at(mem_iter.first);
+      if (memory->op_id > REDSHOW_MEMORY_HOST) {
+        write_updates.emplace_back(memory, &mem_iter.second);
       }
-      // Link a pure read edge between two calling contexts
-      link_ctx_node(node_id, op->ctx_id, memory->ctx_id, DATA_FLOW_EDGE_READ);
-      update_op_metrics(memory->op_id, op->ctx_id, memory->ctx_id, 0.0, len, memory->len,
-                        DATA_FLOW_EDGE_READ);
     }
   }
 
-  for (auto &mem_iter : _trace->write_memory) {
-    auto memory = _memories.at(mem_iter.first);
-    if (memory->op_id > REDSHOW_MEMORY_HOST) {
-      auto overwrite = 0;
+  unlock();
 
-      _ranges.reset();
-      for (auto &range_iter : mem_iter.second) {
-        overwrite += range_iter.end - range_iter.start;
-        _ranges.push_back(std::move(MemoryRange(range_iter.start, range_iter.end)));
-      }
+  if (trace.get() == NULL) {
+    // If the kernel is sampled
+    return;
+  }
 
-      u64 host = reinterpret_cast<u64>(memory->value.get());
-      u64 host_cache = reinterpret_cast<u64>(memory->value_cache.get());
-      u64 device = memory->memory_range.start;
-
-      CopyType copy_type = CopyType::DEFAULT;
-
-      auto device_start_min = mem_iter.second.begin()->start;
-      auto device_end_max = std::prev(mem_iter.second.end())->end;
-      auto device_range_len = device_end_max - device_start_min;
-      auto overwrite_ratio = static_cast<double>(overwrite) / memory->len;
-      auto device_range_ratio = static_cast<double>(device_range_len) / memory->len;
-      auto range_size = mem_iter.second.size();
-      // TODO(Keren): derive a cost model based switch
-      if (overwrite_ratio < _FRAGMENT_RATIO_LIMIT && memory->len > _FRAGMENT_SIZE_LIMIT &&
-        range_size < _FRAGMENT_LEN_LIMIT) {
-        copy_type = CopyType::NON_CONTINOUS_FRAGMENT;
-      } else {
-        dtoh(host_cache + device_start_min - device, device, device_range_len);
-        copy_type = CopyType::MIN_MAX_FRAGMENT;
+  // Metrics are computed without the graph lock so that kernels from different cpu threads
+  // overlap. Only the shadow copy of each memory is protected.
+  for (auto &update : read_updates) {
+    auto &memory = update.memory;
+    if (_configs[REDSHOW_ANALYSIS_READ_TRACE_IGNORE] == false) {
+      for (auto &range_iter : *update.ranges) {
+        update.overwrite += range_iter.end - range_iter.start;
       }
+    } else {
+      update.overwrite = memory->len;
+    }
+  }
+
+  Path<MemoryRange> ranges;
+  for (auto &update : write_updates) {
+    auto &memory = update.memory;
+    auto &memory_ranges = *update.ranges;
+    auto overwrite = 0;
+
+    ranges.reset();
+    for (auto &range_iter : memory_ranges) {
+      overwrite += range_iter.end - range_iter.start;
+      ranges.push_back(std::move(MemoryRange(range_iter.start, range_iter.end)));
+    }
+
+    std::lock_guard<std::mutex> memory_guard(memory_lock(memory->op_id));
+
+    u64 host = reinterpret_cast<u64>(memory->value.get());
+    u64 host_cache = reinterpret_cast<u64>(memory->value_cache.get());
+    u64 device = memory->memory_range.start;
+
+    CopyType copy_type = CopyType::DEFAULT;
+
+    auto device_start_min = memory_ranges.begin()->start;
+    auto device_end_max = std::prev(memory_ranges.end())->end;
+    auto device_range_len = device_end_max - device_start_min;
+    auto overwrite_ratio = static_cast<double>(overwrite) / memory->len;
+    auto device_range_ratio = static_cast<double>(device_range_len) / memory->len;
+    auto range_size = memory_ranges.size();
+    // TODO(Keren): derive a cost model based switch
+    if (overwrite_ratio < _FRAGMENT_RATIO_LIMIT && memory->len > _FRAGMENT_SIZE_LIMIT &&
+      range_size < _FRAGMENT_LEN_LIMIT) {
+      copy_type = CopyType::NON_CONTINOUS_FRAGMENT;
+    } else {
+      dtoh(host_cache + device_start_min - device, device, device_range_len);
+      copy_type = CopyType::MIN_MAX_FRAGMENT;
+    }
 
 #ifdef DEBUG_DATA_FLOW
-      //Reserve for debugging
-      std::cout << " ratio: " << overwrite_ratio << ", min_max_ratio: " << device_range_ratio
-        << ", len: " << memory->len << ", pieces: " << mem_iter.second.size()
-        << ", policy: " << static_cast<int>(copy_type) << std::endl;
+    //Reserve for debugging
+    std::cout << " ratio: " << overwrite_ratio << ", min_max_ratio: " << device_range_ratio
+      << ", len: " << memory->len << ", pieces: " << memory_ranges.size()
+      << ", policy: " << static_cast<int>(copy_type) << std::endl;
 #endif
 
-      // Update host, cannot be multi-threading because spawned threads do not have context
-      if (copy_type == CopyType::NON_CONTINOUS_FRAGMENT) {
-        for (auto &range_iter : mem_iter.second) {
-          auto host_cache_start = host_cache + range_iter.start - device;
-          auto host_start = host + range_iter.start - device;
-          auto range_len = range_iter.end - range_iter.start;
-          dtoh(host_cache_start, range_iter.start, range_len);
-        }
+    // Update host, cannot be multi-threading because spawned threads do not have context
+    if (copy_type == CopyType::NON_CONTINOUS_FRAGMENT) {
+      for (auto &range_iter : memory_ranges) {
+        auto host_cache_start = host_cache + range_iter.start - device;
+        auto host_start = host + range_iter.start - device;
+        auto range_len = range_iter.end - range_iter.start;
+        dtoh(host_cache_start, range_iter.start, range_len);
       }
-      
-      // Compute redundancy and update host
-      auto redundancy = 0;
+    }
+
+    // Compute redundancy and update host
+    auto redundancy = 0;
 #ifdef OPENMP
-#pragma omp parallel for if (_ranges.size() > OMP_SEQ_LEN) reduction(+:redundancy)
+#pragma omp parallel for if (ranges.size() > OMP_SEQ_LEN) reduction(+:redundancy)
 #endif
-      for (size_t i = 0; i < _ranges.size(); ++i) {
-        auto &range = _ranges[i];
-        auto host_cache_start = host_cache + range.start - device;
-        auto host_start = host + range.start - device;
-        auto range_len = range.end - range.start;
-        redundancy += compute_memcpy_redundancy<true>(host_start, host_cache_start, range_len);
-      }
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      auto &range = ranges[i];
+      auto host_cache_start = host_cache + range.start - device;
+      auto host_start = host + range.start - device;
+      auto range_len = range.end - range.start;
+      redundancy += compute_memcpy_redundancy<true>(host_start, host_cache_start, range_len);
+    }
 
-      // Point the operation to the calling context
-      link_op_node(memory->op_id, op->ctx_id, memory->ctx_id);
-      update_op_metrics(memory->op_id, op->ctx_id, memory->ctx_id, redundancy, overwrite,
-                        memory->len);
-      update_op_node(memory->op_id, op->ctx_id);
+    update.redundancy = redundancy;
+    update.overwrite = overwrite;
 
-      std::string hash;
-      if (_configs[REDSHOW_ANALYSIS_DATA_FLOW_HASH] == true) {
-        hash = compute_memory_hash(reinterpret_cast<u64>(host_cache), memory->len);
-        _node_hash[op->ctx_id].emplace(hash);
-      }
+    if (_configs[REDSHOW_ANALYSIS_DATA_FLOW_HASH] == true) {
+      update.hash = compute_memory_hash(reinterpret_cast<u64>(host_cache), memory->len);
+    }
+  }
+
+  lock();
+
+  // Edges are linked by host_op_id, so kernels finished out of order by different cpu threads
+  // still point to their real predecessors. Reads go first to avoid self loops.
+  for (auto &update : read_updates) {
+    auto &memory = update.memory;
+    i32 node_id = 0;
+    if (find_op_node(memory->op_id, op->op_id, node_id)) {
+      // Link a pure read edge between two calling contexts
+      link_ctx_node(node_id, op->ctx_id, memory->ctx_id, DATA_FLOW_EDGE_READ);
+      update_op_metrics(memory->op_id, op->op_id, op->ctx_id, memory->ctx_id, 0.0,
+                        update.overwrite, memory->len, DATA_FLOW_EDGE_READ);
+    }
+  }
+
+  for (auto &update : write_updates) {
+    auto &memory = update.memory;
+
+    // Point the operation to the calling context
+    link_op_node(memory->op_id, op->op_id, op->ctx_id, memory->ctx_id);
+    update_op_metrics(memory->op_id, op->op_id, op->ctx_id, memory->ctx_id, update.redundancy,
+                      update.overwrite, memory->len);
+    update_op_node(memory->op_id, op->op_id, op->ctx_id);
+
+    if (_configs[REDSHOW_ANALYSIS_DATA_FLOW_HASH] == true) {
+      _node_hash[op->ctx_id].emplace(update.hash);
+    }
 
 #ifdef DEBUG_DATA_FLOW
-      std::cout << "ctx: " << op->ctx_id << ", hash: " << hash << ", redundancy: " << redundancy
-                << " overwrite, " << overwrite << ", memory->id: " << memory->ctx_id 
-                << ", memory->len: " << memory->len << std::endl;
+    std::cout << "ctx: " << op->ctx_id << ", hash: " << update.hash
+              << ", redundancy: " << update.redundancy << " overwrite, " << update.overwrite
+              << ", memory->id: " << memory->ctx_id << ", memory->len: " << memory->len
+              << std::endl;
 #endif
-    }
   }
 
-  _trace->read_memory.clear();
-  _trace->write_memory.clear();
-  _trace = NULL;
+  unlock();
+
+  trace->read_memory.clear();
+  trace->write_memory.clear();
 }
 
 void DataFlow::memory_op_callback(std::shared_ptr<Memory> op) {
-  update_op_node(op->op_id, op->ctx_id);
+  update_op_node(op->op_id, op->op_id, op->ctx_id);
   _memories.try_emplace(op->op_id, op);
 
   // Update host
@@ -171,14 +223,16 @@ void DataFlow::memory_op_callback(std::shared_ptr<Memory> op) {
 }
 
 void DataFlow::memset_op_callback(std::shared_ptr<Memset> op) {
+  std::lock_guard<std::mutex> memory_guard(memory_lock(op->memory_op_id));
+
   u64 redundancy = compute_memset_redundancy(op->start, op->value, op->len);
   u64 overwrite = op->len;
 
   auto memory = _memories.at(op->memory_op_id);
-  link_op_node(op->memory_op_id, op->ctx_id, memory->ctx_id);
-  update_op_metrics(op->memory_op_id, op->ctx_id, memory->ctx_id, redundancy, overwrite,
-                    memory->len);
-  update_op_node(op->memory_op_id, op->ctx_id);
+  link_op_node(op->memory_op_id, op->op_id, op->ctx_id, memory->ctx_id);
+  update_op_metrics(op->memory_op_id, op->op_id, op->ctx_id, memory->ctx_id, redundancy,
+                    overwrite, memory->len);
+  update_op_node(op->memory_op_id, op->op_id, op->ctx_id);
 
   // Update host
   memset(reinterpret_cast<void *>(op->start), op->value, op->len);
@@ -202,26 +256,37 @@ void DataFlow::memcpy_op_callback(std::shared_ptr<Memcpy> op) {
   auto src_len = src_memory->len == 0 ? op->len : src_memory->len;
   auto dst_len = dst_memory->len == 0 ? op->len : dst_memory->len;
 
+  // Kernels from other cpu threads may be updating the same shadow memories
+  std::unique_lock<std::mutex> src_guard(memory_lock(op->src_memory_op_id), std::defer_lock);
+  std::unique_lock<std::mutex> dst_guard(memory_lock(op->dst_memory_op_id), std::defer_lock);
+  if (src_guard.mutex() == dst_guard.mutex()) {
+    dst_guard.lock();
+  } else {
+    std::lock(src_guard, dst_guard);
+  }
+
   u64 redundancy = compute_memcpy_redundancy<false>(op->dst_start, op->src_start, op->len);
 
   if (op->dst_memory_op_id == REDSHOW_MEMORY_HOST || op->dst_memory_op_id == REDSHOW_MEMORY_UVM) {
     // sink edge
-    auto dst_ctx_id = _op_node.at(op->dst_memory_op_id);
+    i32 dst_ctx_id = 0;
+    find_op_node(op->dst_memory_op_id, op->op_id, dst_ctx_id);
     link_ctx_node(op->ctx_id, dst_ctx_id, src_memory->ctx_id, DATA_FLOW_EDGE_SINK);
     update_edge_metrics(op->ctx_id, dst_ctx_id, src_memory->ctx_id, redundancy, overwrite, dst_len,
                         DATA_FLOW_EDGE_SINK);
   } else {
-    link_op_node(op->dst_memory_op_id, op->ctx_id, dst_memory->ctx_id);
-    update_op_metrics(op->dst_memory_op_id, op->ctx_id, dst_memory->ctx_id, redundancy, overwrite,
-                      dst_len);
-    update_op_node(op->dst_memory_op_id, op->ctx_id);
+    link_op_node(op->dst_memory_op_id, op->op_id, op->ctx_id, dst_memory->ctx_id);
+    update_op_metrics(op->dst_memory_op_id, op->op_id, op->ctx_id, dst_memory->ctx_id, redundancy,
+                      overwrite, dst_len);
+    update_op_node(op->dst_memory_op_id, op->op_id, op->ctx_id);
   }
 
-  auto src_ctx_id = _op_node.at(op->src_memory_op_id);
-  auto dst_ctx_id = _op_node.at(op->dst_memory_op_id);
-  link_ctx_node(src_ctx_id, op->ctx_id, src_memory->ctx_id, DATA_FLOW_EDGE_READ);
-  update_op_metrics(op->src_memory_op_id, op->ctx_id, src_memory->ctx_id, 0.0, overwrite, src_len,
-                    DATA_FLOW_EDGE_READ);
+  i32 src_ctx_id = 0;
+  if (find_op_node(op->src_memory_op_id, op->op_id, src_ctx_id)) {
+    link_ctx_node(src_ctx_id, op->ctx_id, src_memory->ctx_id, DATA_FLOW_EDGE_READ);
+    update_op_metrics(op->src_memory_op_id, op->op_id, op->ctx_id, src_memory->ctx_id, 0.0,
+                      overwrite, src_len, DATA_FLOW_EDGE_READ);
+  }
 
   // Update host
   memory_copy(reinterpret_cast<void *>(op->dst_start), reinterpret_cast<void *>(op->src_start),
@@ -244,19 +309,27 @@ void DataFlow::memcpy_op_callback(std::shared_ptr<Memcpy> op) {
   }
 }
 
-void DataFlow::op_callback(OperationPtr op) {
+void DataFlow::add_op_node(OperationPtr op) {
   // Add a calling context node
-  lock();
-
   if (!_graph.has_node(op->ctx_id)) {
     // Allocate calling context node
     _graph.add_node(std::move(op->ctx_id), op->ctx_id, op->type);
   }
   _node_count[op->ctx_id]++;
+}
 
+void DataFlow::op_callback(OperationPtr op) {
   if (op->type == OPERATION_TYPE_KERNEL) {
+    // Kernels take the lock by themselves
     kernel_op_callback(std::dynamic_pointer_cast<Kernel>(op));
-  } else if (op->type == OPERATION_TYPE_MEMORY) {
+    return;
+  }
+
+  lock();
+
+  add_op_node(op);
+
+  if (op->type == OPERATION_TYPE_MEMORY) {
     memory_op_callback(std::dynamic_pointer_cast<Memory>(op));
   } else if (op->type == OPERATION_TYPE_MEMCPY) {
     memcpy_op_callback(std::dynamic_pointer_cast<Memcpy>(op));
@@ -282,11 +355,13 @@ void DataFlow::analysis_begin(u32 cpu_thread, i32 kernel_id, u32 cubin_id, u32 m
   }
 
   _trace = std::dynamic_pointer_cast<DataFlowTrace>(this->_kernel_trace[cpu_thread][kernel_id]);
+  // Consumed by the kernel operation launched from the same cpu thread
+  _thread_trace[cpu_thread] = _trace;
 
   unlock();
 }
 
-void DataFlow::analysis_end(u32 cpu_thread, i32 kernel_id) {}
+void DataFlow::analysis_end(u32 cpu_thread, i32 kernel_id) { _trace.reset(); }
 
 void DataFlow::block_enter(const ThreadId &thread_id) {
   // No operation
@@ -417,25 +492,48 @@ void DataFlow::link_ctx_node(i32 src_ctx_id, i32 dst_ctx_id, i32 mem_ctx_id, Edg
   _graph.add_edge(std::move(edge_index), type);
 }
 
-void DataFlow::link_op_node(u64 op_id, i32 ctx_id, i32 mem_ctx_id) {
-  if (_op_node.find(op_id) != _op_node.end()) {
-    auto prev_ctx_id = _op_node.at(op_id);
+bool DataFlow::find_op_node(u64 op_id, u64 host_op_id, i32 &ctx_id) {
+  if (!_op_node.has(op_id)) {
+    return false;
+  }
+
+  // The latest operation on the memory that was issued before host_op_id. Only writers registered
+  // so far are known, so a predecessor that arrives later is missed, and only the last
+  // _OP_NODE_HISTORY_LIMIT writers are kept
+  auto &op_nodes = _op_node.at(op_id);
+  auto iter = op_nodes.lower_bound(host_op_id);
+  if (iter == op_nodes.begin()) {
+    return false;
+  }
+  --iter;
+  ctx_id = iter->second;
+  return true;
+}
+
+void DataFlow::link_op_node(u64 op_id, u64 host_op_id, i32 ctx_id, i32 mem_ctx_id) {
+  i32 prev_ctx_id = 0;
+  if (find_op_node(op_id, host_op_id, prev_ctx_id)) {
     link_ctx_node(prev_ctx_id, ctx_id, mem_ctx_id, DATA_FLOW_EDGE_ORDER);
   }
 }
 
-void DataFlow::update_op_node(u64 op_id, i32 ctx_id) {
+void DataFlow::update_op_node(u64 op_id, u64 host_op_id, i32 ctx_id) {
   if (op_id > REDSHOW_MEMORY_HOST) {
     // Point the operation to the calling context
-    _op_node[op_id] = ctx_id;
+    auto &op_nodes = _op_node[op_id];
+    op_nodes[host_op_id] = ctx_id;
+    // Only operations within a small window can arrive out of order
+    if (op_nodes.size() > _OP_NODE_HISTORY_LIMIT) {
+      op_nodes.erase(op_nodes.begin());
+    }
   }
 }
 
-void DataFlow::update_op_metrics(u64 op_id, i32 ctx_id, i32 mem_ctx_id, u64 redundancy,
-                                 u64 overwrite, u64 count, EdgeType type) {
+void DataFlow::update_op_metrics(u64 op_id, u64 host_op_id, i32 ctx_id, i32 mem_ctx_id,
+                                 u64 redundancy, u64 overwrite, u64 count, EdgeType type) {
   // Update current edge's property
-  if (_op_node.find(op_id) != _op_node.end()) {
-    auto prev_ctx_id = _op_node.at(op_id);
+  i32 prev_ctx_id = 0;
+  if (find_op_node(op_id, host_op_id, prev_ctx_id)) {
     update_edge_metrics(prev_ctx_id, ctx_id, mem_ctx_id, redundancy, overwrite, count, type);
   }
 }
@@ -0,0 +1,189 @@
+#include "analysis/items_value_count.h"
+
+#include <iterator>
+
+namespace redshow {
+
+void ItemsValueCount::merge(const ItemsValueCount &other, u64 value_mask) {
+  if (_capacity == 0) {
+    _capacity = other._capacity;
+  }
+  if (other._shift > _shift) {
+    resample(other._shift);
+  }
+  _untracked += other._untracked;
+  _evicted += other._evicted;
+  other.for_each([this, value_mask](u64 offset, const Item &item) {
+    item.for_each([this, offset, value_mask](u64 value, u64 count) {
+      this->add(offset, value & value_mask, count);
+    });
+  });
+}
+
+void ItemsValueCount::evict(ValueCount &values, u64 value, u64 count) {
+  auto min_iter = values.begin();
+  for (auto iter = values.begin(); iter != values.end(); ++iter) {
+    if (iter->second < min_iter->second) {
+      min_iter = iter;
+    }
+  }
+  auto min_count = min_iter->second;
+  _evicted += min_count;
+  values.erase(min_iter);
+  values[value] = min_count + count;
+}
+
+void ItemsValueCount::resample(u32 shift) {
+  ItemsValueCount items(_capacity, _max_items, _max_values);
+  items._shift = shift;
+  items._untracked = _untracked;
+  items._evicted = _evicted;
+  for_each([&items](u64 offset, const Item &item) {
+    item.for_each([&items, offset](u64 value, u64 count) { items.add(offset, value, count); });
+  });
+  *this = std::move(items);
+}
+
+size_t ItemsValueCount::bytes() const noexcept {
+  return _slots.capacity() * sizeof(Slot) +
+         _runs.size() * (MAP_NODE_OVERHEAD + sizeof(u64) + sizeof(Run)) +
+         _spill.size() * (MAP_NODE_OVERHEAD + sizeof(u64) + sizeof(ValueCount)) +
+         _spill_values * (MAP_NODE_OVERHEAD + sizeof(u64) + sizeof(u64));
+}
+
+void ItemsValueCount::save(BinaryWriter &writer) const {
+  serialize(writer, _capacity);
+  serialize(writer, _max_items);
+  serialize(writer, _max_values);
+  serialize(writer, _shift);
+  serialize(writer, _untracked);
+  serialize(writer, _evicted);
+  u64 size = _size;
+  serialize(writer, size);
+  for_each([&writer](u64 offset, const Item &item) {
+    u64 values = item.size();
+    serialize(writer, offset);
+    serialize(writer, values);
+    item.for_each([&writer](u64 value, u64 count) {
+      serialize(writer, value);
+      serialize(writer, count);
+    });
+  });
+}
+
+void ItemsValueCount::load(BinaryReader &reader) {
+  u64 capacity = 0;
+  u64 max_items = 0;
+  u64 max_values = 0;
+  deserialize(reader, capacity);
+  deserialize(reader, max_items);
+  deserialize(reader, max_values);
+  ItemsValueCount items(capacity, max_items, max_values);
+  deserialize(reader, items._shift);
+  u64 untracked = 0;
+  u64 evicted = 0;
+  deserialize(reader, untracked);
+  deserialize(reader, evicted);
+
+  // Items are within the limits, adding them back samples or evicts nothing
+  u64 size = 0;
+  deserialize(reader, size);
+  for (u64 i = 0; i < size && reader.good(); ++i) {
+    u64 offset = 0;
+    u64 values = 0;
+    deserialize(reader, offset);
+    deserialize(reader, values);
+    for (u64 j = 0; j < values && reader.good(); ++j) {
+      u64 value = 0;
+      u64 count = 0;
+      deserialize(reader, value);
+      deserialize(reader, count);
+      items.add(offset, value, count);
+    }
+  }
+  items._untracked = untracked;
+  items._evicted = evicted;
+  *this = std::move(items);
+}
+
+void ItemsValueCount::add_run(u64 index, u64 value, u64 count) {
+  auto iter = _runs.prev(index);
+  if (iter != _runs.end() && index < iter->second.end) {
+    // An accessed item
+    auto slot = iter->second.slot;
+    if (slot.count == _SPILLED) {
+      add_spilled(index, value, count);
+      return;
+    }
+    if (slot.value == value) {
+      slot.count += count;
+    } else {
+      spill(index, slot, value, count);
+    }
+    merge_run(split_run(iter, index, slot));
+    return;
+  }
+
+  ++_size;
+  Slot slot(value, count);
+  if (iter != _runs.end() && iter->second.end == index && iter->second.slot == slot) {
+    // Extend the run in place
+    iter->second.end += 1;
+  } else {
+    auto hint = iter == _runs.end() ? _runs.begin() : std::next(iter);
+    iter = _runs.emplace_hint(hint, index, Run(index + 1, slot));
+  }
+  merge_run(iter);
+
+  auto capacity = (_capacity + stride() - 1) >> _shift;
+  if (capacity != 0 && _runs.size() * _DENSITY >= capacity) {
+    densify();
+  }
+}
+
+Map<u64, ItemsValueCount::Run>::iterator ItemsValueCount::split_run(
+    Map<u64, Run>::iterator iter, u64 index, const Slot &slot) {
+  auto run = iter->second;
+  if (iter->first < index) {
+    iter->second.end = index;
+    iter = _runs.emplace_hint(std::next(iter), index, Run(index + 1, slot));
+  } else {
+    iter->second = Run(index + 1, slot);
+  }
+  if (index + 1 < run.end) {
+    _runs.emplace_hint(std::next(iter), index + 1, run);
+  }
+  return iter;
+}
+
+void ItemsValueCount::merge_run(Map<u64, Run>::iterator iter) {
+  auto next = std::next(iter);
+  if (next != _runs.end() && next->first == iter->second.end &&
+      next->second.slot == iter->second.slot) {
+    iter->second.end = next->second.end;
+    _runs.erase(next);
+  }
+  if (iter != _runs.begin()) {
+    auto prev = std::prev(iter);
+    if (prev->second.end == iter->first && prev->second.slot == iter->second.slot) {
+      prev->second.end = iter->second.end;
+      _runs.erase(iter);
+    }
+  }
+}
+
+void ItemsValueCount::densify() {
+  auto size = (_capacity + stride() - 1) >> _shift;
+  if (!_runs.empty()) {
+    size = MAX2(size, _runs.rbegin()->second.end);
+  }
+  _slots.resize(size);
+  for (auto &iter : _runs) {
+    for (u64 index = iter.first; index < iter.second.end; ++index) {
+      _slots[index] = iter.second.slot;
+    }
+  }
+  Map<u64, Run>().swap(_runs);
+}
+
+}  // namespace redshow
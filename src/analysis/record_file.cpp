@@ -0,0 +1,178 @@
+#include "analysis/record_file.h"
+
+#include <cstddef>
+#include <cstring>
+
+namespace redshow {
+
+u32 record_field_size(RecordFieldType type) {
+  switch (type) {
+    case RECORD_FIELD_U8:
+      return 1;
+    case RECORD_FIELD_U32:
+    case RECORD_FIELD_I32:
+    case RECORD_FIELD_ACCESS_KIND:
+      return 4;
+    case RECORD_FIELD_U64:
+    case RECORD_FIELD_F64:
+    case RECORD_FIELD_VALUE:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+static RecordTable access_kind_table() {
+  RecordTable table("access_kind", sizeof(AccessKindRecord));
+  table.fields.emplace_back("id", RECORD_FIELD_U32, offsetof(AccessKindRecord, id));
+  table.fields.emplace_back("data_type", RECORD_FIELD_U32, offsetof(AccessKindRecord, data_type));
+  table.fields.emplace_back("vec_size", RECORD_FIELD_U32, offsetof(AccessKindRecord, vec_size));
+  table.fields.emplace_back("unit_size", RECORD_FIELD_U32, offsetof(AccessKindRecord, unit_size));
+  return table;
+}
+
+static void write_u32(std::ostream &out, u32 value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void write_string(std::ostream &out, const std::string &value) {
+  write_u32(out, value.size());
+  out.write(value.data(), value.size());
+}
+
+static bool read_u32(std::istream &in, u32 &value) {
+  return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+static bool read_string(std::istream &in, std::string &value) {
+  u32 size = 0;
+  if (!read_u32(in, size)) {
+    return false;
+  }
+  value.resize(size);
+  return static_cast<bool>(in.read(&value[0], size));
+}
+
+bool RecordWriter::open(const std::string &path, const std::string &name,
+                        const Vector<RecordTable> &tables) {
+  _out.open(path, std::ios::binary);
+  if (!_out.is_open()) {
+    return false;
+  }
+
+  Vector<RecordTable> all_tables;
+  all_tables.emplace_back(access_kind_table());
+  all_tables.insert(all_tables.end(), tables.begin(), tables.end());
+
+  _out.write(RECORD_FILE_MAGIC, sizeof(RECORD_FILE_MAGIC));
+  write_u32(_out, RECORD_FILE_VERSION);
+  write_string(_out, name);
+  write_u32(_out, all_tables.size());
+  for (auto &table : all_tables) {
+    write_string(_out, table.name);
+    write_u32(_out, table.size);
+    write_u32(_out, table.fields.size());
+    for (auto &field : table.fields) {
+      write_string(_out, field.name);
+      write_u32(_out, field.type);
+      write_u32(_out, field.offset);
+    }
+    _sizes.push_back(table.size);
+  }
+  return true;
+}
+
+u32 RecordWriter::access_kind_id(const AccessKind &access_kind) {
+  auto iter = _access_kinds.find(access_kind);
+  if (iter != _access_kinds.end()) {
+    return iter->second;
+  }
+
+  AccessKindRecord record;
+  clear_record(record);
+  record.id = _access_kinds.size();
+  record.data_type = access_kind.data_type;
+  record.vec_size = access_kind.vec_size;
+  record.unit_size = access_kind.unit_size;
+  write(RECORD_TABLE_ACCESS_KIND, &record, 1);
+  _access_kinds[access_kind] = record.id;
+  return record.id;
+}
+
+void RecordWriter::write(u32 table, const void *records, u64 count) {
+  if (count == 0) {
+    return;
+  }
+
+  write_u32(_out, table);
+  _out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  _out.write(reinterpret_cast<const char *>(records), count * _sizes[table]);
+}
+
+bool RecordReader::open(const std::string &path) {
+  _in.open(path, std::ios::binary);
+
+  char magic[sizeof(RECORD_FILE_MAGIC)];
+  u32 version = 0;
+  if (!_in.read(magic, sizeof(magic)) || memcmp(magic, RECORD_FILE_MAGIC, sizeof(magic)) != 0 ||
+      !read_u32(_in, version) || version != RECORD_FILE_VERSION || !read_string(_in, _name)) {
+    return false;
+  }
+
+  u32 table_count = 0;
+  if (!read_u32(_in, table_count)) {
+    return false;
+  }
+  for (u32 i = 0; i < table_count; ++i) {
+    RecordTable table;
+    u32 field_count = 0;
+    if (!read_string(_in, table.name) || !read_u32(_in, table.size) ||
+        !read_u32(_in, field_count)) {
+      return false;
+    }
+    for (u32 j = 0; j < field_count; ++j) {
+      RecordField field;
+      u32 type = 0;
+      if (!read_string(_in, field.name) || !read_u32(_in, type) || !read_u32(_in, field.offset)) {
+        return false;
+      }
+      field.type = static_cast<RecordFieldType>(type);
+      table.fields.push_back(field);
+    }
+    _tables.push_back(table);
+  }
+  return !_tables.empty();
+}
+
+bool RecordReader::next(u32 &table, u64 &count, std::string &records) {
+  if (!read_u32(_in, table) || table >= _tables.size() ||
+      !_in.read(reinterpret_cast<char *>(&count), sizeof(count))) {
+    return false;
+  }
+
+  records.resize(count * _tables[table].size);
+  if (!_in.read(&records[0], records.size())) {
+    return false;
+  }
+
+  if (table == RECORD_TABLE_ACCESS_KIND) {
+    for (u64 i = 0; i < count; ++i) {
+      AccessKindRecord record;
+      memcpy(&record, records.data() + i * sizeof(record), sizeof(record));
+      _access_kinds[record.id] =
+          AccessKind(record.unit_size, record.vec_size,
+                     static_cast<redshow_data_type_t>(record.data_type));
+    }
+  }
+  return true;
+}
+
+AccessKind RecordReader::access_kind(u32 id) const {
+  auto iter = _access_kinds.find(id);
+  if (iter == _access_kinds.end()) {
+    return AccessKind();
+  }
+  return iter->second;
+}
+
+}  // namespace redshow
@@ -1,5 +1,6 @@
 #include "analysis/spatial_redundancy.h"
 
+#include <cstddef>
 #include <cstring>
 
 #include "common/vector.h"
@@ -22,6 +23,10 @@ void SpatialRedundancy::analysis_begin(u32 cpu_thread, i32 kernel_id, u32 cubin_
     trace->kernel.ctx_id = kernel_id;
     trace->kernel.cubin_id = cubin_id;
     trace->kernel.mod_id = mod_id;
+    redshow_sampling_mode_t sampling_mode;
+    u32 sampling_period;
+    redshow_sampling_get(&sampling_mode, &sampling_period);
+    trace->summarize = sampling_mode == REDSHOW_SAMPLING_ADAPTIVE;
     this->_kernel_trace[cpu_thread][kernel_id] = trace;
   }
 
@@ -47,132 +52,242 @@ void SpatialRedundancy::unit_access(i32 kernel_id, const ThreadId &thread_id,
   
   if (flags & GPU_PATCH_READ) {
     auto &spatial_trace = _trace->read_spatial_trace;
-    update_spatial_trace(pc, value, memory.op_id, access_kind, spatial_trace);
+    auto count = update_spatial_trace(pc, value, memory.op_id, access_kind, spatial_trace);
     _trace->read_pc_count[pc]++;
+    if (_trace->summarize) {
+      update_summary(pc, memory.op_id, access_kind, count, _trace->read_max_count);
+    }
   }
   
   if (flags & GPU_PATCH_WRITE) {
     auto &spatial_trace = _trace->write_spatial_trace;
-    update_spatial_trace(pc, value, memory.op_id, access_kind, spatial_trace);
+    auto count = update_spatial_trace(pc, value, memory.op_id, access_kind, spatial_trace);
     _trace->write_pc_count[pc]++;
+    if (_trace->summarize) {
+      update_summary(pc, memory.op_id, access_kind, count, _trace->write_max_count);
+    }
   }
 }
 
-void SpatialRedundancy::update_spatial_trace(u64 pc, u64 value, u64 memory_op_id,
-                                             AccessKind access_kind, SpatialTrace &spatial_trace) {
-  spatial_trace[std::make_pair(memory_op_id, access_kind)][pc][value] += 1;
+u64 SpatialRedundancy::update_spatial_trace(u64 pc, u64 value, u64 memory_op_id,
+                                            AccessKind access_kind, SpatialTrace &spatial_trace) {
+  return spatial_trace[std::make_pair(memory_op_id, access_kind)][pc][value] += 1;
+}
+
+void SpatialRedundancy::update_summary(u64 pc, u64 memory_op_id, AccessKind access_kind,
+                                       u64 count, SpatialMaxCount &max_count) {
+  // Redundant units of a pc are those of its most frequent value, which grows by one at most
+  auto &pc_max_count = max_count[std::make_pair(memory_op_id, access_kind)][pc];
+  if (count > pc_max_count) {
+    pc_max_count = count;
+    _trace->summary_count++;
+  }
+  _trace->summary_total_count++;
 }
 
 void SpatialRedundancy::flush_thread(u32 cpu_thread, const std::string &output_dir,
                                      const LockableMap<u32, Cubin> &cubins,
                                      redshow_record_data_callback_func record_data_callback) {
-  u32 pc_views_limit = 0;
   u32 mem_views_limit = 0;
 
-  redshow_pc_views_get(&pc_views_limit);
   redshow_mem_views_get(&mem_views_limit);
 
-  redshow_record_data_t record_data;
+  auto &thread_result = this->thread_result(cpu_thread, output_dir);
 
-  record_data.views = new redshow_record_view_t[pc_views_limit]();
+  // Spilled traces are read back one kernel at a time
+  for (auto kernel_id : trace_kernels(cpu_thread)) {
+    auto trace = std::dynamic_pointer_cast<RedundancyTrace>(thread_trace(cpu_thread, kernel_id));
+    if (trace.get() != NULL) {
+      flush_trace(cpu_thread, kernel_id, *trace, cubins, record_data_callback, thread_result);
+    }
+  }
 
+  if (mem_views_limit != 0) {
+    if (thread_result.count != 0) {
+      SpatialStatistics read_spatial_stats;
+      SpatialStatistics write_spatial_stats;
+
+      output_spatial_trace(cpu_thread, 0, thread_result.read_spatial_count, thread_result.count,
+                           read_spatial_stats, true, true, thread_result);
+      output_spatial_trace(cpu_thread, 0, thread_result.write_spatial_count, thread_result.count,
+                           write_spatial_stats, true, false, thread_result);
+    }
+  }
+
+  // Outputs are closed
   lock();
+  this->_thread_results.erase(cpu_thread);
+  unlock();
+}
+
+void SpatialRedundancy::flush_kernel(u32 cpu_thread, i32 kernel_id, const std::string &output_dir,
+                                     const LockableMap<u32, Cubin> &cubins,
+                                     redshow_record_data_callback_func record_data_callback) {
+  auto trace = std::dynamic_pointer_cast<RedundancyTrace>(release_trace(cpu_thread, kernel_id));
+  if (trace.get() == NULL) {
+    return;
+  }
 
-  auto &thread_kernel_trace = this->_kernel_trace.at(cpu_thread);
+  flush_trace(cpu_thread, kernel_id, *trace, cubins, record_data_callback,
+              thread_result(cpu_thread, output_dir));
+}
 
+SpatialRedundancy::ThreadResult &SpatialRedundancy::thread_result(u32 cpu_thread,
+                                                                  const std::string &output_dir) {
+  lock();
+  bool opened = this->_thread_results.has(cpu_thread);
+  auto &thread_result = this->_thread_results[cpu_thread];
   unlock();
 
-  std::ofstream out_read(output_dir + "spatial_read_t" + std::to_string(cpu_thread) + ".csv");
-  std::ofstream out_write(output_dir + "spatial_write_t" + std::to_string(cpu_thread) + ".csv");
-
-  u64 thread_count = 0;
-  u64 thread_read_spatial_count = 0;
-  u64 thread_write_spatial_count = 0;
-  for (auto &trace_iter : thread_kernel_trace) {
-    auto kernel_id = trace_iter.first;
-    auto trace = std::dynamic_pointer_cast<RedundancyTrace>(trace_iter.second);
-    auto &kernel = trace->kernel;
-    auto cubin_id = kernel.cubin_id;
-    auto mod_id = kernel.mod_id;
-    auto cubin_offset = 0;
-    u64 kernel_read_spatial_count = 0;
-    u64 kernel_write_spatial_count = 0;
-    u64 kernel_count = 0;
-    SpatialStatistics read_spatial_stats;
-    SpatialStatistics write_spatial_stats;
-    cubins.lock();
-    auto &symbols = cubins.at(cubin_id).symbols.at(mod_id);
-    cubins.unlock();
-
-    record_data.analysis_type = REDSHOW_ANALYSIS_SPATIAL_REDUNDANCY;
-    // read
-    record_data.access_type = REDSHOW_ACCESS_READ;
-    record_spatial_trace(pc_views_limit, mem_views_limit, trace->read_spatial_trace,
-                         trace->read_pc_count, read_spatial_stats, record_data,
-                         kernel_read_spatial_count);
-    // Transform pcs
-    symbols.transform_data_views(record_data);
-    record_data_callback(cubin_id, kernel_id, &record_data);
-    transform_spatial_statistics(cubin_id, symbols, read_spatial_stats);
-
-    // Write
-    record_data.access_type = REDSHOW_ACCESS_WRITE;
-    record_spatial_trace(pc_views_limit, mem_views_limit, trace->write_spatial_trace,
-                         trace->write_pc_count, write_spatial_stats, record_data,
-                         kernel_write_spatial_count);
-
-    // Transform pcs
-    symbols.transform_data_views(record_data);
-    record_data_callback(cubin_id, kernel_id, &record_data);
-    transform_spatial_statistics(cubin_id, symbols, write_spatial_stats);
-
-    // Accumulate all access count and red count
-    for (auto &iter : trace->read_pc_count) {
-      kernel_count += iter.second;
+  if (!opened) {
+    redshow_output_format_t format = REDSHOW_OUTPUT_CSV;
+    redshow_output_format_get(&format);
+    thread_result.binary = format == REDSHOW_OUTPUT_BINARY;
+
+    auto thread_name = "_t" + std::to_string(cpu_thread);
+    if (thread_result.binary) {
+      auto tables = record_tables();
+      thread_result.records_read.open(output_dir + "spatial_read" + thread_name + ".bin",
+                                      "spatial_redundancy", tables);
+      thread_result.records_write.open(output_dir + "spatial_write" + thread_name + ".bin",
+                                       "spatial_redundancy", tables);
+    } else {
+      thread_result.out_read.open(output_dir + "spatial_read" + thread_name + ".csv");
+      thread_result.out_write.open(output_dir + "spatial_write" + thread_name + ".csv");
     }
+  }
+  return thread_result;
+}
 
-    for (auto &iter : trace->write_pc_count) {
-      kernel_count += iter.second;
-    }
+void SpatialRedundancy::flush_trace(u32 cpu_thread, i32 kernel_id, RedundancyTrace &trace,
+                                    const LockableMap<u32, Cubin> &cubins,
+                                    redshow_record_data_callback_func record_data_callback,
+                                    ThreadResult &thread_result) {
+  u32 pc_views_limit = 0;
+  u32 mem_views_limit = 0;
 
-    thread_count += kernel_count;
-    thread_read_spatial_count += kernel_read_spatial_count;
-    thread_write_spatial_count += kernel_write_spatial_count;
+  redshow_pc_views_get(&pc_views_limit);
+  redshow_mem_views_get(&mem_views_limit);
 
-    if (mem_views_limit != 0) {
-      if (!read_spatial_stats.empty()) {
-        show_spatial_trace(cpu_thread, kernel_id, kernel_read_spatial_count, kernel_count,
-                           read_spatial_stats, false, out_read);
-      }
-      if (!write_spatial_stats.empty()) {
-        show_spatial_trace(cpu_thread, kernel_id, kernel_write_spatial_count, kernel_count,
-                           write_spatial_stats, false, out_write);
-      }
-    }
+  redshow_record_data_t record_data;
+
+  record_data.views = new redshow_record_view_t[pc_views_limit]();
+
+  auto &kernel = trace.kernel;
+  auto cubin_id = kernel.cubin_id;
+  auto mod_id = kernel.mod_id;
+  auto cubin_offset = 0;
+  u64 kernel_read_spatial_count = 0;
+  u64 kernel_write_spatial_count = 0;
+  u64 kernel_count = 0;
+  SpatialStatistics read_spatial_stats;
+  SpatialStatistics write_spatial_stats;
+  double scale = 1.0;
+  redshow_sampling_scale_get(cpu_thread, kernel_id, &scale);
+  cubins.lock();
+  auto &symbols = cubins.at(cubin_id).symbols.at(mod_id);
+  cubins.unlock();
+
+  record_data.analysis_type = REDSHOW_ANALYSIS_SPATIAL_REDUNDANCY;
+  // read
+  record_data.access_type = REDSHOW_ACCESS_READ;
+  record_spatial_trace(pc_views_limit, mem_views_limit, trace.read_spatial_trace,
+                       trace.read_pc_count, read_spatial_stats, record_data,
+                       kernel_read_spatial_count);
+  scale_spatial_statistics(scale, record_data, read_spatial_stats, kernel_read_spatial_count);
+  // Transform pcs
+  symbols.transform_data_views(record_data);
+  record_data_callback(cubin_id, kernel_id, &record_data);
+  transform_spatial_statistics(cubin_id, symbols, read_spatial_stats);
+
+  // Write
+  record_data.access_type = REDSHOW_ACCESS_WRITE;
+  record_spatial_trace(pc_views_limit, mem_views_limit, trace.write_spatial_trace,
+                       trace.write_pc_count, write_spatial_stats, record_data,
+                       kernel_write_spatial_count);
+  scale_spatial_statistics(scale, record_data, write_spatial_stats, kernel_write_spatial_count);
+
+  // Transform pcs
+  symbols.transform_data_views(record_data);
+  record_data_callback(cubin_id, kernel_id, &record_data);
+  transform_spatial_statistics(cubin_id, symbols, write_spatial_stats);
+
+  // Accumulate all access count and red count
+  for (auto &iter : trace.read_pc_count) {
+    kernel_count += iter.second;
   }
 
-  if (mem_views_limit != 0) {
-    if (thread_count != 0) {
-      SpatialStatistics read_spatial_stats;
-      SpatialStatistics write_spatial_stats;
+  for (auto &iter : trace.write_pc_count) {
+    kernel_count += iter.second;
+  }
+  kernel_count = scale_count(kernel_count, scale);
 
-      show_spatial_trace(cpu_thread, 0, thread_read_spatial_count, thread_count, read_spatial_stats,
-                         true, out_read);
-      show_spatial_trace(cpu_thread, 0, thread_write_spatial_count, thread_count,
-                         write_spatial_stats, true, out_write);
+  thread_result.count += kernel_count;
+  thread_result.read_spatial_count += kernel_read_spatial_count;
+  thread_result.write_spatial_count += kernel_write_spatial_count;
+
+  if (mem_views_limit != 0) {
+    if (!read_spatial_stats.empty()) {
+      output_spatial_trace(cpu_thread, kernel_id, kernel_read_spatial_count, kernel_count,
+                           read_spatial_stats, false, true, thread_result);
+    }
+    if (!write_spatial_stats.empty()) {
+      output_spatial_trace(cpu_thread, kernel_id, kernel_write_spatial_count, kernel_count,
+                           write_spatial_stats, false, false, thread_result);
     }
   }
 
-  out_read.close();
-  out_write.close();
-
   // Release data
   delete[] record_data.views;
 }
 
+void SpatialRedundancy::output_spatial_trace(u32 cpu_thread, i32 kernel_id, u64 total_red_count,
+                                             u64 total_count, SpatialStatistics &spatial_stats,
+                                             bool is_thread, bool read,
+                                             ThreadResult &thread_result) {
+  if (thread_result.binary) {
+    auto &records = read ? thread_result.records_read : thread_result.records_write;
+    write_spatial_records(cpu_thread, kernel_id, total_red_count, total_count, spatial_stats,
+                          is_thread, records);
+  } else {
+    auto &out = read ? thread_result.out_read : thread_result.out_write;
+    show_spatial_trace(cpu_thread, kernel_id, total_red_count, total_count, spatial_stats,
+                       is_thread, out);
+  }
+}
+
 void SpatialRedundancy::flush(const std::string &output_dir, const LockableMap<u32, Cubin> &cubins,
                               redshow_record_data_callback_func record_data_callback) {}
 
+size_t SpatialRedundancy::trace_size(const Trace &trace) const {
+  auto &redundancy_trace = dynamic_cast<const RedundancyTrace &>(trace);
+  return heap_size(redundancy_trace.read_spatial_trace) +
+         heap_size(redundancy_trace.write_spatial_trace) +
+         heap_size(redundancy_trace.read_pc_count) + heap_size(redundancy_trace.write_pc_count) +
+         heap_size(redundancy_trace.read_max_count) + heap_size(redundancy_trace.write_max_count);
+}
+
+void SpatialRedundancy::save_trace(const Trace &trace, BinaryWriter &writer) const {
+  auto &redundancy_trace = dynamic_cast<const RedundancyTrace &>(trace);
+  serialize(writer, redundancy_trace.read_spatial_trace);
+  serialize(writer, redundancy_trace.write_spatial_trace);
+  serialize(writer, redundancy_trace.read_pc_count);
+  serialize(writer, redundancy_trace.write_pc_count);
+  serialize(writer, redundancy_trace.read_max_count);
+  serialize(writer, redundancy_trace.write_max_count);
+}
+
+std::shared_ptr<Trace> SpatialRedundancy::load_trace(BinaryReader &reader) const {
+  auto trace = std::make_shared<RedundancyTrace>();
+  deserialize(reader, trace->read_spatial_trace);
+  deserialize(reader, trace->write_spatial_trace);
+  deserialize(reader, trace->read_pc_count);
+  deserialize(reader, trace->write_pc_count);
+  deserialize(reader, trace->read_max_count);
+  deserialize(reader, trace->write_max_count);
+  return trace;
+}
+
 void SpatialRedundancy::record_spatial_trace(u32 pc_views_limit, u32 mem_views_limit,
                                              SpatialTrace &spatial_trace,
                                              PCAccessCount &pc_access_count,
@@ -306,13 +421,95 @@ void SpatialRedundancy::show_spatial_trace(u32 cpu_thread, i32 kernel_id, u64 to
           out << akind.value_to_string(value, true);
           out << "," << akind.to_string() << "," << red_count << ","
               << static_cast<double>(red_count) / access_count << ","
-              << static_cast<double>(red_count) / total_count << std::endl;
+              << static_cast<double>(red_count) / total_count << '\n';
         }
       }
     }
   }
 }
 
+void SpatialRedundancy::write_spatial_records(u32 cpu_thread, i32 kernel_id, u64 total_red_count,
+                                              u64 total_count, SpatialStatistics &spatial_stats,
+                                              bool is_thread, RecordWriter &records) {
+  if (is_thread) {
+    ThreadRecord record;
+    clear_record(record);
+    record.cpu_thread = cpu_thread;
+    record.redundant_access_count = total_red_count;
+    record.total_access_count = total_count;
+    records.write(RECORD_TABLE_THREAD, &record, 1);
+    return;
+  }
+
+  KernelRecord record;
+  clear_record(record);
+  record.kernel_id = kernel_id;
+  record.redundant_access_count = total_red_count;
+  record.total_access_count = total_count;
+  records.write(RECORD_TABLE_KERNEL, &record, 1);
+
+  // Access kinds are added to the dictionary before the block that refers to them
+  Vector<SpatialRecord> rows;
+  // {memory_op_id : {pc : [RealPCPair]}}
+  for (auto &spatial_iter : spatial_stats) {
+    for (auto &pc_iter : spatial_iter.second) {
+      for (auto &real_pc_pair : pc_iter.second) {
+        rows.emplace_back();
+        auto &row = rows.back();
+        clear_record(row);
+        row.memory_op_id = spatial_iter.first;
+        row.cubin_id = real_pc_pair.to_pc.cubin_id;
+        row.function_index = real_pc_pair.to_pc.function_index;
+        row.pc_offset = real_pc_pair.to_pc.pc_offset;
+        row.value = real_pc_pair.value;
+        row.access_kind = records.access_kind_id(real_pc_pair.access_kind);
+        row.count = real_pc_pair.red_count;
+        row.access_count = real_pc_pair.access_count;
+      }
+    }
+  }
+  records.write(RECORD_TABLE_SPATIAL, rows);
+}
+
+Vector<RecordTable> SpatialRedundancy::record_tables() {
+  Vector<RecordTable> tables;
+
+  RecordTable kernel_table("kernel", sizeof(KernelRecord));
+  kernel_table.fields.emplace_back("kernel_id", RECORD_FIELD_I32,
+                                   offsetof(KernelRecord, kernel_id));
+  kernel_table.fields.emplace_back("redundant_access_count", RECORD_FIELD_U64,
+                                   offsetof(KernelRecord, redundant_access_count));
+  kernel_table.fields.emplace_back("total_access_count", RECORD_FIELD_U64,
+                                   offsetof(KernelRecord, total_access_count));
+  tables.emplace_back(kernel_table);
+
+  RecordTable thread_table("thread", sizeof(ThreadRecord));
+  thread_table.fields.emplace_back("cpu_thread", RECORD_FIELD_U32,
+                                   offsetof(ThreadRecord, cpu_thread));
+  thread_table.fields.emplace_back("redundant_access_count", RECORD_FIELD_U64,
+                                   offsetof(ThreadRecord, redundant_access_count));
+  thread_table.fields.emplace_back("total_access_count", RECORD_FIELD_U64,
+                                   offsetof(ThreadRecord, total_access_count));
+  tables.emplace_back(thread_table);
+
+  RecordTable table("spatial_redundancy", sizeof(SpatialRecord));
+  table.fields.emplace_back("memory_op_id", RECORD_FIELD_U64,
+                            offsetof(SpatialRecord, memory_op_id));
+  table.fields.emplace_back("cubin_id", RECORD_FIELD_U32, offsetof(SpatialRecord, cubin_id));
+  table.fields.emplace_back("function_index", RECORD_FIELD_U32,
+                            offsetof(SpatialRecord, function_index));
+  table.fields.emplace_back("pc_offset", RECORD_FIELD_U64, offsetof(SpatialRecord, pc_offset));
+  table.fields.emplace_back("value", RECORD_FIELD_VALUE, offsetof(SpatialRecord, value));
+  table.fields.emplace_back("access_kind", RECORD_FIELD_ACCESS_KIND,
+                            offsetof(SpatialRecord, access_kind));
+  table.fields.emplace_back("count", RECORD_FIELD_U64, offsetof(SpatialRecord, count));
+  table.fields.emplace_back("access_count", RECORD_FIELD_U64,
+                            offsetof(SpatialRecord, access_count));
+  tables.emplace_back(table);
+
+  return tables;
+}
+
 void SpatialRedundancy::transform_spatial_statistics(u32 cubin_id, const SymbolVector &symbols,
                                                      SpatialStatistics &spatial_stats) {
   for (auto &spatial_stat_iter : spatial_stats) {
@@ -331,4 +528,28 @@ void SpatialRedundancy::transform_spatial_statistics(u32 cubin_id, const SymbolV
   }
 }
 
+void SpatialRedundancy::scale_spatial_statistics(double scale, redshow_record_data_t &record_data,
+                                                 SpatialStatistics &spatial_stats,
+                                                 u64 &kernel_spatial_count) {
+  if (scale == 1.0) {
+    return;
+  }
+
+  for (auto i = 0; i < record_data.num_views; ++i) {
+    record_data.views[i].red_count = scale_count(record_data.views[i].red_count, scale);
+    record_data.views[i].access_count = scale_count(record_data.views[i].access_count, scale);
+  }
+
+  for (auto &spatial_stat_iter : spatial_stats) {
+    for (auto &pc_iter : spatial_stat_iter.second) {
+      for (auto &real_pc_pair : pc_iter.second) {
+        real_pc_pair.red_count = scale_count(real_pc_pair.red_count, scale);
+        real_pc_pair.access_count = scale_count(real_pc_pair.access_count, scale);
+      }
+    }
+  }
+
+  kernel_spatial_count = scale_count(kernel_spatial_count, scale);
+}
+
 }  // namespace redshow
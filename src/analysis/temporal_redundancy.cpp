@@ -1,5 +1,6 @@
 #include "analysis/temporal_redundancy.h"
 
+#include <cstddef>
 #include <cstring>
 
 #include "operation/kernel.h"
@@ -21,6 +22,10 @@ void TemporalRedundancy::analysis_begin(u32 cpu_thread, i32 kernel_id, u32 cubin
     trace->kernel.ctx_id = kernel_id;
     trace->kernel.cubin_id = cubin_id;
     trace->kernel.mod_id = mod_id;
+    redshow_sampling_mode_t sampling_mode;
+    u32 sampling_period;
+    redshow_sampling_get(&sampling_mode, &sampling_period);
+    trace->summarize = sampling_mode == REDSHOW_SAMPLING_ADAPTIVE;
     this->_kernel_trace[cpu_thread][kernel_id] = trace;
   }
 
@@ -49,128 +54,232 @@ void TemporalRedundancy::unit_access(i32 kernel_id, const ThreadId &thread_id,
   if (flags & GPU_PATCH_READ) {
     auto &pc_pairs = _trace->read_pc_pairs;
     auto &temporal_trace = _trace->read_temporal_trace;
-    update_temporal_trace(pc, thread_id, addr, value, access_kind, temporal_trace, pc_pairs);
+    auto redundant =
+        update_temporal_trace(pc, thread_id, addr, value, access_kind, temporal_trace, pc_pairs);
     _trace->read_pc_count[pc]++;
+    if (_trace->summarize) {
+      _trace->summary_count += redundant;
+      _trace->summary_total_count++;
+    }
   }
   
   if (flags & GPU_PATCH_WRITE) {
     auto &pc_pairs = _trace->write_pc_pairs;
     auto &temporal_trace = _trace->write_temporal_trace;
-    update_temporal_trace(pc, thread_id, addr, value, access_kind, temporal_trace, pc_pairs);
+    auto redundant =
+        update_temporal_trace(pc, thread_id, addr, value, access_kind, temporal_trace, pc_pairs);
     _trace->write_pc_count[pc]++;
+    if (_trace->summarize) {
+      _trace->summary_count += redundant;
+      _trace->summary_total_count++;
+    }
   }
 }
 
 void TemporalRedundancy::flush_thread(u32 cpu_thread, const std::string &output_dir,
                                       const LockableMap<u32, Cubin> &cubins,
                                       redshow_record_data_callback_func record_data_callback) {
-  u32 pc_views_limit = 0;
   u32 mem_views_limit = 0;
 
-  redshow_pc_views_get(&pc_views_limit);
   redshow_mem_views_get(&mem_views_limit);
 
-  redshow_record_data_t record_data;
+  auto &thread_result = this->thread_result(cpu_thread, output_dir);
 
-  record_data.views = new redshow_record_view_t[pc_views_limit]();
+  // Spilled traces are read back one kernel at a time
+  for (auto kernel_id : trace_kernels(cpu_thread)) {
+    auto trace = std::dynamic_pointer_cast<RedundancyTrace>(thread_trace(cpu_thread, kernel_id));
+    if (trace.get() != NULL) {
+      flush_trace(cpu_thread, kernel_id, *trace, cubins, record_data_callback, thread_result);
+    }
+  }
+
+  if (mem_views_limit != 0) {
+    if (thread_result.count != 0) {
+      TemporalStatistics read_temporal_stats;
+      TemporalStatistics write_temporal_stats;
+
+      output_temporal_trace(cpu_thread, 0, thread_result.read_temporal_count, thread_result.count,
+                            read_temporal_stats, true, true, thread_result);
+      output_temporal_trace(cpu_thread, 0, thread_result.write_temporal_count, thread_result.count,
+                            write_temporal_stats, true, false, thread_result);
+    }
+  }
 
+  // Outputs are closed
   lock();
+  this->_thread_results.erase(cpu_thread);
+  unlock();
+}
+
+void TemporalRedundancy::flush_kernel(u32 cpu_thread, i32 kernel_id, const std::string &output_dir,
+                                      const LockableMap<u32, Cubin> &cubins,
+                                      redshow_record_data_callback_func record_data_callback) {
+  auto trace = std::dynamic_pointer_cast<RedundancyTrace>(release_trace(cpu_thread, kernel_id));
+  if (trace.get() == NULL) {
+    return;
+  }
 
-  auto &thread_kernel_trace = this->_kernel_trace.at(cpu_thread);
+  flush_trace(cpu_thread, kernel_id, *trace, cubins, record_data_callback,
+              thread_result(cpu_thread, output_dir));
+}
 
+TemporalRedundancy::ThreadResult &TemporalRedundancy::thread_result(u32 cpu_thread,
+                                                                    const std::string &output_dir) {
+  lock();
+  bool opened = this->_thread_results.has(cpu_thread);
+  auto &thread_result = this->_thread_results[cpu_thread];
   unlock();
 
-  std::ofstream out_read(output_dir + "temporal_read_t" + std::to_string(cpu_thread) + ".csv");
-  std::ofstream out_write(output_dir + "temporal_write_t" + std::to_string(cpu_thread) + ".csv");
-
-  u64 thread_count = 0;
-  u64 thread_read_temporal_count = 0;
-  u64 thread_write_temporal_count = 0;
-  for (auto &trace_iter : thread_kernel_trace) {
-    auto kernel_id = trace_iter.first;
-    auto trace = std::dynamic_pointer_cast<RedundancyTrace>(trace_iter.second);
-    auto &kernel = trace->kernel;
-    auto cubin_id = kernel.cubin_id;
-    auto mod_id = kernel.mod_id;
-    auto cubin_offset = 0;
-    u64 kernel_read_temporal_count = 0;
-    u64 kernel_write_temporal_count = 0;
-    u64 kernel_count = 0;
-    TemporalStatistics read_temporal_stats;
-    TemporalStatistics write_temporal_stats;
-    cubins.lock();
-    auto &symbols = cubins.at(cubin_id).symbols.at(mod_id);
-    cubins.unlock();
-
-    record_data.analysis_type = REDSHOW_ANALYSIS_TEMPORAL_REDUNDANCY;
-    // Read
-    record_data.access_type = REDSHOW_ACCESS_READ;
-    record_temporal_trace(pc_views_limit, mem_views_limit, trace->read_pc_pairs,
-                          trace->read_pc_count, read_temporal_stats, record_data,
-                          kernel_read_temporal_count);
-
-    symbols.transform_data_views(record_data);
-    record_data_callback(cubin_id, kernel_id, &record_data);
-    transform_temporal_statistics(cubin_id, symbols, read_temporal_stats);
-
-    // Write
-    record_data.access_type = REDSHOW_ACCESS_WRITE;
-    record_temporal_trace(pc_views_limit, mem_views_limit, trace->write_pc_pairs,
-                          trace->write_pc_count, write_temporal_stats, record_data,
-                          kernel_write_temporal_count);
-
-    symbols.transform_data_views(record_data);
-    record_data_callback(cubin_id, kernel_id, &record_data);
-    transform_temporal_statistics(cubin_id, symbols, write_temporal_stats);
-
-    // Accumulate all access count and red count
-    for (auto &iter : trace->read_pc_count) {
-      kernel_count += iter.second;
+  if (!opened) {
+    redshow_output_format_t format = REDSHOW_OUTPUT_CSV;
+    redshow_output_format_get(&format);
+    thread_result.binary = format == REDSHOW_OUTPUT_BINARY;
+
+    auto thread_name = "_t" + std::to_string(cpu_thread);
+    if (thread_result.binary) {
+      auto tables = record_tables();
+      thread_result.records_read.open(output_dir + "temporal_read" + thread_name + ".bin",
+                                      "temporal_redundancy", tables);
+      thread_result.records_write.open(output_dir + "temporal_write" + thread_name + ".bin",
+                                       "temporal_redundancy", tables);
+    } else {
+      thread_result.out_read.open(output_dir + "temporal_read" + thread_name + ".csv");
+      thread_result.out_write.open(output_dir + "temporal_write" + thread_name + ".csv");
     }
+  }
+  return thread_result;
+}
 
-    for (auto &iter : trace->write_pc_count) {
-      kernel_count += iter.second;
-    }
+void TemporalRedundancy::flush_trace(u32 cpu_thread, i32 kernel_id, RedundancyTrace &trace,
+                                     const LockableMap<u32, Cubin> &cubins,
+                                     redshow_record_data_callback_func record_data_callback,
+                                     ThreadResult &thread_result) {
+  u32 pc_views_limit = 0;
+  u32 mem_views_limit = 0;
+
+  redshow_pc_views_get(&pc_views_limit);
+  redshow_mem_views_get(&mem_views_limit);
 
-    thread_count += kernel_count;
-    thread_read_temporal_count += kernel_read_temporal_count;
-    thread_write_temporal_count += kernel_write_temporal_count;
+  redshow_record_data_t record_data;
 
-    if (mem_views_limit != 0) {
-      if (!read_temporal_stats.empty()) {
-        show_temporal_trace(cpu_thread, kernel_id, kernel_read_temporal_count, kernel_count,
-                            read_temporal_stats, false, out_read);
-      }
-      if (!write_temporal_stats.empty()) {
-        show_temporal_trace(cpu_thread, kernel_id, kernel_write_temporal_count, kernel_count,
-                            write_temporal_stats, false, out_write);
-      }
-    }
+  record_data.views = new redshow_record_view_t[pc_views_limit]();
+
+  auto &kernel = trace.kernel;
+  auto cubin_id = kernel.cubin_id;
+  auto mod_id = kernel.mod_id;
+  auto cubin_offset = 0;
+  u64 kernel_read_temporal_count = 0;
+  u64 kernel_write_temporal_count = 0;
+  u64 kernel_count = 0;
+  TemporalStatistics read_temporal_stats;
+  TemporalStatistics write_temporal_stats;
+  double scale = 1.0;
+  redshow_sampling_scale_get(cpu_thread, kernel_id, &scale);
+  cubins.lock();
+  auto &symbols = cubins.at(cubin_id).symbols.at(mod_id);
+  cubins.unlock();
+
+  record_data.analysis_type = REDSHOW_ANALYSIS_TEMPORAL_REDUNDANCY;
+  // Read
+  record_data.access_type = REDSHOW_ACCESS_READ;
+  record_temporal_trace(pc_views_limit, mem_views_limit, trace.read_pc_pairs,
+                        trace.read_pc_count, read_temporal_stats, record_data,
+                        kernel_read_temporal_count);
+  scale_temporal_statistics(scale, record_data, read_temporal_stats, kernel_read_temporal_count);
+
+  symbols.transform_data_views(record_data);
+  record_data_callback(cubin_id, kernel_id, &record_data);
+  transform_temporal_statistics(cubin_id, symbols, read_temporal_stats);
+
+  // Write
+  record_data.access_type = REDSHOW_ACCESS_WRITE;
+  record_temporal_trace(pc_views_limit, mem_views_limit, trace.write_pc_pairs,
+                        trace.write_pc_count, write_temporal_stats, record_data,
+                        kernel_write_temporal_count);
+  scale_temporal_statistics(scale, record_data, write_temporal_stats, kernel_write_temporal_count);
+
+  symbols.transform_data_views(record_data);
+  record_data_callback(cubin_id, kernel_id, &record_data);
+  transform_temporal_statistics(cubin_id, symbols, write_temporal_stats);
+
+  // Accumulate all access count and red count
+  for (auto &iter : trace.read_pc_count) {
+    kernel_count += iter.second;
   }
 
-  if (mem_views_limit != 0) {
-    if (thread_count != 0) {
-      TemporalStatistics read_temporal_stats;
-      TemporalStatistics write_temporal_stats;
+  for (auto &iter : trace.write_pc_count) {
+    kernel_count += iter.second;
+  }
+  kernel_count = scale_count(kernel_count, scale);
 
-      show_temporal_trace(cpu_thread, 0, thread_read_temporal_count, thread_count,
-                          read_temporal_stats, true, out_read);
-      show_temporal_trace(cpu_thread, 0, thread_write_temporal_count, thread_count,
-                          write_temporal_stats, true, out_write);
+  thread_result.count += kernel_count;
+  thread_result.read_temporal_count += kernel_read_temporal_count;
+  thread_result.write_temporal_count += kernel_write_temporal_count;
+
+  if (mem_views_limit != 0) {
+    if (!read_temporal_stats.empty()) {
+      output_temporal_trace(cpu_thread, kernel_id, kernel_read_temporal_count, kernel_count,
+                            read_temporal_stats, false, true, thread_result);
+    }
+    if (!write_temporal_stats.empty()) {
+      output_temporal_trace(cpu_thread, kernel_id, kernel_write_temporal_count, kernel_count,
+                            write_temporal_stats, false, false, thread_result);
     }
   }
 
-  out_read.close();
-  out_write.close();
-
   // Release data
   delete[] record_data.views;
 }
 
+void TemporalRedundancy::output_temporal_trace(u32 cpu_thread, i32 kernel_id, u64 total_red_count,
+                                               u64 total_count, TemporalStatistics &temporal_stats,
+                                               bool is_thread, bool read,
+                                               ThreadResult &thread_result) {
+  if (thread_result.binary) {
+    auto &records = read ? thread_result.records_read : thread_result.records_write;
+    write_temporal_records(cpu_thread, kernel_id, total_red_count, total_count, temporal_stats,
+                           is_thread, records);
+  } else {
+    auto &out = read ? thread_result.out_read : thread_result.out_write;
+    show_temporal_trace(cpu_thread, kernel_id, total_red_count, total_count, temporal_stats,
+                        is_thread, out);
+  }
+}
+
 void TemporalRedundancy::flush(const std::string &output_dir, const LockableMap<u32, Cubin> &cubins,
                                redshow_record_data_callback_func record_data_callback) {}
 
-void TemporalRedundancy::update_temporal_trace(u64 pc, ThreadId thread_id, u64 addr, u64 value,
+size_t TemporalRedundancy::trace_size(const Trace &trace) const {
+  auto &redundancy_trace = dynamic_cast<const RedundancyTrace &>(trace);
+  return heap_size(redundancy_trace.read_temporal_trace) +
+         heap_size(redundancy_trace.read_pc_pairs) + heap_size(redundancy_trace.read_pc_count) +
+         heap_size(redundancy_trace.write_temporal_trace) +
+         heap_size(redundancy_trace.write_pc_pairs) + heap_size(redundancy_trace.write_pc_count);
+}
+
+void TemporalRedundancy::save_trace(const Trace &trace, BinaryWriter &writer) const {
+  auto &redundancy_trace = dynamic_cast<const RedundancyTrace &>(trace);
+  serialize(writer, redundancy_trace.read_temporal_trace);
+  serialize(writer, redundancy_trace.read_pc_pairs);
+  serialize(writer, redundancy_trace.read_pc_count);
+  serialize(writer, redundancy_trace.write_temporal_trace);
+  serialize(writer, redundancy_trace.write_pc_pairs);
+  serialize(writer, redundancy_trace.write_pc_count);
+}
+
+std::shared_ptr<Trace> TemporalRedundancy::load_trace(BinaryReader &reader) const {
+  // Last values of addresses are restored too, later accesses compare with them as before
+  auto trace = std::make_shared<RedundancyTrace>();
+  deserialize(reader, trace->read_temporal_trace);
+  deserialize(reader, trace->read_pc_pairs);
+  deserialize(reader, trace->read_pc_count);
+  deserialize(reader, trace->write_temporal_trace);
+  deserialize(reader, trace->write_pc_pairs);
+  deserialize(reader, trace->write_pc_count);
+  return trace;
+}
+
+bool TemporalRedundancy::update_temporal_trace(u64 pc, ThreadId thread_id, u64 addr, u64 value,
                                                AccessKind access_kind,
                                                TemporalTrace &temporal_trace, PCPairs &pc_pairs) {
   auto tmr_it = temporal_trace.find(thread_id);
@@ -190,12 +299,14 @@ void TemporalRedundancy::update_temporal_trace(u64 pc, ThreadId thread_id, u64 a
     } else {
       auto prev_pc = m_it->second.first;
       auto prev_value = m_it->second.second;
+      m_it->second = record[addr];
       if (prev_value == value) {
         pc_pairs[pc][prev_pc][std::make_pair(prev_value, access_kind)] += 1;
+        return true;
       }
-      m_it->second = record[addr];
     }
   }
+  return false;
 }
 
 void TemporalRedundancy::record_temporal_trace(u32 pc_views_limit, u32 mem_views_limit,
@@ -313,12 +424,95 @@ void TemporalRedundancy::show_temporal_trace(u32 cpu_thread, i32 kernel_id, u64
         out << real_pc_pair.access_kind.value_to_string(real_pc_pair.value, true);
         out << "," << real_pc_pair.access_kind.to_string() << "," << real_pc_pair.red_count << ","
             << static_cast<double>(real_pc_pair.red_count) / real_pc_pair.access_count << ","
-            << static_cast<double>(real_pc_pair.red_count) / total_count << endl;
+            << static_cast<double>(real_pc_pair.red_count) / total_count << '\n';
       }
     }
   }
 }
 
+void TemporalRedundancy::write_temporal_records(u32 cpu_thread, i32 kernel_id, u64 total_red_count,
+                                                u64 total_count, TemporalStatistics &temporal_stats,
+                                                bool is_thread, RecordWriter &records) {
+  if (is_thread) {
+    ThreadRecord record;
+    clear_record(record);
+    record.cpu_thread = cpu_thread;
+    record.redundant_access_count = total_red_count;
+    record.total_access_count = total_count;
+    records.write(RECORD_TABLE_THREAD, &record, 1);
+    return;
+  }
+
+  KernelRecord record;
+  clear_record(record);
+  record.kernel_id = kernel_id;
+  record.redundant_access_count = total_red_count;
+  record.total_access_count = total_count;
+  records.write(RECORD_TABLE_KERNEL, &record, 1);
+
+  // Access kinds are added to the dictionary before the block that refers to them
+  Vector<TemporalRecord> rows;
+  for (auto &temp_iter : temporal_stats) {
+    for (auto &real_pc_pair : temp_iter.second) {
+      rows.emplace_back();
+      auto &row = rows.back();
+      clear_record(row);
+      row.cubin_id = real_pc_pair.from_pc.cubin_id;
+      row.from_function_index = real_pc_pair.from_pc.function_index;
+      row.from_pc_offset = real_pc_pair.from_pc.pc_offset;
+      row.to_function_index = real_pc_pair.to_pc.function_index;
+      row.to_pc_offset = real_pc_pair.to_pc.pc_offset;
+      row.value = real_pc_pair.value;
+      row.access_kind = records.access_kind_id(real_pc_pair.access_kind);
+      row.count = real_pc_pair.red_count;
+      row.access_count = real_pc_pair.access_count;
+    }
+  }
+  records.write(RECORD_TABLE_TEMPORAL, rows);
+}
+
+Vector<RecordTable> TemporalRedundancy::record_tables() {
+  Vector<RecordTable> tables;
+
+  RecordTable kernel_table("kernel", sizeof(KernelRecord));
+  kernel_table.fields.emplace_back("kernel_id", RECORD_FIELD_I32,
+                                   offsetof(KernelRecord, kernel_id));
+  kernel_table.fields.emplace_back("redundant_access_count", RECORD_FIELD_U64,
+                                   offsetof(KernelRecord, redundant_access_count));
+  kernel_table.fields.emplace_back("total_access_count", RECORD_FIELD_U64,
+                                   offsetof(KernelRecord, total_access_count));
+  tables.emplace_back(kernel_table);
+
+  RecordTable thread_table("thread", sizeof(ThreadRecord));
+  thread_table.fields.emplace_back("cpu_thread", RECORD_FIELD_U32,
+                                   offsetof(ThreadRecord, cpu_thread));
+  thread_table.fields.emplace_back("redundant_access_count", RECORD_FIELD_U64,
+                                   offsetof(ThreadRecord, redundant_access_count));
+  thread_table.fields.emplace_back("total_access_count", RECORD_FIELD_U64,
+                                   offsetof(ThreadRecord, total_access_count));
+  tables.emplace_back(thread_table);
+
+  RecordTable table("temporal_redundancy", sizeof(TemporalRecord));
+  table.fields.emplace_back("cubin_id", RECORD_FIELD_U32, offsetof(TemporalRecord, cubin_id));
+  table.fields.emplace_back("f_function_index", RECORD_FIELD_U32,
+                            offsetof(TemporalRecord, from_function_index));
+  table.fields.emplace_back("f_pc_offset", RECORD_FIELD_U64,
+                            offsetof(TemporalRecord, from_pc_offset));
+  table.fields.emplace_back("t_function_index", RECORD_FIELD_U32,
+                            offsetof(TemporalRecord, to_function_index));
+  table.fields.emplace_back("t_pc_offset", RECORD_FIELD_U64,
+                            offsetof(TemporalRecord, to_pc_offset));
+  table.fields.emplace_back("value", RECORD_FIELD_VALUE, offsetof(TemporalRecord, value));
+  table.fields.emplace_back("access_kind", RECORD_FIELD_ACCESS_KIND,
+                            offsetof(TemporalRecord, access_kind));
+  table.fields.emplace_back("count", RECORD_FIELD_U64, offsetof(TemporalRecord, count));
+  table.fields.emplace_back("access_count", RECORD_FIELD_U64,
+                            offsetof(TemporalRecord, access_count));
+  tables.emplace_back(table);
+
+  return tables;
+}
+
 void TemporalRedundancy::transform_temporal_statistics(uint32_t cubin_id,
                                                        const SymbolVector &symbols,
                                                        TemporalStatistics &temporal_stats) {
@@ -344,4 +538,27 @@ void TemporalRedundancy::transform_temporal_statistics(uint32_t cubin_id,
   }
 }
 
+void TemporalRedundancy::scale_temporal_statistics(double scale,
+                                                   redshow_record_data_t &record_data,
+                                                   TemporalStatistics &temporal_stats,
+                                                   u64 &kernel_temporal_count) {
+  if (scale == 1.0) {
+    return;
+  }
+
+  for (auto i = 0; i < record_data.num_views; ++i) {
+    record_data.views[i].red_count = scale_count(record_data.views[i].red_count, scale);
+    record_data.views[i].access_count = scale_count(record_data.views[i].access_count, scale);
+  }
+
+  for (auto &temp_stat_iter : temporal_stats) {
+    for (auto &real_pc_pair : temp_stat_iter.second) {
+      real_pc_pair.red_count = scale_count(real_pc_pair.red_count, scale);
+      real_pc_pair.access_count = scale_count(real_pc_pair.access_count, scale);
+    }
+  }
+
+  kernel_temporal_count = scale_count(kernel_temporal_count, scale);
+}
+
 }  // namespace redshow
@@ -5,7 +5,9 @@
 #include "analysis/value_pattern.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
+#include <sstream>
 #include <tuple>
 #include <utility>
 
@@ -32,12 +34,38 @@ void ValuePattern::analysis_begin(u32 cpu_thread, i32 kernel_id, u32 cubin_id, u
     trace->kernel.ctx_id = kernel_id;
     trace->kernel.cubin_id = cubin_id;
     trace->kernel.mod_id = mod_id;
+    redshow_sampling_mode_t sampling_mode;
+    u32 sampling_period;
+    redshow_sampling_get(&sampling_mode, &sampling_period);
+    trace->summarize = sampling_mode == REDSHOW_SAMPLING_ADAPTIVE;
+    redshow_value_pattern_mode_t mode;
+    redshow_value_pattern_mode_get(&mode);
+    trace->online = mode == REDSHOW_VALUE_PATTERN_ONLINE;
+    redshow_value_pattern_limit_get(&trace->max_items, &trace->max_values);
     this->_kernel_trace[cpu_thread][kernel_id] = trace;
   }
 
   _trace = std::dynamic_pointer_cast<ValuePatternTrace>(this->_kernel_trace[cpu_thread][kernel_id]);
 
   unlock();
+
+  // Resolve approximation once instead of for every float unit
+  int decimal_degree_f32;
+  int decimal_degree_f64;
+
+  redshow_approx_get(&decimal_degree_f32, &decimal_degree_f64);
+
+  if (decimal_degree_f32 == VALID_FLOAT_DIGITS) {
+    // The 7th digit in float number's decimal part is partial valid, so we set the deault approx
+    // level to REDSHOW_APPROX_MIN.
+    vp_approx_level_config(REDSHOW_APPROX_MIN, decimal_degree_f32, decimal_degree_f64);
+
+    _trace->float_mask = value_to_float(0xffffffffu, decimal_degree_f32);
+    _trace->double_mask = value_to_double(0xffffffffffffffffu, decimal_degree_f64);
+  } else {
+    _trace->float_mask = 0xffffffffffffffffu;
+    _trace->double_mask = 0xffffffffffffffffu;
+  }
 }
 
 void ValuePattern::analysis_end(u32 cpu_thread, i32 kernel_id) { _trace.reset(); }
@@ -50,153 +78,701 @@ void ValuePattern::block_exit(const ThreadId &thread_id) {
   // Do nothing
 }
 
+bool ValuePattern::order_sensitive() const {
+  redshow_value_pattern_mode_t mode;
+  redshow_value_pattern_mode_get(&mode);
+  if (mode == REDSHOW_VALUE_PATTERN_ONLINE) {
+    return true;
+  }
+
+  u64 max_items = 0;
+  u64 max_values = 0;
+  redshow_value_pattern_limit_get(&max_items, &max_values);
+  return max_items != 0 || max_values != 0;
+}
+
 void ValuePattern::unit_access(i32 kernel_id, const ThreadId &thread_id,
                                const AccessKind &access_kind, const Memory &memory, u64 pc,
                                u64 value, u64 addr, u32 index, GPUPatchFlags flags) {
   addr += index * access_kind.unit_size / 8;
-  if (access_kind.data_type == REDSHOW_DATA_UNKNOWN) {
-    // If unknown, try each data type
-    auto enum_access_kind = access_kind;
-    enum_access_kind.data_type = REDSHOW_DATA_FLOAT;
-    unit_access(kernel_id, thread_id, enum_access_kind, memory, pc, value, addr, index, flags);
-    enum_access_kind.data_type = REDSHOW_DATA_INT;
-    unit_access(kernel_id, thread_id, enum_access_kind, memory, pc, value, addr, index, flags);
-
-    return;
-  }
-  //  @todo If memory usage is too high, we can limit the save of various values of one item.
   auto &r_value_dist = _trace->r_value_dist;
   auto &w_value_dist = _trace->w_value_dist;
-  auto &r_value_dist_compact = _trace->r_value_dist_compact;
-  auto &w_value_dist_compact = _trace->w_value_dist_compact;
-  auto size = (memory.memory_range.end - memory.memory_range.start) / (access_kind.unit_size >> 3);
   auto offset = (addr - memory.memory_range.start) / (access_kind.unit_size >> 3);
 
   if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
-    int decimal_degree_f32;
-    int decimal_degree_f64;
+    if (access_kind.unit_size == 32) {
+      value &= _trace->float_mask;
+    } else if (access_kind.unit_size == 64) {
+      value &= _trace->double_mask;
+    }
+  }
 
-    redshow_approx_get(&decimal_degree_f32, &decimal_degree_f64);
+  if (_trace->summarize) {
+    // Patterns stop changing once no new values show up
+    auto array = hash_mix64(memory.op_id << 1 | ((flags & GPU_PATCH_WRITE) ? 1 : 0));
+    _trace->summary_item_values.add(hash_mix64(array ^ offset) ^ value);
+    _trace->summary_count = _trace->summary_item_values.estimate();
+    _trace->summary_total_count++;
+  }
 
-    if (decimal_degree_f32 == VALID_FLOAT_DIGITS) {
-      // The 7th digit in float number's decimal part is partial valid, so we set the deault approx
-      // level to REDSHOW_APPROX_MIN.
-      vp_approx_level_config(REDSHOW_APPROX_MIN, decimal_degree_f32, decimal_degree_f64);
+  if (_trace->online) {
+    if (flags & GPU_PATCH_READ) {
+      summarize_access(_trace->r_value_summary, memory, access_kind, offset, value);
+    }
 
-      if (access_kind.unit_size == 32) {
-        value = value_to_float(value, decimal_degree_f32);
-      } else if (access_kind.unit_size == 64) {
-        value = value_to_double(value, decimal_degree_f64);
-      }
+    if (flags & GPU_PATCH_WRITE) {
+      summarize_access(_trace->w_value_summary, memory, access_kind, offset, value);
     }
+    return;
   }
 
+  // Units of unknown types are recorded once, and interpreted as both int and float at flush
   if (flags & GPU_PATCH_READ) {
-    r_value_dist[memory][access_kind][offset][value] += 1;
+    array_items(r_value_dist, memory, access_kind, _trace->max_items, _trace->max_values)
+        .add(offset, value);
   }
 
   if (flags & GPU_PATCH_WRITE) {
-    w_value_dist[memory][access_kind][offset][value] += 1;
+    array_items(w_value_dist, memory, access_kind, _trace->max_items, _trace->max_values)
+        .add(offset, value);
+  }
+}
+
+ItemsValueCount &ValuePattern::array_items(ValueDist &value_dist, const Memory &memory,
+                                           const AccessKind &access_kind, u64 max_items,
+                                           u64 max_values) {
+  auto &array_dist = value_dist[memory];
+  auto iter = array_dist.find(access_kind);
+  if (iter == array_dist.end()) {
+    // Shared and local memory have no length, their items are always kept sparse
+    auto capacity = memory.len / MAX2(access_kind.unit_size >> 3, 1u);
+    iter =
+        array_dist.emplace(access_kind, ItemsValueCount(capacity, max_items, max_values)).first;
+  }
+  return iter->second;
+}
+
+ValuePattern::ArrayValueSummary &ValuePattern::array_summary(ValueSummaryDist &value_summary,
+                                                             const Memory &memory,
+                                                             const AccessKind &access_kind) {
+  auto &array_summary = value_summary[memory];
+  auto iter = array_summary.find(access_kind);
+  if (iter == array_summary.end()) {
+    iter = array_summary.emplace(access_kind, ArrayValueSummary(access_kind)).first;
+    init_approx(iter->second);
+  }
+  return iter->second;
+}
+
+void ValuePattern::init_approx(ArrayValueSummary &summary) {
+  auto &access_kind = summary.access_kind;
+  if (access_kind.data_type == REDSHOW_DATA_FLOAT &&
+      (access_kind.unit_size == 32 || access_kind.unit_size == 64)) {
+    summary.approx = std::make_shared<ArrayValueSummary>(access_kind);
+  }
+}
+
+void ValuePattern::summarize_access(ValueSummaryDist &value_summary, const Memory &memory,
+                                    const AccessKind &access_kind, u64 offset, u64 value) {
+  if (access_kind.data_type != REDSHOW_DATA_UNKNOWN) {
+    summarize_value(array_summary(value_summary, memory, access_kind), offset, value);
+    return;
+  }
+
+  auto int_kind = access_kind;
+  int_kind.data_type = REDSHOW_DATA_INT;
+  summarize_value(array_summary(value_summary, memory, int_kind), offset, value);
+
+  auto float_kind = access_kind;
+  float_kind.data_type = REDSHOW_DATA_FLOAT;
+  auto &float_summary = array_summary(value_summary, memory, float_kind);
+  if (access_kind.unit_size == 32) {
+    summarize_value(float_summary, offset, value & _trace->float_mask);
+  } else if (access_kind.unit_size == 64) {
+    summarize_value(float_summary, offset, value & _trace->double_mask);
+  } else {
+    summarize_value(float_summary, offset, value);
+  }
+}
+
+void ValuePattern::summarize_value(ArrayValueSummary &summary, u64 offset, u64 value,
+                                   u64 count) {
+  using std::get;
+  auto &access_kind = summary.access_kind;
+
+  if (summary.total_access_count == 0) {
+    summary.first_value = value;
+  } else if (value != summary.first_value) {
+    summary.single_value = false;
+  }
+  summary.total_access_count += count;
+
+  summary.items.add(offset);
+  summary.values.add(value);
+  summary.item_values.add(hash_mix64(offset) ^ value);
+
+  // Space-saving: a new value takes over the least counted one
+  auto top_iter = summary.top_values.find(value);
+  if (top_iter != summary.top_values.end()) {
+    top_iter->second += count;
+  } else if (summary.top_values.size() < _TOP_VALUES) {
+    summary.top_values.emplace(value, count);
+  } else {
+    auto min_iter = std::min_element(summary.top_values.begin(), summary.top_values.end(),
+                                     [](auto &l, auto &r) { return l.second < r.second; });
+    auto min_count = min_iter->second;
+    summary.top_values.erase(min_iter);
+    summary.top_values.emplace(value, min_count + count);
+  }
+
+  double y = value;
+  if (access_kind.data_type == REDSHOW_DATA_INT) {
+    auto bits = get_redundant_zeros_bits(value, access_kind);
+    auto &redundant_zero_bits = summary.redundant_zero_bits;
+    get<0>(redundant_zero_bits) = std::min(get<0>(redundant_zero_bits), get<0>(bits));
+    get<1>(redundant_zero_bits) = std::min(get<1>(redundant_zero_bits), get<1>(bits));
+    get<2>(redundant_zero_bits) = std::min(get<2>(redundant_zero_bits), get<2>(bits));
+  } else if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
+    if (summary.float_no_decimal && !float_no_decimal(value, access_kind)) {
+      summary.float_no_decimal = false;
+    }
+    if (summary.possible_float_type_overuse) {
+      if ((access_kind.unit_size == 64 && summary.max_exponents >= -127 &&
+           summary.max_exponents <= 128) ||
+          (access_kind.unit_size == 32 && summary.max_exponents >= -14 &&
+           summary.max_exponents <= 15)) {
+        summary.possible_float_type_overuse =
+            check_exponent_and_fraction(summary.all_first_Xbits_same, summary.last_first_Xbits,
+                                        summary.max_exponents, value, access_kind);
+      }
+    }
+    if (access_kind.unit_size == 32) {
+      float f;
+      u32 c = value & 0xffffffffu;
+      memcpy(&f, &c, sizeof(c));
+      y = f;
+    } else if (access_kind.unit_size == 64) {
+      double d;
+      memcpy(&d, &value, sizeof(value));
+      y = d;
+    }
+  }
+
+  double x = offset;
+  double n = count;
+  summary.sum_x += n * x;
+  summary.sum_y += n * y;
+  summary.sum_xx += n * x * x;
+  summary.sum_xy += n * x * y;
+  summary.sum_yy += n * y * y;
+
+  if (summary.approx) {
+    if (access_kind.unit_size == 32) {
+      summarize_value(*summary.approx, offset, value_to_float(value, MAX_FLOAT_DIGITS), count);
+    } else if (access_kind.unit_size == 64) {
+      summarize_value(*summary.approx, offset, value_to_double(value, MAX_DOUBLE_DIGITS), count);
+    }
+  }
+}
+
+void ValuePattern::merge_value_summary(ArrayValueSummary &summary,
+                                       const ArrayValueSummary &other) {
+  using std::get;
+  if (other.total_access_count == 0) {
+    return;
+  }
+
+  if (summary.total_access_count == 0) {
+    summary.first_value = other.first_value;
+    summary.single_value = other.single_value;
+  } else {
+    summary.single_value = summary.single_value && other.single_value &&
+                           summary.first_value == other.first_value;
+  }
+  summary.total_access_count += other.total_access_count;
+
+  auto &redundant_zero_bits = summary.redundant_zero_bits;
+  auto &other_redundant_zero_bits = other.redundant_zero_bits;
+  get<0>(redundant_zero_bits) =
+      std::min(get<0>(redundant_zero_bits), get<0>(other_redundant_zero_bits));
+  get<1>(redundant_zero_bits) =
+      std::min(get<1>(redundant_zero_bits), get<1>(other_redundant_zero_bits));
+  get<2>(redundant_zero_bits) =
+      std::min(get<2>(redundant_zero_bits), get<2>(other_redundant_zero_bits));
+
+  summary.float_no_decimal = summary.float_no_decimal && other.float_no_decimal;
+  summary.possible_float_type_overuse =
+      summary.possible_float_type_overuse && other.possible_float_type_overuse;
+  summary.all_first_Xbits_same =
+      summary.all_first_Xbits_same && other.all_first_Xbits_same &&
+      (summary.last_first_Xbits == 0 || other.last_first_Xbits == 0 ||
+       summary.last_first_Xbits == other.last_first_Xbits);
+  if (other.last_first_Xbits != 0) {
+    summary.last_first_Xbits = other.last_first_Xbits;
+  }
+  if (std::abs(other.max_exponents) > std::abs(summary.max_exponents)) {
+    summary.max_exponents = other.max_exponents;
+  }
+
+  summary.items.merge(other.items);
+  summary.values.merge(other.values);
+  summary.item_values.merge(other.item_values);
+
+  // Keep the most counted values of both
+  for (auto &iter : other.top_values) {
+    summary.top_values[iter.first] += iter.second;
+  }
+  if (summary.top_values.size() > _TOP_VALUES) {
+    Vector<std::pair<u64, u64>> top_values;
+    top_values.assign(summary.top_values.begin(), summary.top_values.end());
+    std::stable_sort(top_values.begin(), top_values.end(),
+                     [](auto &l, auto &r) { return l.second > r.second; });
+    top_values.resize(_TOP_VALUES);
+    summary.top_values = ValueCount();
+    summary.top_values.insert(top_values.begin(), top_values.end());
+  }
+
+  summary.sum_x += other.sum_x;
+  summary.sum_y += other.sum_y;
+  summary.sum_xx += other.sum_xx;
+  summary.sum_xy += other.sum_xy;
+  summary.sum_yy += other.sum_yy;
+
+  if (summary.approx && other.approx) {
+    merge_value_summary(*summary.approx, *other.approx);
   }
 }
 
 void ValuePattern::flush_thread(u32 cpu_thread, const std::string &output_dir,
                                 const LockableMap<u32, Cubin> &cubins,
                                 redshow_record_data_callback_func record_data_callback) {
-  if (!this->_kernel_trace.has(cpu_thread)) {
+  lock();
+  bool has_results = this->_kernel_trace.has(cpu_thread) || this->_thread_results.has(cpu_thread);
+  unlock();
+
+  if (!has_results) {
     return;
   }
 
+  auto &thread_result = this->thread_result(cpu_thread, output_dir);
+  bool do_summary_analysis = this->_configs.has(REDSHOW_ANALYSIS_VALUE_PATTERN_SUMMARY) &&
+                             this->_configs.at(REDSHOW_ANALYSIS_VALUE_PATTERN_SUMMARY);
+
+  // Spilled traces are read back in batches within the trace budget
+  uint64_t budget = 0;
+  const char *dir = NULL;
+  redshow_trace_budget_get(&budget, &dir);
+
+  auto kernel_ids = trace_kernels(cpu_thread);
+  size_t kernel_index = 0;
+  while (kernel_index < kernel_ids.size()) {
+    Vector<std::shared_ptr<ValuePatternTrace>> traces;
+    size_t traces_size = 0;
+    while (kernel_index < kernel_ids.size() && (budget == 0 || traces_size < budget)) {
+      auto trace = std::dynamic_pointer_cast<ValuePatternTrace>(
+          thread_trace(cpu_thread, kernel_ids[kernel_index++]));
+      if (trace.get() != NULL) {
+        if (budget != 0) {
+          traces_size += trace_size(*trace);
+        }
+        traces.emplace_back(trace);
+      }
+    }
+    check_pattern_traces(traces, do_summary_analysis, thread_result);
+  }
+
+  if (do_summary_analysis) {
+    Vector<ArrayPatternTask> summary_tasks;
+    add_pattern_tasks(thread_result.r_value_summary_sum, GPU_PATCH_READ, summary_tasks);
+    add_pattern_tasks(thread_result.w_value_summary_sum, GPU_PATCH_WRITE, summary_tasks);
+    check_pattern_tasks(summary_tasks, thread_result.binary);
+
+    if (!thread_result.binary) {
+      thread_result.out << "================\narray pattern summary\n================\n";
+    }
+    write_pattern_tasks(summary_tasks, 0, summary_tasks.size(), RECORD_TABLE_ARRAY_SUMMARY,
+                        thread_result);
+  }
+
+  // Output is closed
   lock();
+  this->_thread_results.erase(cpu_thread);
+  unlock();
+}
 
-  auto &thread_kernel_trace = this->_kernel_trace.at(cpu_thread);
+void ValuePattern::flush_kernel(u32 cpu_thread, i32 kernel_id, const std::string &output_dir,
+                                const LockableMap<u32, Cubin> &cubins,
+                                redshow_record_data_callback_func record_data_callback) {
+  auto trace = std::dynamic_pointer_cast<ValuePatternTrace>(release_trace(cpu_thread, kernel_id));
+  if (trace.get() == NULL) {
+    return;
+  }
+
+  auto &thread_result = this->thread_result(cpu_thread, output_dir);
+  bool do_summary_analysis = this->_configs.has(REDSHOW_ANALYSIS_VALUE_PATTERN_SUMMARY) &&
+                             this->_configs.at(REDSHOW_ANALYSIS_VALUE_PATTERN_SUMMARY);
+
+  Vector<std::shared_ptr<ValuePatternTrace>> traces;
+  traces.emplace_back(trace);
+  check_pattern_traces(traces, do_summary_analysis, thread_result);
+}
 
+ValuePattern::ThreadResult &ValuePattern::thread_result(u32 cpu_thread,
+                                                        const std::string &output_dir) {
+  lock();
+  bool opened = this->_thread_results.has(cpu_thread);
+  auto &thread_result = this->_thread_results[cpu_thread];
   unlock();
 
-  std::ofstream out(output_dir + "value_pattern_t" + std::to_string(cpu_thread) + ".csv");
-  bool do_summary_analysis = false;
-  // for all kernels
-  ValueDist r_value_dist_sum;
-  ValueDist w_value_dist_sum;
-  for (auto &trace_iter : thread_kernel_trace) {
-    auto kernel_id = trace_iter.first;
-    out << "kernel id: " << kernel_id << std::endl;
-    auto trace = std::dynamic_pointer_cast<ValuePatternTrace>(trace_iter.second);
-    auto &r_value_dist = trace->r_value_dist;
-    auto &w_value_dist = trace->w_value_dist;
-    check_pattern_for_value_dist(r_value_dist, out, GPU_PATCH_READ);
-    check_pattern_for_value_dist(w_value_dist, out, GPU_PATCH_WRITE);
-
-    if (do_summary_analysis) {
-      for (auto &memory_iter : r_value_dist) {
-        auto &memory = memory_iter.first;
-        for (auto &array_iter : memory_iter.second) {
-          auto &access_kind = array_iter.first;
-          auto &array_items = array_iter.second;
-          for (auto offset = 0; offset < array_items.size(); ++offset) {
-            auto &value_count = array_items[offset];
-            for (auto &item_value_count_iter : value_count) {
-              auto &item_value = item_value_count_iter.first;
-              auto &item_value_count = item_value_count_iter.second;
-              r_value_dist_sum[memory][access_kind][offset][item_value] += item_value_count;
-            }
-          }
-        }
+  if (!opened) {
+    redshow_output_format_t format = REDSHOW_OUTPUT_CSV;
+    redshow_output_format_get(&format);
+    thread_result.binary = format == REDSHOW_OUTPUT_BINARY;
+
+    auto thread_name = "value_pattern_t" + std::to_string(cpu_thread);
+    if (thread_result.binary) {
+      thread_result.records.open(output_dir + thread_name + ".bin", "value_pattern",
+                                 record_tables());
+    } else {
+      thread_result.out.open(output_dir + thread_name + ".csv");
+    }
+  }
+  return thread_result;
+}
+
+void ValuePattern::check_pattern_traces(Vector<std::shared_ptr<ValuePatternTrace>> &traces,
+                                        bool summarize, ThreadResult &thread_result) {
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic) if (traces.size() > 1)
+#endif
+  for (size_t i = 0; i < traces.size(); ++i) {
+    auto &trace = traces[i];
+    if (!trace->online) {
+      resolve_unknown_types(trace->r_value_dist, trace->float_mask, trace->double_mask,
+                            trace->max_items, trace->max_values);
+      resolve_unknown_types(trace->w_value_dist, trace->float_mask, trace->double_mask,
+                            trace->max_items, trace->max_values);
+    }
+  }
+
+  // Arrays of all kernels are classified together, reports are written in kernel order
+  Vector<ArrayPatternTask> tasks;
+  // <kernel_id, end of its tasks>
+  Vector<std::pair<i32, size_t>> kernel_tasks;
+  for (auto &trace : traces) {
+    if (trace->online) {
+      add_pattern_tasks(trace->r_value_summary, GPU_PATCH_READ, tasks);
+      add_pattern_tasks(trace->w_value_summary, GPU_PATCH_WRITE, tasks);
+    } else {
+      add_pattern_tasks(trace->r_value_dist, GPU_PATCH_READ, summarize, tasks);
+      add_pattern_tasks(trace->w_value_dist, GPU_PATCH_WRITE, summarize, tasks);
+    }
+    kernel_tasks.emplace_back(trace->kernel.ctx_id, tasks.size());
+  }
+
+  check_pattern_tasks(tasks, thread_result.binary);
+
+  size_t task_index = 0;
+  for (auto &kernel_iter : kernel_tasks) {
+    if (thread_result.binary) {
+      KernelRecord record;
+      clear_record(record);
+      record.kernel_id = kernel_iter.first;
+      thread_result.records.write(RECORD_TABLE_KERNEL, &record, 1);
+    } else {
+      thread_result.out << "kernel id: " << kernel_iter.first << '\n';
+    }
+    write_pattern_tasks(tasks, task_index, kernel_iter.second, RECORD_TABLE_ARRAY, thread_result);
+    task_index = kernel_iter.second;
+  }
+
+  if (summarize) {
+    // Merge bounded per-kernel summaries in kernel order, items are never copied
+    for (auto &task : tasks) {
+      auto &value_summary_sum = task.read_flag == GPU_PATCH_READ
+                                    ? thread_result.r_value_summary_sum
+                                    : thread_result.w_value_summary_sum;
+      auto *summary = task.summary != NULL ? task.summary : task.array_summary.get();
+      merge_value_summary(array_summary(value_summary_sum, *task.memory, *task.access_kind),
+                          *summary);
+    }
+  }
+}
+
+void ValuePattern::resolve_unknown_types(ValueDist &value_dist, u64 float_mask, u64 double_mask,
+                                         u64 max_items, u64 max_values) {
+  for (auto &memory_iter : value_dist) {
+    auto &array_dist = memory_iter.second;
+
+    Vector<AccessKind> unknown_kinds;
+    for (auto &array_iter : array_dist) {
+      if (array_iter.first.data_type == REDSHOW_DATA_UNKNOWN) {
+        unknown_kinds.push_back(array_iter.first);
       }
+    }
 
-      for (auto &memory_iter : w_value_dist) {
-        auto &memory = memory_iter.first;
-        for (auto &array_iter : memory_iter.second) {
-          auto &access_kind = array_iter.first;
-          auto &array_items = array_iter.second;
-          for (auto offset = 0; offset < array_items.size(); ++offset) {
-            auto &value_count = array_items[offset];
-            for (auto &item_value_count_iter : value_count) {
-              auto &item_value = item_value_count_iter.first;
-              auto &item_value_count = item_value_count_iter.second;
-              w_value_dist_sum[memory][access_kind][offset][item_value] += item_value_count;
-            }
-          }
-        }
+    for (auto &unknown_kind : unknown_kinds) {
+      auto float_kind = unknown_kind;
+      float_kind.data_type = REDSHOW_DATA_FLOAT;
+      auto int_kind = unknown_kind;
+      int_kind.data_type = REDSHOW_DATA_INT;
+
+      u64 value_mask = 0xffffffffffffffffu;
+      if (unknown_kind.unit_size == 32) {
+        value_mask = float_mask;
+      } else if (unknown_kind.unit_size == 64) {
+        value_mask = double_mask;
+      }
+
+      auto &unknown_items = array_dist.at(unknown_kind);
+      auto &float_items =
+          array_items(value_dist, memory_iter.first, float_kind, max_items, max_values);
+      float_items.merge(unknown_items, value_mask);
+
+      // Int values are kept as they are
+      auto &int_items = array_items(value_dist, memory_iter.first, int_kind, max_items, max_values);
+      if (int_items.empty()) {
+        int_items = std::move(unknown_items);
+      } else {
+        int_items.merge(unknown_items);
       }
+
+      array_dist.erase(unknown_kind);
     }
   }
-  if (do_summary_analysis) {
-    out << "================\narray pattern summary\n================" << std::endl;
-    check_pattern_for_value_dist(r_value_dist_sum, out, GPU_PATCH_READ);
-    check_pattern_for_value_dist(w_value_dist_sum, out, GPU_PATCH_WRITE);
-  }
 }
 
-void ValuePattern::check_pattern_for_value_dist(ValueDist &value_dist, std::ofstream &out,
-                                                uint8_t read_flag) {
+void ValuePattern::add_pattern_tasks(const ValueDist &value_dist, uint8_t read_flag,
+                                     bool summarize, Vector<ArrayPatternTask> &tasks) {
   for (auto &memory_iter : value_dist) {
-    auto &memory = memory_iter.first;
     for (auto &array_iter : memory_iter.second) {
-      auto &access_kind = array_iter.first;
-      auto &array_items = array_iter.second;
-      ArrayPatternInfo array_pattern_info(access_kind, memory);
-      dense_value_pattern(array_items, array_pattern_info);
-      // Now we set approxiamte level is mid.
-      ArrayPatternInfo array_pattern_info_approx(access_kind, memory);
-      bool valid_approx =
-          approximate_value_pattern(array_items, array_pattern_info, array_pattern_info_approx);
-
-      show_value_pattern(array_pattern_info, out, read_flag);
-      if (valid_approx) {
-        out << "====  approximate ====" << std::endl;
-        show_value_pattern(array_pattern_info_approx, out, read_flag);
+      tasks.emplace_back(memory_iter.first, array_iter.first, read_flag);
+      tasks.back().array_items = &array_iter.second;
+      if (summarize) {
+        tasks.back().array_summary = std::make_shared<ArrayValueSummary>(array_iter.first);
+        init_approx(*tasks.back().array_summary);
+      }
+    }
+  }
+}
+
+void ValuePattern::add_pattern_tasks(const ValueSummaryDist &value_summary, uint8_t read_flag,
+                                     Vector<ArrayPatternTask> &tasks) {
+  for (auto &memory_iter : value_summary) {
+    for (auto &array_iter : memory_iter.second) {
+      tasks.emplace_back(memory_iter.first, array_iter.first, read_flag);
+      tasks.back().summary = &array_iter.second;
+    }
+  }
+}
+
+void ValuePattern::check_pattern_tasks(Vector<ArrayPatternTask> &tasks, bool binary) {
+#ifdef OPENMP
+#pragma omp parallel if (tasks.size() > 1)
+#endif
+  {
+    // Scratch buffers are reused across the arrays of a thread
+    DenseValueScratch scratch;
+
+#ifdef OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (size_t i = 0; i < tasks.size(); ++i) {
+      auto &task = tasks[i];
+      ArrayPatternInfo array_pattern_info(*task.access_kind, *task.memory);
+      ArrayPatternInfo array_pattern_info_approx(*task.access_kind, *task.memory);
+      bool valid_approx = false;
+      if (task.summary != NULL) {
+        valid_approx =
+            check_pattern_for_value_summary(task, array_pattern_info, array_pattern_info_approx);
+      } else {
+        valid_approx = check_pattern_for_value_dist(task, scratch, array_pattern_info,
+                                                    array_pattern_info_approx);
+      }
+
+      if (binary) {
+        add_pattern_record(array_pattern_info, false, task);
+        if (valid_approx) {
+          add_pattern_record(array_pattern_info_approx, true, task);
+        }
+      } else {
+        std::ostringstream out;
+        show_value_pattern(array_pattern_info, out, task.read_flag);
+        if (valid_approx) {
+          out << "====  approximate ====\n";
+          show_value_pattern(array_pattern_info_approx, out, task.read_flag);
+        }
+        task.report = out.str();
       }
     }
   }
 }
 
+void ValuePattern::write_pattern_tasks(Vector<ArrayPatternTask> &tasks, size_t begin, size_t end,
+                                       u32 table, ThreadResult &thread_result) {
+  if (!thread_result.binary) {
+    for (size_t i = begin; i < end; ++i) {
+      thread_result.out << tasks[i].report;
+    }
+    return;
+  }
+
+  Vector<ArrayPatternRecord> records;
+  for (size_t i = begin; i < end; ++i) {
+    auto access_kind_id = thread_result.records.access_kind_id(*tasks[i].access_kind);
+    for (auto &record : tasks[i].records) {
+      // A copy of the members may not preserve the cleared padding, the bytes are copied
+      records.emplace_back();
+      memcpy(&records.back(), &record, sizeof(record));
+      records.back().access_kind = access_kind_id;
+    }
+  }
+  thread_result.records.write(table, records);
+}
+
+bool ValuePattern::check_pattern_for_value_dist(const ArrayPatternTask &task,
+                                                DenseValueScratch &scratch,
+                                                ArrayPatternInfo &array_pattern_info,
+                                                ArrayPatternInfo &array_pattern_info_approx) {
+  auto &access_kind = *task.access_kind;
+  auto &array_items = *task.array_items;
+  auto &state = scratch.state;
+  auto &state_approx = scratch.state_approx;
+  auto &values = scratch.values;
+  auto &values_approx = scratch.values_approx;
+  // Only float arrays are approximated, items of other sizes are dropped
+  bool approx = access_kind.data_type == REDSHOW_DATA_FLOAT;
+  bool approx_items = approx && (access_kind.unit_size == 32 || access_kind.unit_size == 64);
+
+  state.clear(access_kind);
+  state_approx.clear(access_kind);
+  // Exact and approximate values are classified in the same pass
+  array_items.for_each([&](u64 offset, const ItemsValueCount::Item &item) {
+    values.clear();
+    item.for_each([&](u64 value, u64 count) { values.emplace_back(value, count); });
+    dense_value_item(state, access_kind, values);
+
+    if (task.array_summary) {
+      for (auto &value_count : values) {
+        summarize_value(*task.array_summary, offset, value_count.first, value_count.second);
+      }
+    }
+
+    if (approx_items) {
+      values_approx.clear();
+      for (auto &value_count : values) {
+        values_approx.emplace_back(approximate_value(value_count.first, access_kind),
+                                   value_count.second);
+      }
+      // Merge values that approximate to the same one, in value order
+      std::sort(values_approx.begin(), values_approx.end());
+      size_t size = 0;
+      for (size_t i = 0; i < values_approx.size(); ++i) {
+        if (size != 0 && values_approx[size - 1].first == values_approx[i].first) {
+          values_approx[size - 1].second += values_approx[i].second;
+        } else {
+          values_approx[size++] = values_approx[i];
+        }
+      }
+      values_approx.resize(size);
+      dense_value_item(state_approx, access_kind, values_approx);
+    }
+  });
+
+  dense_value_pattern(state, array_items, false, array_pattern_info);
+  if (array_items.sampled()) {
+    array_pattern_info.sampling_stride = array_items.stride();
+    array_pattern_info.untracked_access_count = array_items.untracked();
+    array_pattern_info.evicted_access_count = array_items.evicted();
+  }
+  bool valid_approx = false;
+  if (approx) {
+    array_pattern_info_approx.sampling_stride = array_pattern_info.sampling_stride;
+    array_pattern_info_approx.untracked_access_count = array_pattern_info.untracked_access_count;
+    array_pattern_info_approx.evicted_access_count = array_pattern_info.evicted_access_count;
+    dense_value_pattern(state_approx, array_items, true, array_pattern_info_approx);
+    valid_approx = array_pattern_info_approx.vpts.size() > 0 &&
+                   !same_value_patterns(array_pattern_info.vpts, array_pattern_info_approx.vpts);
+  }
+
+  return valid_approx;
+}
+
+bool ValuePattern::check_pattern_for_value_summary(const ArrayPatternTask &task,
+                                                   ArrayPatternInfo &array_pattern_info,
+                                                   ArrayPatternInfo &array_pattern_info_approx) {
+  auto &summary = *task.summary;
+  online_value_pattern(summary, array_pattern_info);
+
+  bool valid_approx = false;
+  if (summary.approx) {
+    online_value_pattern(*summary.approx, array_pattern_info_approx);
+    valid_approx = array_pattern_info_approx.vpts.size() > 0 &&
+                   !same_value_patterns(array_pattern_info.vpts, array_pattern_info_approx.vpts);
+  }
+
+  return valid_approx;
+}
+
 void ValuePattern::flush(const std::string &output_dir, const LockableMap<u32, Cubin> &cubins,
                          redshow_record_data_callback_func record_data_callback) {}
 
+// Arrays are identified by their ranges, memory contents are not kept
+static void serialize(BinaryWriter &writer, const Memory &memory) {
+  serialize(writer, memory.op_id);
+  serialize(writer, memory.ctx_id);
+  serialize(writer, memory.memory_range);
+  serialize(writer, static_cast<u64>(memory.len));
+}
+
+static void deserialize(BinaryReader &reader, Memory &memory) {
+  u64 len = 0;
+  deserialize(reader, memory.op_id);
+  deserialize(reader, memory.ctx_id);
+  deserialize(reader, memory.memory_range);
+  deserialize(reader, len);
+  memory.len = len;
+}
+
+static size_t heap_size(const Memory &memory) { return 0; }
+
+size_t ValuePattern::trace_size(const Trace &trace) const {
+  auto &value_pattern_trace = dynamic_cast<const ValuePatternTrace &>(trace);
+  // Accumulators of the online mode are bounded, they stay in memory
+  if (value_pattern_trace.online) {
+    return 0;
+  }
+  return heap_size(value_pattern_trace.r_value_dist) + heap_size(value_pattern_trace.w_value_dist) +
+         heap_size(value_pattern_trace.summary_item_values);
+}
+
+void ValuePattern::save_trace(const Trace &trace, BinaryWriter &writer) const {
+  auto &value_pattern_trace = dynamic_cast<const ValuePatternTrace &>(trace);
+  serialize(writer, value_pattern_trace.float_mask);
+  serialize(writer, value_pattern_trace.double_mask);
+  serialize(writer, value_pattern_trace.max_items);
+  serialize(writer, value_pattern_trace.max_values);
+  serialize(writer, value_pattern_trace.r_value_dist);
+  serialize(writer, value_pattern_trace.w_value_dist);
+  serialize(writer, value_pattern_trace.summary_item_values);
+}
+
+std::shared_ptr<Trace> ValuePattern::load_trace(BinaryReader &reader) const {
+  auto trace = std::make_shared<ValuePatternTrace>();
+  deserialize(reader, trace->float_mask);
+  deserialize(reader, trace->double_mask);
+  deserialize(reader, trace->max_items);
+  deserialize(reader, trace->max_values);
+  deserialize(reader, trace->r_value_dist);
+  deserialize(reader, trace->w_value_dist);
+  deserialize(reader, trace->summary_item_values);
+  return trace;
+}
+
 /**This function is used to check how many significant bits are zeros.
  * @return pair<int, int> The first item is for signed and the second for unsigned.*/
-std::tuple<int, int, int> ValuePattern::get_redundant_zeros_bits(u64 a, AccessKind &accessKind) {
+std::tuple<int, int, int> ValuePattern::get_redundant_zeros_bits(u64 a,
+                                                                const AccessKind &accessKind) {
   u64 b = a;
   u64 flag = 0x1u << (accessKind.unit_size - 1);
   char sign_bit = (a >> (accessKind.unit_size - 1)) & 0x1;
@@ -223,7 +799,7 @@ std::tuple<int, int, int> ValuePattern::get_redundant_zeros_bits(u64 a, AccessKi
 }
 
 /** Check wehther the float number has decimal part or not.*/
-bool ValuePattern::float_no_decimal(u64 a, AccessKind &accessKind) {
+bool ValuePattern::float_no_decimal(u64 a, const AccessKind &accessKind) {
   using std::abs;
   if (accessKind.unit_size == 32) {
     float b;
@@ -250,7 +826,7 @@ bool ValuePattern::float_no_decimal(u64 a, AccessKind &accessKind) {
  * @arg max_exponents_X: what is the max exponents among all values we gone through */
 bool ValuePattern::check_exponent_and_fraction(bool &all_first_Xbits_same, u64 &all_first_Xbits,
                                                int &max_exponents_X, u64 value,
-                                               AccessKind &accessKind) {
+                                               const AccessKind &accessKind) {
   u64 mask, tmp_first_Xbits, tmp_exponent;
   int tmp_abs_exponent;
   switch (accessKind.unit_size) {
@@ -322,8 +898,8 @@ void inline ValuePattern::check_zeros_bits(int zeros_bits, int full, int &narrow
  * @arg pair<int, int> &redundant_zero_bits how many significant bits are zeros. The first item is
  * for signed and the second for unsigned.
  *  */
-void ValuePattern::detect_type_overuse(std::tuple<int, int, int> &redundant_zero_bits,
-                                       AccessKind &accessKind,
+void ValuePattern::detect_type_overuse(const std::tuple<int, int, int> &redundant_zero_bits,
+                                       const AccessKind &accessKind,
                                        std::tuple<int, int, int> &narrow_down_to_unit_size) {
   using std::get;
   int narrow_down_to_unit_size_signed = accessKind.unit_size;
@@ -354,110 +930,95 @@ void ValuePattern::detect_type_overuse(std::tuple<int, int, int> &redundant_zero
                       narrow_down_to_unit_size_for_tail);
 }  // namespace redshow
 
-void ValuePattern::dense_value_pattern(ItemsValueCount &array_items,
-                                       ArrayPatternInfo &array_pattern_info) {
+void ValuePattern::dense_value_item(DenseValueState &state, const AccessKind &access_kind,
+                                    const Vector<std::pair<u64, u64>> &values) {
+  using std::get;
+  using std::make_tuple;
+  state.number_of_items += 1;
+  if (access_kind.data_type == REDSHOW_DATA_INT) {
+    auto &redundant_zero_bits = state.redundant_zero_bits;
+    for (auto &value_count : values) {
+      //          int type overuse
+      auto temp_redundat_zero_bits = get_redundant_zeros_bits(value_count.first, access_kind);
+      redundant_zero_bits =
+          make_tuple(std::min(get<0>(redundant_zero_bits), get<0>(temp_redundat_zero_bits)),
+                     std::min(get<1>(redundant_zero_bits), get<1>(temp_redundat_zero_bits)),
+                     std::min(get<2>(redundant_zero_bits), get<2>(temp_redundat_zero_bits)));
+    }
+  } else if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
+    for (auto &value_count : values) {
+      if (state.inappropriate_float_type && !float_no_decimal(value_count.first, access_kind)) {
+        state.inappropriate_float_type = false;
+        break;
+      }
+    }
+    if (state.possible_float_type_overuse) {
+      for (auto &value_count : values) {
+        //          float type overuse
+        if (access_kind.unit_size == 64) {
+          //            float exponent range : -127 ~ 128
+          if (state.max_exponents_double >= -127 && state.max_exponents_double <= 128) {
+            state.possible_float_type_overuse = check_exponent_and_fraction(
+                state.all_first_20bits_double_same, state.last_first_20bits_double,
+                state.max_exponents_double, value_count.first, access_kind);
+            if (not state.possible_float_type_overuse) break;
+          }
+        } else if (access_kind.unit_size == 32) {
+          //            IEEE 754 half exponent range: -14 ~ 15
+          if (state.max_exponents_double >= -14 && state.max_exponents_double <= 15) {
+            state.possible_float_type_overuse = check_exponent_and_fraction(
+                state.all_first_9bits_float_same, state.last_first_9bits_float,
+                state.max_exponents_double, value_count.first, access_kind);
+            if (not state.possible_float_type_overuse) break;
+          }
+        }
+      }
+    }
+  }
+  if (values.size() == 1) {
+    state.unique_value_count[values.front().first] += 1;
+    state.unique_item_count++;
+  }
+  for (auto &value_count : values) {
+    state.total_access_count += value_count.second;
+    if (values.size() == 1) state.total_unique_item_access_count += value_count.second;
+  }
+}
+
+void ValuePattern::dense_value_pattern(DenseValueState &state, const ItemsValueCount &array_items,
+                                       bool approx, ArrayPatternInfo &array_pattern_info) {
   using std::get;
   using std::make_tuple;
-  using std::pair;
-  using std::tuple;
   auto &access_kind = array_pattern_info.access_kind;
   u64 memory_size = array_pattern_info.memory.len;
   //    number of accessed items
-  auto number_of_items = array_items.size();
+  auto number_of_items = state.number_of_items;
   //  the following variables will be updated.
   auto &top_value_count_vec = array_pattern_info.top_value_count_vec;
-  int unique_item_count = 0;
   auto &vpts = array_pattern_info.vpts;
   auto &narrow_down_to_unit_size = array_pattern_info.narrow_down_to_unit_size;
-  auto &unique_value_count_vec = array_pattern_info.unqiue_value_count_vec;
+  auto &unique_value_count = state.unique_value_count;
+  auto &unique_value_count_vec = state.unique_value_count_vec;
   // special memory array
   if (memory_size == 0) {
     vpts.emplace_back(VP_NO_PATTERN);
     return;
   }
-  u64 total_access_count = 0;
-  u64 total_unique_item_access_count = 0;
   float THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE = 0.1;
   float THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE_2 = 0.5;
-  int TOP_NUM_VALUE = 10;
-
-  ValueCount unique_value_count;
-  bool inappropriate_float_type = true;
-  //     <signed_leading_zero_bits, unsigned_leading_zero_bits, tail_zero_bits>
-  tuple<int, int, int> redundant_zero_bits =
-      make_tuple(access_kind.unit_size, access_kind.unit_size, access_kind.unit_size);
-  bool all_first_20bits_double_same = true;
-  bool all_first_9bits_float_same = true;
-  u64 last_first_20bits_double = 0;
-  u64 last_first_9bits_float = 0;
   const int MAX_DOUBLE_EXPONENT = 127;
   const int MAX_FLOAT_EXPONENT = 14;
-  int max_exponents_double = 0;
-  int max_exponents_float = 0;
-  bool possible_float_type_overuse = true;
-  // Type ArrayItems is part of ValueDist: {offset: {value: count}}
-  for (auto temp_item_value_count_w_i : array_items) {
-    auto temp_item_value_count = temp_item_value_count_w_i.second;
-    if (access_kind.data_type == REDSHOW_DATA_INT) {
-      for (auto temp_value : temp_item_value_count) {
-        //          int type overuse
-        auto temp_redundat_zero_bits = get_redundant_zeros_bits(temp_value.first, access_kind);
-        redundant_zero_bits =
-            make_tuple(std::min(get<0>(redundant_zero_bits), get<0>(temp_redundat_zero_bits)),
-                       std::min(get<1>(redundant_zero_bits), get<1>(temp_redundat_zero_bits)),
-                       std::min(get<2>(redundant_zero_bits), get<2>(temp_redundat_zero_bits)));
-      }
-    } else if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
-      for (auto temp_value : temp_item_value_count) {
-        if (inappropriate_float_type && !float_no_decimal(temp_value.first, access_kind)) {
-          inappropriate_float_type = false;
-          break;
-        }
-      }
-      if (possible_float_type_overuse) {
-        for (auto temp_value : temp_item_value_count) {
-          //          float type overuse
-          if (access_kind.unit_size == 64) {
-            //            float exponent range : -127 ~ 128
-            if (max_exponents_double >= -127 && max_exponents_double <= 128) {
-              possible_float_type_overuse = check_exponent_and_fraction(
-                  all_first_20bits_double_same, last_first_20bits_double, max_exponents_double,
-                  temp_value.first, access_kind);
-              if (not possible_float_type_overuse) break;
-            }
-          } else if (access_kind.unit_size == 32) {
-            //            IEEE 754 half exponent range: -14 ~ 15
-            if (max_exponents_double >= -14 && max_exponents_double <= 15) {
-              possible_float_type_overuse =
-                  check_exponent_and_fraction(all_first_9bits_float_same, last_first_9bits_float,
-                                              max_exponents_double, temp_value.first, access_kind);
-              if (not possible_float_type_overuse) break;
-            }
-          }
-        }
-      }
-    }
-    if (temp_item_value_count.size() == 1) {
-      unique_value_count[temp_item_value_count.begin()->first] += 1;
-      unique_item_count++;
-    }
-    for (auto item_value_count_one : temp_item_value_count) {
-      total_access_count += item_value_count_one.second;
-      if (temp_item_value_count.size() == 1)
-        total_unique_item_access_count += item_value_count_one.second;
-    }
-  }
-  array_pattern_info.total_access_count = total_access_count;
-  array_pattern_info.unique_item_count = unique_item_count;
-  array_pattern_info.unique_item_access_count = total_unique_item_access_count;
-  if (detect_structrued_pattern(array_items, array_pattern_info)) {
+  array_pattern_info.total_access_count = state.total_access_count;
+  array_pattern_info.unique_item_count = state.unique_item_count;
+  array_pattern_info.unique_item_access_count = state.total_unique_item_access_count;
+  if (detect_structrued_pattern(array_items, approx, number_of_items, array_pattern_info)) {
     vpts.emplace_back(VP_STRUCTURED_PATTERN);
   }
-  if (access_kind.data_type == REDSHOW_DATA_FLOAT && inappropriate_float_type) {
+  if (access_kind.data_type == REDSHOW_DATA_FLOAT && state.inappropriate_float_type) {
     vpts.emplace_back(VP_INAPPROPRIATE_FLOAT);
   }
   if (access_kind.data_type == REDSHOW_DATA_INT) {
-    detect_type_overuse(redundant_zero_bits, access_kind, narrow_down_to_unit_size);
+    detect_type_overuse(state.redundant_zero_bits, access_kind, narrow_down_to_unit_size);
     if (access_kind.unit_size != get<0>(narrow_down_to_unit_size) ||
         access_kind.unit_size != get<1>(narrow_down_to_unit_size) ||
         access_kind.unit_size != get<2>(narrow_down_to_unit_size)) {
@@ -466,19 +1027,20 @@ void ValuePattern::dense_value_pattern(ItemsValueCount &array_items,
     }
   }
 
-  for (auto iter : unique_value_count) {
+  for (auto &iter : unique_value_count) {
     unique_value_count_vec.emplace_back(iter.first, iter.second);
   }
   std::sort(unique_value_count_vec.begin(), unique_value_count_vec.end(),
             [](auto &l, auto &r) { return l.second > r.second; });
 
-  for (int i = 0; i < std::min((size_t)TOP_NUM_VALUE, unique_value_count_vec.size()); i++) {
+  array_pattern_info.unique_value_count = unique_value_count_vec.size();
+  for (int i = 0; i < std::min(_TOP_NUM_VALUE, unique_value_count_vec.size()); i++) {
     top_value_count_vec.emplace_back(unique_value_count_vec[i]);
   }
   ValuePatternType vpt = VP_NO_PATTERN;
   //  single value pattern, redundant zeros
   if (unique_value_count.size() == 1) {
-    if (total_access_count == total_unique_item_access_count) {
+    if (state.total_access_count == state.total_unique_item_access_count) {
       if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
         if (access_kind.unit_size == 32) {
           uint32_t value_hex = unique_value_count.begin()->first & 0xffffffffu;
@@ -507,7 +1069,7 @@ void ValuePattern::dense_value_pattern(ItemsValueCount &array_items,
       }
     }
   } else {
-    if (unique_item_count >= THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE_2 * number_of_items) {
+    if (state.unique_item_count >= THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE_2 * number_of_items) {
       if (unique_value_count_vec.size() <= THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE * number_of_items) {
         vpt = VP_DENSE_VALUE;
       }
@@ -517,15 +1079,15 @@ void ValuePattern::dense_value_pattern(ItemsValueCount &array_items,
   if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
     if (access_kind.unit_size == 32) {
       if (((vpt == VP_SINGLE_VALUE or vpt == VP_REDUNDANT_ZEROS) ||
-           (not all_first_9bits_float_same)) &&
-          max_exponents_float <= MAX_FLOAT_EXPONENT) {
+           (not state.all_first_9bits_float_same)) &&
+          state.max_exponents_float <= MAX_FLOAT_EXPONENT) {
         narrow_down_to_unit_size = make_tuple(16, 32, 32);
         vpts.emplace_back(VP_TYPE_OVERUSE);
       }
     } else if (access_kind.unit_size == 64) {
       if (((vpt == VP_SINGLE_VALUE or vpt == VP_REDUNDANT_ZEROS) ||
-           (not all_first_20bits_double_same)) &&
-          max_exponents_double <= MAX_DOUBLE_EXPONENT) {
+           (not state.all_first_20bits_double_same)) &&
+          state.max_exponents_double <= MAX_DOUBLE_EXPONENT) {
         narrow_down_to_unit_size = make_tuple(32, 64, 64);
         vpts.emplace_back(VP_TYPE_OVERUSE);
       }
@@ -537,80 +1099,176 @@ void ValuePattern::dense_value_pattern(ItemsValueCount &array_items,
   }
 }
 
-/**
- * @arg array_items: [offset: {value: count}] It is an array to save the value distribution of the
- * target array. */
-bool ValuePattern::approximate_value_pattern(ItemsValueCount &array_items,
-                                             ArrayPatternInfo &array_pattern_info,
-                                             ArrayPatternInfo &array_pattern_info_approx) {
-  auto &access_kind = array_pattern_info.access_kind;
-  auto &memory = array_pattern_info.memory;
-  if (access_kind.data_type != REDSHOW_DATA_FLOAT) {
+u64 ValuePattern::approximate_value(u64 value, const AccessKind &access_kind) {
+  // Now we set approxiamte level is max.
+  if (access_kind.unit_size == 32) {
+    return value_to_float(value, MAX_FLOAT_DIGITS);
+  } else {
+    return value_to_double(value, MAX_DOUBLE_DIGITS);
+  }
+}
+
+bool ValuePattern::same_value_patterns(Vector<ValuePatternType> vpts,
+                                       Vector<ValuePatternType> new_vpts) {
+  if (new_vpts.size() != vpts.size()) {
     return false;
   }
-  int decimal_degree_f32, decimal_degree_f64;
-  vp_approx_level_config(REDSHOW_APPROX_MAX, decimal_degree_f32, decimal_degree_f64);
-  //    auto number_of_items = array_pattern_info.memory.len / (access_kind.unit_size >> 3);
-  auto number_of_items = array_items.size();
-  ItemsValueCount array_items_approx;
-  //    for (auto i = 0; i < number_of_items; ++i) {
-  for (auto one_item_value_count_w_i : array_items) {
-    auto index = one_item_value_count_w_i.first;
-    auto one_item_value_count = one_item_value_count_w_i.second;
-    for (auto one_value_count : one_item_value_count) {
+  std::sort(new_vpts.begin(), new_vpts.end());
+  std::sort(vpts.begin(), vpts.end());
+  return vpts == new_vpts;
+}
+
+void ValuePattern::online_value_pattern(const ArrayValueSummary &summary,
+                                        ArrayPatternInfo &array_pattern_info) {
+  using std::get;
+  using std::make_tuple;
+  auto &access_kind = array_pattern_info.access_kind;
+  auto &vpts = array_pattern_info.vpts;
+  auto &narrow_down_to_unit_size = array_pattern_info.narrow_down_to_unit_size;
+  float THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE = 0.1;
+  float THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE_2 = 0.5;
+  const int MAX_DOUBLE_EXPONENT = 127;
+  const int MAX_FLOAT_EXPONENT = 14;
+
+  u64 number_of_items = summary.items.estimate();
+  u64 number_of_item_values = summary.item_values.estimate();
+  // Lower bound if items with more than one value have two
+  u64 unique_item_count = 0;
+  if (number_of_items * 2 > number_of_item_values) {
+    unique_item_count = std::min(number_of_items, number_of_items * 2 - number_of_item_values);
+  }
+  // Equal while both are exact, otherwise within the error of the sketches
+  bool all_unique_items = number_of_item_values * DistinctSketch::K <=
+                          number_of_items * (DistinctSketch::K + DistinctSketch::K / 16);
+
+  array_pattern_info.total_access_count = summary.total_access_count;
+  array_pattern_info.unique_item_count = unique_item_count;
+  if (number_of_items != 0) {
+    array_pattern_info.unique_item_access_count =
+        summary.total_access_count * unique_item_count / number_of_items;
+  }
+  array_pattern_info.unique_value_count = summary.values.estimate();
+
+  auto &top_value_count_vec = array_pattern_info.top_value_count_vec;
+  for (auto &iter : summary.top_values) {
+    top_value_count_vec.emplace_back(iter.first, iter.second);
+  }
+  std::sort(top_value_count_vec.begin(), top_value_count_vec.end(),
+            [](auto &l, auto &r) { return l.second > r.second; });
+  if (top_value_count_vec.size() > _TOP_NUM_VALUE) {
+    top_value_count_vec.resize(_TOP_NUM_VALUE);
+  }
+
+  // special memory array
+  if (array_pattern_info.memory.len == 0) {
+    vpts.emplace_back(VP_NO_PATTERN);
+    return;
+  }
+
+  // Closed-form least squares over all accesses
+  if (all_unique_items && number_of_items >= 3) {
+    double n = summary.total_access_count;
+    double denominator = n * summary.sum_xx - summary.sum_x * summary.sum_x;
+    if (denominator != 0) {
+      double k = (n * summary.sum_xy - summary.sum_x * summary.sum_y) / denominator;
+      double b = (summary.sum_y - k * summary.sum_x) / n;
+      double sse = summary.sum_yy - 2 * k * summary.sum_xy - 2 * b * summary.sum_y +
+                   k * k * summary.sum_xx + 2 * k * b * summary.sum_x + n * b * b;
+      double mse = std::max(sse, 0.0) / n;
+      double threshold = 0.01 * mse;
+      if (std::abs(mse - threshold) < 1e-3) {
+        array_pattern_info.k = k;
+        array_pattern_info.b = b;
+        array_pattern_info.mse = mse;
+        vpts.emplace_back(VP_STRUCTURED_PATTERN);
+      }
+    }
+  }
+  if (access_kind.data_type == REDSHOW_DATA_FLOAT && summary.float_no_decimal) {
+    vpts.emplace_back(VP_INAPPROPRIATE_FLOAT);
+  }
+  if (access_kind.data_type == REDSHOW_DATA_INT) {
+    detect_type_overuse(summary.redundant_zero_bits, access_kind, narrow_down_to_unit_size);
+    if (access_kind.unit_size != get<0>(narrow_down_to_unit_size) ||
+        access_kind.unit_size != get<1>(narrow_down_to_unit_size) ||
+        access_kind.unit_size != get<2>(narrow_down_to_unit_size)) {
+      vpts.emplace_back(VP_TYPE_OVERUSE);
+    }
+  }
+
+  ValuePatternType vpt = VP_NO_PATTERN;
+  //  single value pattern, redundant zeros
+  if (summary.single_value) {
+    auto value = summary.first_value;
+    if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
       if (access_kind.unit_size == 32) {
-        u64 new_value = value_to_float(one_value_count.first, decimal_degree_f32);
-        array_items_approx[index][new_value] += one_value_count.second;
+        float f;
+        u32 c = value & 0xffffffffu;
+        memcpy(&f, &c, sizeof(c));
+        vpt = std::abs(f) < 1e-6 ? VP_REDUNDANT_ZEROS : VP_SINGLE_VALUE;
       } else if (access_kind.unit_size == 64) {
-        u64 new_value = value_to_double(one_value_count.first, decimal_degree_f64);
-        array_items_approx[index][new_value] += one_value_count.second;
+        double d;
+        memcpy(&d, &value, sizeof(value));
+        vpt = std::abs(d) < 1e-14 ? VP_REDUNDANT_ZEROS : VP_SINGLE_VALUE;
       }
+    } else if (access_kind.data_type == REDSHOW_DATA_INT) {
+      vpt = value == 0 ? VP_REDUNDANT_ZEROS : VP_SINGLE_VALUE;
     }
+  } else if (unique_item_count >= THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE_2 * number_of_items &&
+             array_pattern_info.unique_value_count <=
+                 THRESHOLD_PERCENTAGE_OF_ARRAY_SIZE * number_of_items) {
+    vpt = VP_DENSE_VALUE;
   }
-  dense_value_pattern(array_items_approx, array_pattern_info_approx);
-  auto new_vpts = array_pattern_info_approx.vpts;
-  auto vpts = array_pattern_info.vpts;
-  bool valid_approx = false;
-  if (new_vpts.size() > 0) {
-    if (new_vpts.size() != vpts.size()) {
-      valid_approx = true;
-    } else {
-      std::sort(new_vpts.begin(), new_vpts.end());
-      std::sort(vpts.begin(), vpts.end());
-      for (int i = 0; i < new_vpts.size(); i++) {
-        if (vpts[i] != new_vpts[i]) {
-          valid_approx = true;
-          break;
-        }
+  //    float type overuse
+  if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
+    bool single_value = vpt == VP_SINGLE_VALUE || vpt == VP_REDUNDANT_ZEROS;
+    if (access_kind.unit_size == 32) {
+      if ((single_value || !summary.all_first_Xbits_same) &&
+          summary.max_exponents <= MAX_FLOAT_EXPONENT) {
+        narrow_down_to_unit_size = make_tuple(16, 32, 32);
+        vpts.emplace_back(VP_TYPE_OVERUSE);
+      }
+    } else if (access_kind.unit_size == 64) {
+      if ((single_value || !summary.all_first_Xbits_same) &&
+          summary.max_exponents <= MAX_DOUBLE_EXPONENT) {
+        narrow_down_to_unit_size = make_tuple(32, 64, 64);
+        vpts.emplace_back(VP_TYPE_OVERUSE);
       }
     }
   }
-  return valid_approx;
+  if (vpts.size() == 0 || vpt != VP_NO_PATTERN) {
+    vpts.emplace_back(vpt);
+  }
 }
 
-void ValuePattern::show_value_pattern(ArrayPatternInfo &array_pattern_info, std::ofstream &out,
-                                      uint8_t read_flag) {
+void ValuePattern::show_value_pattern(const ArrayPatternInfo &array_pattern_info,
+                                      std::ostream &out, uint8_t read_flag) {
   using std::endl;
   using std::get;
+  static const Vector<ValuePatternType> no_pattern_vpts = {VP_NO_PATTERN};
   auto &memory = array_pattern_info.memory;
   int unique_item_count = array_pattern_info.unique_item_count;
-  auto value_count_vec = array_pattern_info.unqiue_value_count_vec;
-  auto access_kind = array_pattern_info.access_kind;
+  auto &access_kind = array_pattern_info.access_kind;
   auto memory_size = array_pattern_info.memory.len;
-  auto vpts = array_pattern_info.vpts;
-  auto narrow_down_to_unit_size = array_pattern_info.narrow_down_to_unit_size;
-  auto top_value_count_vec = array_pattern_info.top_value_count_vec;
+  auto &vpts = array_pattern_info.vpts.size() == 0 ? no_pattern_vpts : array_pattern_info.vpts;
+  auto &narrow_down_to_unit_size = array_pattern_info.narrow_down_to_unit_size;
+  auto &top_value_count_vec = array_pattern_info.top_value_count_vec;
   std::string read_write = read_flag == GPU_PATCH_READ ? "Read" : "Write";
   out << "array id: " << memory.ctx_id << ", memory size " << memory_size << ", value type "
       << access_kind.to_string() << " " << read_write << endl;
   out << "total access count: " << array_pattern_info.total_access_count << endl;
   out << "unique item count: " << unique_item_count << endl;
-  out << "unqiue item value count: " << value_count_vec.size() << endl;
+  out << "unqiue item value count: " << array_pattern_info.unique_value_count << endl;
   out << "unqiue item access count: " << array_pattern_info.unique_item_access_count << endl;
+  if (array_pattern_info.sampling_stride != 1 || array_pattern_info.evicted_access_count != 0) {
+    // Counts above are of tracked items, the rest are not classified
+    out << "sampling item stride: " << array_pattern_info.sampling_stride
+        << ", untracked access count: " << array_pattern_info.untracked_access_count
+        << ", evicted value access count: " << array_pattern_info.evicted_access_count << endl;
+  }
   out << "pattern type:\n";
-  if (vpts.size() == 0) vpts.emplace_back(VP_NO_PATTERN);
   for (auto a_vpt : vpts) {
-    out << " * " << pattern_names[a_vpt] << "\t";
+    out << " * " << pattern_names.at(a_vpt) << "\t";
     AccessKind temp_a;
     auto narrow_down_to_unit_size_signed = get<0>(narrow_down_to_unit_size);
     auto narrow_down_to_unit_size_unsigned = get<1>(narrow_down_to_unit_size);
@@ -652,67 +1310,158 @@ void ValuePattern::show_value_pattern(ArrayPatternInfo &array_pattern_info, std:
   }
   if (top_value_count_vec.size() != 0) {
     out << "TOP unqiue value\tcount" << endl;
-    for (auto item : top_value_count_vec) {
+    for (auto &item : top_value_count_vec) {
       out << access_kind.value_to_string(item.first, true) << "\t" << item.second << endl;
     }
   }
   out << endl;
 }
 
-bool ValuePattern::detect_structrued_pattern(ItemsValueCount &array_items,
+void ValuePattern::add_pattern_record(const ArrayPatternInfo &array_pattern_info, bool approximate,
+                                      ArrayPatternTask &task) {
+  task.records.emplace_back();
+  auto &record = task.records.back();
+  clear_record(record);
+  record.array_id = array_pattern_info.memory.ctx_id;
+  record.memory_size = array_pattern_info.memory.len;
+  record.read = task.read_flag == GPU_PATCH_READ;
+  record.approximate = approximate;
+  record.total_access_count = array_pattern_info.total_access_count;
+  record.unique_item_count = array_pattern_info.unique_item_count;
+  record.unique_value_count = array_pattern_info.unique_value_count;
+  record.unique_item_access_count = array_pattern_info.unique_item_access_count;
+  record.sampling_stride = array_pattern_info.sampling_stride;
+  record.untracked_access_count = array_pattern_info.untracked_access_count;
+  record.evicted_access_count = array_pattern_info.evicted_access_count;
+  if (array_pattern_info.vpts.size() == 0) {
+    record.patterns = 1u << VP_NO_PATTERN;
+  }
+  for (auto vpt : array_pattern_info.vpts) {
+    record.patterns |= 1u << vpt;
+  }
+  record.narrow_signed_unit_size = std::get<0>(array_pattern_info.narrow_down_to_unit_size);
+  record.narrow_unsigned_unit_size = std::get<1>(array_pattern_info.narrow_down_to_unit_size);
+  record.narrow_tail_unit_size = std::get<2>(array_pattern_info.narrow_down_to_unit_size);
+  record.k = array_pattern_info.k;
+  record.b = array_pattern_info.b;
+  record.mse = array_pattern_info.mse;
+  auto &top_value_count_vec = array_pattern_info.top_value_count_vec;
+  record.top_value_count = std::min(top_value_count_vec.size(), _TOP_NUM_VALUE);
+  for (size_t i = 0; i < record.top_value_count; ++i) {
+    record.top_values[i] = top_value_count_vec[i].first;
+    record.top_counts[i] = top_value_count_vec[i].second;
+  }
+}
+
+Vector<RecordTable> ValuePattern::record_tables() {
+  Vector<RecordTable> tables;
+
+  RecordTable kernel_table("kernel", sizeof(KernelRecord));
+  kernel_table.fields.emplace_back("kernel_id", RECORD_FIELD_I32,
+                                   offsetof(KernelRecord, kernel_id));
+  tables.emplace_back(kernel_table);
+
+  RecordTable table("array", sizeof(ArrayPatternRecord));
+  auto add_field = [&table](const std::string &name, RecordFieldType type, size_t offset) {
+    table.fields.emplace_back(name, type, offset);
+  };
+  add_field("array_id", RECORD_FIELD_I32, offsetof(ArrayPatternRecord, array_id));
+  add_field("memory_size", RECORD_FIELD_U64, offsetof(ArrayPatternRecord, memory_size));
+  add_field("access_kind", RECORD_FIELD_ACCESS_KIND, offsetof(ArrayPatternRecord, access_kind));
+  add_field("read", RECORD_FIELD_U8, offsetof(ArrayPatternRecord, read));
+  add_field("approximate", RECORD_FIELD_U8, offsetof(ArrayPatternRecord, approximate));
+  add_field("total_access_count", RECORD_FIELD_U64,
+            offsetof(ArrayPatternRecord, total_access_count));
+  add_field("unique_item_count", RECORD_FIELD_I32,
+            offsetof(ArrayPatternRecord, unique_item_count));
+  add_field("unique_item_value_count", RECORD_FIELD_U64,
+            offsetof(ArrayPatternRecord, unique_value_count));
+  add_field("unique_item_access_count", RECORD_FIELD_U64,
+            offsetof(ArrayPatternRecord, unique_item_access_count));
+  add_field("sampling_item_stride", RECORD_FIELD_U64,
+            offsetof(ArrayPatternRecord, sampling_stride));
+  add_field("untracked_access_count", RECORD_FIELD_U64,
+            offsetof(ArrayPatternRecord, untracked_access_count));
+  add_field("evicted_value_access_count", RECORD_FIELD_U64,
+            offsetof(ArrayPatternRecord, evicted_access_count));
+  add_field("patterns", RECORD_FIELD_U32, offsetof(ArrayPatternRecord, patterns));
+  add_field("narrow_signed_unit_size", RECORD_FIELD_U32,
+            offsetof(ArrayPatternRecord, narrow_signed_unit_size));
+  add_field("narrow_unsigned_unit_size", RECORD_FIELD_U32,
+            offsetof(ArrayPatternRecord, narrow_unsigned_unit_size));
+  add_field("narrow_tail_unit_size", RECORD_FIELD_U32,
+            offsetof(ArrayPatternRecord, narrow_tail_unit_size));
+  add_field("k", RECORD_FIELD_F64, offsetof(ArrayPatternRecord, k));
+  add_field("b", RECORD_FIELD_F64, offsetof(ArrayPatternRecord, b));
+  add_field("mse", RECORD_FIELD_F64, offsetof(ArrayPatternRecord, mse));
+  add_field("top_value_count", RECORD_FIELD_U32, offsetof(ArrayPatternRecord, top_value_count));
+  for (size_t i = 0; i < _TOP_NUM_VALUE; ++i) {
+    add_field("top_value_" + std::to_string(i), RECORD_FIELD_VALUE,
+              offsetof(ArrayPatternRecord, top_values) + i * sizeof(u64));
+    add_field("top_count_" + std::to_string(i), RECORD_FIELD_U64,
+              offsetof(ArrayPatternRecord, top_counts) + i * sizeof(u64));
+  }
+  tables.emplace_back(table);
+
+  // Summaries of allocations have the records of arrays
+  table.name = "array_summary";
+  tables.emplace_back(table);
+
+  return tables;
+}
+
+bool ValuePattern::detect_structrued_pattern(const ItemsValueCount &array_items, bool approx,
+                                             u64 number_of_items,
                                              ArrayPatternInfo &array_pattern_info) {
   //  All of the items are unique items.
   auto &access_kind = array_pattern_info.access_kind;
-  //    u64 number_of_items = array_pattern_info.memory.len / (access_kind.unit_size >> 3);
-  u64 number_of_items = array_items.size();
   //  Ignore the 0th and the last item.
   if (array_pattern_info.unique_item_count == number_of_items && number_of_items >= 3) {
+    // Values of unique items are also unique after approximation
+    auto item_value = [&](const ItemsValueCount::Item &item) {
+      return approx ? approximate_value(item.value(), access_kind) : item.value();
+    };
     double sum_x = 0;
     double sum_y_f = 0;
     long long sum_y_i = 0;
     double avg_y = 0;
-    for (auto temp_item_value_count_wi : array_items) {
-      sum_x += temp_item_value_count_wi.first;
-    }
+    array_items.for_each([&](u64 offset, const ItemsValueCount::Item &item) { sum_x += offset; });
     double avg_x = sum_x / number_of_items;
     if (access_kind.data_type == REDSHOW_DATA_INT) {
-      for (auto temp_item_value_count_wi : array_items) {
-        sum_y_i += temp_item_value_count_wi.second.begin()->first;
-      }
+      array_items.for_each(
+          [&](u64 offset, const ItemsValueCount::Item &item) { sum_y_i += item_value(item); });
       avg_y = (double)sum_y_i / number_of_items;
     } else if (access_kind.data_type == REDSHOW_DATA_FLOAT) {
       float a;
       double b;
-      for (auto temp_item_value_count_wi : array_items) {
-        auto &temp_item_value_count = temp_item_value_count_wi.second;
+      array_items.for_each([&](u64 offset, const ItemsValueCount::Item &item) {
         if (access_kind.unit_size == 32) {
-          u32 c = temp_item_value_count.begin()->first & 0xffffffffu;
+          u32 c = item_value(item) & 0xffffffffu;
           memcpy(&a, &c, sizeof(c));
           sum_y_f += a;
         } else if (access_kind.unit_size == 64) {
-          u64 c = temp_item_value_count.begin()->first & 0xffffffffu;
+          u64 c = item_value(item) & 0xffffffffu;
           memcpy(&b, &c, sizeof(c));
           sum_y_f += b;
         }
-      }
+      });
       avg_y = sum_y_f / number_of_items;
     }
     double sum1 = 0, sum2 = 0, mse = 0;
-    for (auto temp_item_value_count_wi : array_items) {
-      auto i = temp_item_value_count_wi.first;
-      sum1 += (i - avg_x) * (temp_item_value_count_wi.second.begin()->first - avg_y);
+    array_items.for_each([&](u64 i, const ItemsValueCount::Item &item) {
+      sum1 += (i - avg_x) * (item_value(item) - avg_y);
       sum2 += (i - avg_x) * (i - avg_x);
-    }
+    });
     double k = sum1 / sum2;
     double b = avg_y - k * avg_x;
     double threshold = 0;
     //      calculate precision of our predictor
-    for (auto temp_item_value_count_wi : array_items) {
-      double y_p = k * temp_item_value_count_wi.first + b;
-      double temp_t = y_p - temp_item_value_count_wi.second.begin()->first;
+    array_items.for_each([&](u64 i, const ItemsValueCount::Item &item) {
+      double y_p = k * i + b;
+      double temp_t = y_p - item_value(item);
       mse += temp_t * temp_t;
       threshold += (0.1 * temp_t) * (0.1 * temp_t);
-    }
+    });
     mse = mse / number_of_items;
     threshold = threshold / number_of_items;
     if (std::abs(mse - threshold) < 1e-3) {
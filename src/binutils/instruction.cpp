@@ -1,16 +1,19 @@
 #include "binutils/instruction.h"
 
 #include <algorithm>
-#include <boost/lexical_cast.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/property_tree/ptree.hpp>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <queue>
 #include <vector>
 
+#include "binutils/instruction_cache.h"
 #include "binutils/symbol.h"
+#include "common/hash.h"
+#include "common/json_reader.h"
+#include "common/mapped_file.h"
 #include "common/utils.h"
 #include "redshow.h"
 
@@ -25,19 +28,8 @@ namespace redshow {
 void InstructionParser::default_access_kind(Instruction &inst) {
   if (inst.access_kind->vec_size == 0) {
     // Determine the vec size of data,
-    if (inst.op.find(".128") != std::string::npos) {
-      inst.access_kind->vec_size = 128;
-    } else if (inst.op.find(".64") != std::string::npos) {
-      inst.access_kind->vec_size = 64;
-    } else if (inst.op.find(".32") != std::string::npos) {
-      inst.access_kind->vec_size = 32;
-    } else if (inst.op.find(".16") != std::string::npos) {
-      inst.access_kind->vec_size = 16;
-    } else if (inst.op.find(".8") != std::string::npos) {
-      inst.access_kind->vec_size = 8;
-    } else {
-      inst.access_kind->vec_size = 32;
-    }
+    auto vec_size = inst.vec_size();
+    inst.access_kind->vec_size = vec_size == 0 ? 32 : vec_size;
   }
 
   // Default mode
@@ -53,6 +45,40 @@ void InstructionParser::default_access_kind(Instruction &inst) {
   }
 }
 
+u32 Instruction::decode_op(const std::string_view &op) noexcept {
+  static const std::pair<const char *, u32> TOKENS[] = {
+      {"MEMORY", INST_MEMORY},
+      {".LOAD", INST_LOAD},
+      {".STORE", INST_STORE},
+      {"STORE", INST_STORE_ANY},
+      {".SHARED", INST_SHARED},
+      {".LOCAL", INST_LOCAL},
+      {"MOVE", INST_MOVE},
+      {"UNIFORM", INST_UNIFORM},
+      {"INTEGER", INST_INTEGER},
+      {"FLOAT", INST_FLOAT},
+      {"CONVERT", INST_CONVERT},
+      {".I2F", INST_I2F},
+      {".F2F", INST_F2F},
+      {".F2I", INST_F2I},
+      {".I2I", INST_I2I},
+      {"._64_TO_32", INST_64_TO_32},
+      {"._32_TO_64", INST_32_TO_64},
+      {".8", INST_WIDTH_8},
+      {".16", INST_WIDTH_16},
+      {".32", INST_WIDTH_32},
+      {".64", INST_WIDTH_64},
+      {".128", INST_WIDTH_128}};
+
+  u32 flags = INST_NONE;
+  for (auto &token : TOKENS) {
+    if (op.find(token.first) != std::string_view::npos) {
+      flags |= token.second;
+    }
+  }
+  return flags;
+}
+
 AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGraph &inst_graph,
                                                std::set<unsigned int> &visited, bool load) {
   if (visited.find(inst.pc) != visited.end()) {
@@ -64,22 +90,11 @@ AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGra
 
   AccessKind access_kind;
   // Determine the vec size of data,
-  if (inst.op.find(".128") != std::string::npos) {
-    access_kind.vec_size = 128;
-  } else if (inst.op.find(".64") != std::string::npos) {
-    access_kind.vec_size = 64;
-  } else if (inst.op.find(".32") != std::string::npos) {
-    access_kind.vec_size = 32;
-  } else if (inst.op.find(".16") != std::string::npos) {
-    access_kind.vec_size = 16;
-  } else if (inst.op.find(".8") != std::string::npos) {
-    access_kind.vec_size = 8;
-  } else {
-    access_kind.vec_size = 32;
-  }
+  auto vec_size = inst.vec_size();
+  access_kind.vec_size = vec_size == 0 ? 32 : vec_size;
 
   // Special handling for uniform register instructions
-  if (inst.op.find("UNIFORM") != std::string::npos) {
+  if (inst.has(INST_UNIFORM)) {
     access_kind.data_type = REDSHOW_DATA_INT;
   }
 
@@ -88,7 +103,7 @@ AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGra
     return access_kind;
   }
 
-  auto &edges = load ? inst_graph.outgoing_edges(inst.pc) : inst_graph.incoming_edges(inst.pc);
+  auto edges = load ? inst_graph.outgoing_edges(inst.pc) : inst_graph.incoming_edges(inst.pc);
 
   for (auto iter = edges.begin(); iter != edges.end(); ++iter) {
     auto pc = load ? iter->to : iter->from;
@@ -97,21 +112,21 @@ AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGra
 
     // Direct unit size detect
     if (access_kind.unit_size == 0) {
-      if (neighbor_inst.op.find(".64") != std::string::npos) {
+      if (neighbor_inst.has(INST_WIDTH_64)) {
         access_kind.unit_size = MIN2(64, access_kind.vec_size);
-      } else if (neighbor_inst.op.find(".32") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_WIDTH_32)) {
         access_kind.unit_size = MIN2(32, access_kind.vec_size);
-      } else if (neighbor_inst.op.find(".16") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_WIDTH_16)) {
         access_kind.unit_size = MIN2(16, access_kind.vec_size);
-      } else if (neighbor_inst.op.find(".8") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_WIDTH_8)) {
         access_kind.unit_size = MIN2(8, access_kind.vec_size);
-      } else if (neighbor_inst.op.find("._64_TO_32") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_64_TO_32)) {
         if (load) {
           access_kind.unit_size = MIN2(64, access_kind.vec_size);
         } else {
           access_kind.unit_size = MIN2(32, access_kind.vec_size);
         }
-      } else if (neighbor_inst.op.find("._32_TO_64") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_32_TO_64)) {
         if (load) {
           access_kind.unit_size = MIN2(32, access_kind.vec_size);
         } else {
@@ -120,7 +135,7 @@ AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGra
       }
     }
 
-    if (neighbor_inst.op.find("MOVE") != std::string::npos) {
+    if (neighbor_inst.has(INST_MOVE)) {
       // Transit node
       // INTEGER.IMAD.MOVE is handled here
       // Since a transit node is never a memory instruction, so do not cache its result
@@ -131,11 +146,10 @@ AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGra
       if (access_kind.unit_size == 0) {
         access_kind.unit_size = neighbor_access_kind.unit_size;
       }
-    } else if (neighbor_inst.op.find("MEMORY") != std::string::npos) {
+    } else if (neighbor_inst.has(INST_MEMORY)) {
       if (load) {
         // Decided by memory hierarchy
-        if (neighbor_inst.op.find(".SHARED") != std::string::npos ||
-            neighbor_inst.op.find(".LOCAL") != std::string::npos) {
+        if (neighbor_inst.has(INST_SHARED | INST_LOCAL)) {
           if (std::find(inst.dsts.begin(), inst.dsts.end(), neighbor_inst.srcs[0]) !=
               inst.dsts.end()) {
             if (access_kind.data_type == REDSHOW_DATA_UNKNOWN) {
@@ -175,27 +189,26 @@ AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGra
           access_kind.unit_size = neighbor_access_kind.unit_size;
         }
       }
-    } else if (neighbor_inst.op.find("INTEGER") != std::string::npos ||
-               neighbor_inst.op.find("UNIFORM") != std::string::npos) {
+    } else if (neighbor_inst.has(INST_INTEGER | INST_UNIFORM)) {
       access_kind.data_type = REDSHOW_DATA_INT;
-    } else if (neighbor_inst.op.find("FLOAT") != std::string::npos) {
+    } else if (neighbor_inst.has(INST_FLOAT)) {
       access_kind.data_type = REDSHOW_DATA_FLOAT;
-    } else if (neighbor_inst.op.find("CONVERT") != std::string::npos) {
-      if (neighbor_inst.op.find(".I2F") != std::string::npos) {
+    } else if (neighbor_inst.has(INST_CONVERT)) {
+      if (neighbor_inst.has(INST_I2F)) {
         if (load) {
           access_kind.data_type = REDSHOW_DATA_INT;
         } else {
           access_kind.data_type = REDSHOW_DATA_FLOAT;
         }
-      } else if (neighbor_inst.op.find(".F2F") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_F2F)) {
         access_kind.data_type = REDSHOW_DATA_FLOAT;
-      } else if (neighbor_inst.op.find(".F2I") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_F2I)) {
         if (load) {
           access_kind.data_type = REDSHOW_DATA_FLOAT;
         } else {
           access_kind.data_type = REDSHOW_DATA_INT;
         }
-      } else if (neighbor_inst.op.find(".I2I") != std::string::npos) {
+      } else if (neighbor_inst.has(INST_I2I)) {
         access_kind.data_type = REDSHOW_DATA_INT;
       }
     } else {
@@ -212,92 +225,163 @@ AccessKind InstructionParser::init_access_kind(Instruction &inst, InstructionGra
   return access_kind;
 }
 
-bool InstructionParser::parse(const std::string &file_path, SymbolVector &symbols,
-                              InstructionGraph &inst_graph) {
-  boost::property_tree::ptree root;
-  boost::property_tree::read_json(file_path, root);
-
-#ifdef DEBUG_INSTRUCTION
-  // inst_pc-><symbol_index, inst_pc_offset>
-  std::map<int, std::pair<int, int>> pc_offsets;
-#endif
-
-  // Read instructions
-  for (auto &ptree_function : root) {
-    int function_index = ptree_function.second.get<int>("index", 0);
-    int cubin_offset = ptree_function.second.get<int>("address", 0);
-    // Ensure space
-    symbols.resize(MAX2(symbols.size(), function_index + 1));
-    symbols[function_index] = Symbol(function_index, cubin_offset);
-
-    auto &ptree_blocks = ptree_function.second.get_child("blocks");
-    for (auto &ptree_block : ptree_blocks) {
-      auto &ptree_insts = ptree_block.second.get_child("insts");
-      for (auto &ptree_inst : ptree_insts) {
-        int pc = ptree_inst.second.get<int>("pc", 0) + cubin_offset;
-        std::string op = ptree_inst.second.get<std::string>("op", "");
-        int pred = ptree_inst.second.get<int>("pred", -1);
-
-        std::vector<int> dsts;
-        auto &ptree_dsts = ptree_inst.second.get_child("dsts");
-        for (auto &ptree_dst : ptree_dsts) {
-          int dst = boost::lexical_cast<int>(ptree_dst.second.data());
-          dsts.push_back(dst);
-        }
+bool InstructionParser::read_registers(JsonReader &reader, std::vector<int> &regs) {
+  if (!reader.begin_array()) {
+    return false;
+  }
+  while (reader.next_element()) {
+    int reg = 0;
+    if (!reader.read_int(reg)) {
+      return false;
+    }
+    regs.push_back(reg);
+  }
+  return !reader.error();
+}
 
-        std::vector<int> srcs;
-        std::map<int, std::vector<int>> assign_pcs;
-        auto &ptree_srcs = ptree_inst.second.get_child("srcs");
-        for (auto &ptree_src : ptree_srcs) {
-          int src = ptree_src.second.get<int>("id", 0);
-          srcs.push_back(src);
-          auto &ptree_assign_pcs = ptree_src.second.get_child("assign_pcs");
-          for (auto &ptree_assign_pc : ptree_assign_pcs) {
-            int assign_pc = boost::lexical_cast<int>(ptree_assign_pc.second.data()) + cubin_offset;
-            assign_pcs[src].push_back(assign_pc);
-          }
-        }
+bool InstructionParser::read_sources(JsonReader &reader, const std::string_view &assign_key,
+                                     std::vector<int> &srcs,
+                                     std::map<int, std::vector<int>> &assign_pcs) {
+  if (!reader.begin_array()) {
+    return false;
+  }
+  std::vector<int> pcs;
+  while (reader.next_element()) {
+    if (!reader.begin_object()) {
+      return false;
+    }
+    // "id" is not guaranteed to precede the assign pcs
+    int src = 0;
+    pcs.clear();
+    std::string_view key;
+    while (reader.next_key(key)) {
+      bool ok = true;
+      if (key == "id") {
+        ok = reader.read_int(src);
+      } else if (key == assign_key) {
+        ok = read_registers(reader, pcs);
+      } else {
+        ok = reader.skip_value();
+      }
+      if (!ok) {
+        return false;
+      }
+    }
+    if (reader.error()) {
+      return false;
+    }
+    srcs.push_back(src);
+    if (!pcs.empty()) {
+      auto &src_pcs = assign_pcs[src];
+      src_pcs.insert(src_pcs.end(), pcs.begin(), pcs.end());
+    }
+  }
+  return !reader.error();
+}
 
-        std::vector<int> udsts;
-        auto &ptree_udsts = ptree_inst.second.get_child("udsts");
-        for (auto &ptree_udst : ptree_udsts) {
-          int udst = boost::lexical_cast<int>(ptree_udst.second.data());
-          udsts.push_back(udst);
-        }
+bool InstructionParser::read_instruction(JsonReader &reader, Instruction &inst) {
+  if (!reader.begin_object()) {
+    return false;
+  }
+  inst.pc = 0;
+  inst.predicate = -1;
+  std::string_view key;
+  while (reader.next_key(key)) {
+    bool ok = true;
+    if (key == "pc") {
+      ok = reader.read_int(inst.pc);
+    } else if (key == "op") {
+      std::string_view op;
+      ok = reader.read_string(op);
+      inst.set_op(op);
+    } else if (key == "pred") {
+      ok = reader.read_int(inst.predicate);
+    } else if (key == "dsts") {
+      ok = read_registers(reader, inst.dsts);
+    } else if (key == "srcs") {
+      ok = read_sources(reader, "assign_pcs", inst.srcs, inst.assign_pcs);
+    } else if (key == "udsts") {
+      ok = read_registers(reader, inst.udsts);
+    } else if (key == "usrcs") {
+      ok = read_sources(reader, "uassign_pcs", inst.usrcs, inst.uassign_pcs);
+    } else {
+      ok = reader.skip_value();
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return !reader.error();
+}
 
-        std::vector<int> usrcs;
-        std::map<int, std::vector<int>> uassign_pcs;
-        auto &ptree_usrcs = ptree_inst.second.get_child("usrcs");
-        for (auto &ptree_usrc : ptree_usrcs) {
-          int usrc = ptree_usrc.second.get<int>("id", 0);
-          usrcs.push_back(usrc);
-          auto &ptree_uassign_pcs = ptree_usrc.second.get_child("uassign_pcs");
-          for (auto &ptree_uassign_pc : ptree_uassign_pcs) {
-            int uassign_pc =
-                boost::lexical_cast<int>(ptree_uassign_pc.second.data()) + cubin_offset;
-            uassign_pcs[usrc].push_back(uassign_pc);
+bool InstructionParser::read_function(JsonReader &reader, int &function_index, int &cubin_offset,
+                                      std::vector<Instruction> &insts) {
+  if (!reader.begin_object()) {
+    return false;
+  }
+  function_index = 0;
+  cubin_offset = 0;
+  std::string_view key;
+  while (reader.next_key(key)) {
+    bool ok = true;
+    if (key == "index") {
+      ok = reader.read_int(function_index);
+    } else if (key == "address") {
+      ok = reader.read_int(cubin_offset);
+    } else if (key == "blocks") {
+      ok = reader.begin_array();
+      while (ok && reader.next_element()) {
+        ok = reader.begin_object();
+        std::string_view block_key;
+        while (ok && reader.next_key(block_key)) {
+          if (block_key == "insts") {
+            ok = reader.begin_array();
+            while (ok && reader.next_element()) {
+              insts.emplace_back();
+              ok = read_instruction(reader, insts.back());
+            }
+          } else {
+            ok = reader.skip_value();
           }
         }
+      }
+    } else {
+      ok = reader.skip_value();
+    }
+    if (!ok || reader.error()) {
+      return false;
+    }
+  }
+  if (reader.error() || function_index < 0) {
+    return false;
+  }
 
-        Instruction inst(op, pc, pred, dsts, srcs, udsts, usrcs, assign_pcs, uassign_pcs);
-        inst_graph.add_node(pc, inst);
-
-#ifdef DEBUG_INSTRUCTION
-        pc_offsets[pc] = std::make_pair(function_index, pc - cubin_offset);
-#endif
+  // "address" is not guaranteed to precede "blocks", relocate pcs at the end
+  for (auto &inst : insts) {
+    inst.pc += cubin_offset;
+    for (auto &iter : inst.assign_pcs) {
+      for (auto &pc : iter.second) {
+        pc += cubin_offset;
+      }
+    }
+    for (auto &iter : inst.uassign_pcs) {
+      for (auto &pc : iter.second) {
+        pc += cubin_offset;
       }
     }
   }
+  return true;
+}
 
+void InstructionParser::analyze(InstructionGraph &inst_graph) {
   // Build a instruction dependency graph
-  for (auto iter = inst_graph.nodes_begin(); iter != inst_graph.nodes_end(); ++iter) {
-    auto &inst = iter->second;
+  for (size_t pos = 0; pos < inst_graph.size(); ++pos) {
+    auto &inst = inst_graph.node_at(pos);
 
     size_t i = 0;
-    if (inst.op.find("STORE") != std::string::npos) {
+    if (inst.has(INST_STORE_ANY)) {
       // If store operation has more than one src, skip the first or two src
-      if (inst.op.find(".SHARED") != std::string::npos ||
-          inst.op.find(".LOCAL") != std::string::npos) {
+      if (inst.has(INST_SHARED | INST_LOCAL)) {
         i = 1;
       } else {
         i = 2;
@@ -310,7 +394,7 @@ bool InstructionParser::parse(const std::string &file_path, SymbolVector &symbol
       int src = inst.srcs[i];
       for (auto src_pc : inst.assign_pcs[src]) {
         auto edge_index = InstructionDependencyIndex(src_pc, inst.pc);
-        inst_graph.add_edge(std::move(edge_index), false);
+        inst_graph.add_edge(edge_index, false);
       }
     }
 
@@ -318,43 +402,212 @@ bool InstructionParser::parse(const std::string &file_path, SymbolVector &symbol
       int usrc = inst.usrcs[i];
       for (auto usrc_pc : inst.uassign_pcs[usrc]) {
         auto edge_index = InstructionDependencyIndex(usrc_pc, inst.pc);
-        inst_graph.add_edge(std::move(edge_index), false);
+        inst_graph.add_edge(edge_index, false);
       }
     }
   }
 
-  // Analyze memory instruction's access kind
-  for (auto iter = inst_graph.nodes_begin(); iter != inst_graph.nodes_end(); ++iter) {
-    auto &inst = iter->second;
+  // Build CSR arrays, nodes are sorted by pc
+  inst_graph.freeze();
 
-    if (inst.op.find("MEMORY") == std::string::npos) {
-      continue;
+  // Inference and its cache only follow dependency edges, so memory instructions in different
+  // connected components are independent. Components never span functions.
+  typedef InstructionGraph::Position Position;
+  Vector<Position> parents(inst_graph.size());
+  for (size_t pos = 0; pos < parents.size(); ++pos) {
+    parents[pos] = pos;
+  }
+  auto find = [&parents](Position pos) {
+    while (parents[pos] != pos) {
+      parents[pos] = parents[parents[pos]];
+      pos = parents[pos];
     }
+    return pos;
+  };
+  for (size_t i = 0; i < inst_graph.edge_size(); ++i) {
+    auto &edge_index = inst_graph.edge_index_at(i);
+    auto from = find(inst_graph.position(edge_index.from));
+    auto to = find(inst_graph.position(edge_index.to));
+    if (from != to) {
+      parents[MAX2(from, to)] = MIN2(from, to);
+    }
+  }
 
-    if (inst.access_kind.get() != NULL) {
-      // If access kind is cached
+  // <component, [memory instructions in pc order]>
+  Vector<Vector<Position>> groups;
+  Vector<Position> group_of;
+  group_of.assign(inst_graph.size(), InstructionGraph::npos);
+  for (size_t pos = 0; pos < inst_graph.size(); ++pos) {
+    auto &inst = inst_graph.node_at(pos);
+    if (!inst.has(INST_MEMORY)) {
       continue;
     }
+    auto root = find(pos);
+    if (group_of[root] == InstructionGraph::npos) {
+      group_of[root] = groups.size();
+      groups.emplace_back();
+    }
+    groups[group_of[root]].push_back(pos);
+  }
 
-    // If access kind is not determined, allocate one
-    inst.access_kind = std::make_shared<AccessKind>();
-    std::set<unsigned int> visited;
+  // Analyze memory instruction's access kind, each group in the same order as a serial walk
+#ifdef OPENMP
+#pragma omp parallel for schedule(dynamic) if (groups.size() > 1)
+#endif
+  for (size_t i = 0; i < groups.size(); ++i) {
+    for (auto pos : groups[i]) {
+      auto &inst = inst_graph.node_at(pos);
+
+      if (inst.access_kind.get() != NULL) {
+        // If access kind is cached
+        continue;
+      }
 
-    // Associate access type with instruction
-    if (inst.op.find(".STORE") != std::string::npos) {
-      *inst.access_kind = init_access_kind(inst, inst_graph, visited, false);
-    } else if (inst.op.find(".LOAD") != std::string::npos) {
-      *inst.access_kind = init_access_kind(inst, inst_graph, visited, true);
+      // If access kind is not determined, allocate one
+      inst.access_kind = std::make_shared<AccessKind>();
+      std::set<unsigned int> visited;
+
+      // Associate access type with instruction
+      if (inst.has(INST_STORE)) {
+        *inst.access_kind = init_access_kind(inst, inst_graph, visited, false);
+      } else if (inst.has(INST_LOAD)) {
+        *inst.access_kind = init_access_kind(inst, inst_graph, visited, true);
+      }
+
+      default_access_kind(inst);
     }
+  }
+}
+
+bool InstructionParser::index(const char *begin, const char *end, SymbolVector &symbols,
+                              Vector<InstructionFunctionRange> &ranges) {
+  JsonReader reader(begin, end);
+
+  bool keyed = reader.peek() == '{';
+  if (keyed ? !reader.begin_object() : !reader.begin_array()) {
+    return false;
+  }
+  std::string_view function_key;
+  while (keyed ? reader.next_key(function_key) : reader.next_element()) {
+    int function_index = 0;
+    int cubin_offset = 0;
+    reader.peek();
+    auto *function_begin = reader.position();
+    if (!reader.begin_object()) {
+      return false;
+    }
+    // Only function headers are read, blocks are skipped without allocation
+    std::string_view key;
+    while (reader.next_key(key)) {
+      bool ok = true;
+      if (key == "index") {
+        ok = reader.read_int(function_index);
+      } else if (key == "address") {
+        ok = reader.read_int(cubin_offset);
+      } else {
+        ok = reader.skip_value();
+      }
+      if (!ok) {
+        return false;
+      }
+    }
+    if (reader.error() || function_index < 0) {
+      return false;
+    }
+
+    // Ensure space
+    symbols.resize(MAX2(symbols.size(), function_index + 1));
+    symbols[function_index] = Symbol(function_index, cubin_offset);
+    ranges.emplace_back(function_index, cubin_offset, function_begin - begin,
+                        reader.position() - begin);
+  }
+
+  return !reader.error() && reader.done();
+}
+
+bool InstructionParser::parse_function(const char *begin, const char *end,
+                                       InstructionGraph &inst_graph) {
+  JsonReader reader(begin, end);
 
-    default_access_kind(inst);
+  int function_index = 0;
+  int cubin_offset = 0;
+  std::vector<Instruction> insts;
+  if (!read_function(reader, function_index, cubin_offset, insts)) {
+    return false;
   }
 
+  for (auto &inst : insts) {
+    auto pc = inst.pc;
+    inst_graph.add_node(pc, std::move(inst));
+  }
+  analyze(inst_graph);
+
+  return true;
+}
+
+bool InstructionParser::parse(const std::string &file_path, SymbolVector &symbols,
+                              InstructionGraph &inst_graph) {
+  MappedFile file;
+  if (!file.open(file_path)) {
+    return false;
+  }
+
+  // Reuse the results of a previous run on the same .inst content
+  redshow_data_type_t default_data_type;
+  redshow_data_type_get(&default_data_type);
+  InstructionCacheKey cache_key(hash64(file.data(), file.size()), file.size(), default_data_type);
+  auto cache_path = file_path + ".cache";
+  if (InstructionCache::load(cache_path, cache_key, symbols, inst_graph)) {
+    return true;
+  }
+
+  JsonReader reader(file.begin(), file.end());
+
+#ifdef DEBUG_INSTRUCTION
+  // inst_pc-><symbol_index, inst_pc_offset>
+  std::map<int, std::pair<int, int>> pc_offsets;
+#endif
+
+  // Read instructions, functions are stored either in an array or in an object
+  bool keyed = reader.peek() == '{';
+  if (keyed ? !reader.begin_object() : !reader.begin_array()) {
+    return false;
+  }
+  std::vector<Instruction> insts;
+  Vector<Symbol> functions;
+  std::string_view function_key;
+  while (keyed ? reader.next_key(function_key) : reader.next_element()) {
+    int function_index = 0;
+    int cubin_offset = 0;
+    insts.clear();
+    if (!read_function(reader, function_index, cubin_offset, insts)) {
+      return false;
+    }
+
+    // Ensure space
+    symbols.resize(MAX2(symbols.size(), function_index + 1));
+    symbols[function_index] = Symbol(function_index, cubin_offset);
+    functions.push_back(symbols[function_index]);
+
+    for (auto &inst : insts) {
+#ifdef DEBUG_INSTRUCTION
+      pc_offsets[inst.pc] = std::make_pair(function_index, inst.pc - cubin_offset);
+#endif
+      auto pc = inst.pc;
+      inst_graph.add_node(pc, std::move(inst));
+    }
+  }
+  if (reader.error() || !reader.done()) {
+    return false;
+  }
+
+  analyze(inst_graph);
+
 #ifdef DEBUG_INSTRUCTION
   // Analyze memory instruction's access kind
-  for (auto iter = inst_graph.nodes_begin(); iter != inst_graph.nodes_end(); ++iter) {
-    auto &inst = iter->second;
-    if (inst.op.find("MEMORY") != std::string::npos) {
+  for (size_t pos = 0; pos < inst_graph.size(); ++pos) {
+    auto &inst = inst_graph.node_at(pos);
+    if (inst.has(INST_MEMORY)) {
       std::cout << "Func Index: " << pc_offsets[inst.pc].first << ", PC: " << std::hex
                 << pc_offsets[inst.pc].second << ", TYPE: " << inst.access_kind->to_string()
                 << std::dec << std::endl;
@@ -362,6 +615,9 @@ bool InstructionParser::parse(const std::string &file_path, SymbolVector &symbol
   }
 #endif
 
+  // The cache is an optimization, a read-only directory is fine
+  InstructionCache::store(cache_path, cache_key, functions, inst_graph);
+
   return true;
 }
 
@@ -395,46 +651,79 @@ u64 AccessKind::value_to_basic_type(u64 a, int decimal_degree_f32, int decimal_d
   return a;
 }
 
-std::string AccessKind::value_to_string(u64 a, bool is_signed) {
-  std::stringstream ss;
+u64 AccessKind::value_mask(int decimal_degree_f32, int decimal_degree_f64) const {
+  switch (data_type) {
+    case REDSHOW_DATA_INT:
+      switch (unit_size) {
+        case 8:
+          return 0xffu;
+        case 16:
+          return 0xffffu;
+        case 32:
+          return 0xffffffffu;
+      }
+      break;
+    case REDSHOW_DATA_FLOAT:
+      switch (unit_size) {
+        case 32:
+          return value_to_float(0xffffffffu, decimal_degree_f32);
+        case 64:
+          return value_to_double(0xffffffffffffffffu, decimal_degree_f64);
+      }
+      break;
+    default:
+      break;
+  }
+  return 0xffffffffffffffffu;
+}
+
+// Same text as printing a float with the default precision of std::ostream
+static std::string float_to_string(double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%g", value);
+  return std::string(buf);
+}
+
+std::string AccessKind::value_to_string(u64 a, bool is_signed) const {
   if (data_type == REDSHOW_DATA_INT) {
     if (unit_size == 8) {
       if (is_signed) {
         i8 b;
         memcpy(&b, &a, sizeof(b));
-        ss << (int)b;
+        return std::to_string((int)b);
       } else {
+        // Printed as a character
         u8 b;
         memcpy(&b, &a, sizeof(b));
-        ss << b;
+        return std::string(1, static_cast<char>(b));
       }
     } else if (unit_size == 16) {
       if (is_signed) {
         i16 b;
         memcpy(&b, &a, sizeof(b));
-        ss << b;
+        return std::to_string(b);
       } else {
         u16 b;
         memcpy(&b, &a, sizeof(b));
-        ss << b;
+        return std::to_string(b);
       }
     } else if (unit_size == 32) {
       if (is_signed) {
         i32 b;
         memcpy(&b, &a, sizeof(b));
-        ss << b;
+        return std::to_string(b);
       } else {
         u32 b;
         memcpy(&b, &a, sizeof(b));
-        ss << b;
+        return std::to_string(b);
       }
     } else if (unit_size == 64) {
       if (is_signed) {
         i64 b;
         memcpy(&b, &a, sizeof(b));
-        ss << b;
+        return std::to_string(b);
       } else {
-        ss << a;
+        return std::to_string(a);
       }
     }
   } else if (data_type == REDSHOW_DATA_FLOAT) {
@@ -442,15 +731,15 @@ std::string AccessKind::value_to_string(u64 a, bool is_signed) {
     if (unit_size == 32) {
       float b;
       memcpy(&b, &a, sizeof(b));
-      ss << b;
+      return float_to_string(b);
     } else if (unit_size == 64) {
       double b;
       memcpy(&b, &a, sizeof(b));
-      ss << b;
+      return float_to_string(b);
     }
   }
 
-  return ss.str();
+  return std::string();
 }
 
 }  // namespace redshow
@@ -0,0 +1,178 @@
+#include "binutils/instruction_cache.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#include "common/mapped_file.h"
+
+namespace redshow {
+
+const char InstructionCache::MAGIC[8] = {'R', 'S', 'I', 'N', 'S', 'T', 'C', '\0'};
+
+static inline size_t align8(size_t size) { return (size + 7) & ~static_cast<size_t>(7); }
+
+bool InstructionCache::load(const std::string &cache_path, const InstructionCacheKey &key,
+                            SymbolVector &symbols, InstructionGraph &inst_graph) {
+  MappedFile file;
+  if (!file.open(cache_path) || file.size() < sizeof(Header)) {
+    return false;
+  }
+
+  Header header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION ||
+      header.header_size != sizeof(Header) || header.content_hash != key.content_hash ||
+      header.content_size != key.content_size ||
+      header.default_data_type != static_cast<i32>(key.default_data_type)) {
+    return false;
+  }
+
+  // Validate section sizes before touching outputs
+  size_t symbols_offset = sizeof(Header);
+  size_t nodes_offset = symbols_offset + header.num_symbols * sizeof(Entry);
+  size_t edges_offset = nodes_offset + header.num_nodes * sizeof(Node);
+  size_t ops_offset = edges_offset + header.num_edges * sizeof(Edge);
+  if (header.num_symbols > file.size() || header.num_nodes > file.size() ||
+      header.num_edges > file.size() || header.ops_size > file.size() ||
+      ops_offset + header.ops_size > file.size()) {
+    return false;
+  }
+
+  auto *entries = reinterpret_cast<const Entry *>(file.data() + symbols_offset);
+  auto *nodes = reinterpret_cast<const Node *>(file.data() + nodes_offset);
+  auto *edges = reinterpret_cast<const Edge *>(file.data() + edges_offset);
+  auto *ops = file.data() + ops_offset;
+
+  for (size_t i = 0; i < header.num_symbols; ++i) {
+    if (entries[i].index >= MAX_SYMBOL_INDEX) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < header.num_nodes; ++i) {
+    if (static_cast<u64>(nodes[i].op_offset) + nodes[i].op_size > header.ops_size) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < header.num_symbols; ++i) {
+    auto index = entries[i].index;
+    // Ensure space
+    symbols.resize(MAX2(symbols.size(), index + 1));
+    symbols[index] = Symbol(index, entries[i].offset);
+  }
+
+  inst_graph.reserve(header.num_nodes, header.num_edges);
+  for (size_t i = 0; i < header.num_nodes; ++i) {
+    auto &node = nodes[i];
+    Instruction inst;
+    inst.set_op(std::string_view(ops + node.op_offset, node.op_size));
+    inst.pc = node.pc;
+    inst.predicate = node.predicate;
+    if (node.flags & NODE_ACCESS_KIND) {
+      inst.access_kind = std::make_shared<AccessKind>(
+          node.unit_size, node.vec_size, static_cast<redshow_data_type_t>(node.data_type));
+    }
+    inst_graph.add_node(node.pc, std::move(inst));
+  }
+
+  for (size_t i = 0; i < header.num_edges; ++i) {
+    auto edge_index = InstructionDependencyIndex(edges[i].from, edges[i].to);
+    inst_graph.add_edge(edge_index, (edges[i].flags & EDGE_INTER_FUNCTION) != 0);
+  }
+
+  // Input arrays are sorted, freeze is linear
+  inst_graph.freeze();
+
+  return true;
+}
+
+bool InstructionCache::store(const std::string &cache_path, const InstructionCacheKey &key,
+                             const Vector<Symbol> &functions,
+                             const InstructionGraph &inst_graph) {
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.header_size = sizeof(Header);
+  header.content_hash = key.content_hash;
+  header.content_size = key.content_size;
+  header.default_data_type = key.default_data_type;
+  header.num_symbols = functions.size();
+  header.num_nodes = inst_graph.size();
+  header.num_edges = inst_graph.edge_size();
+
+  Vector<Entry> entries(functions.size());
+  for (size_t i = 0; i < functions.size(); ++i) {
+    entries[i].index = functions[i].index;
+    entries[i].offset = functions[i].offset;
+  }
+
+  // <op, offset>
+  std::map<std::string, u32> op_offsets;
+  std::string ops;
+  Vector<Node> nodes(inst_graph.size());
+  for (size_t i = 0; i < inst_graph.size(); ++i) {
+    auto &inst = inst_graph.node_at(i);
+    auto &node = nodes[i];
+    memset(&node, 0, sizeof(node));
+
+    auto iter = op_offsets.find(inst.op);
+    if (iter == op_offsets.end()) {
+      iter = op_offsets.emplace(inst.op, ops.size()).first;
+      ops += inst.op;
+    }
+    node.pc = inst_graph.index_at(i);
+    node.op_offset = iter->second;
+    node.op_size = inst.op.size();
+    node.predicate = inst.predicate;
+    if (inst.access_kind.get() != NULL) {
+      node.flags |= NODE_ACCESS_KIND;
+      node.vec_size = inst.access_kind->vec_size;
+      node.unit_size = inst.access_kind->unit_size;
+      node.data_type = inst.access_kind->data_type;
+    }
+  }
+  header.ops_size = ops.size();
+  ops.resize(align8(ops.size()), '\0');
+
+  Vector<Edge> edges(inst_graph.edge_size());
+  for (size_t i = 0; i < inst_graph.edge_size(); ++i) {
+    auto &edge_index = inst_graph.edge_index_at(i);
+    edges[i].from = edge_index.from;
+    edges[i].to = edge_index.to;
+    edges[i].flags = inst_graph.edge_at(i).inter_function ? EDGE_INTER_FUNCTION : 0;
+  }
+
+  // Write to a private file and rename, concurrent processes never see a partial cache
+  auto tmp_path = cache_path + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream out(tmp_path, std::ofstream::binary | std::ofstream::trunc);
+    if (!out.good()) {
+      return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(Entry));
+    out.write(reinterpret_cast<const char *>(nodes.data()), nodes.size() * sizeof(Node));
+    out.write(reinterpret_cast<const char *>(edges.data()), edges.size() * sizeof(Edge));
+    out.write(ops.data(), ops.size());
+    if (!out.good()) {
+      out.close();
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+
+  if (std::rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace redshow
@@ -0,0 +1,68 @@
+#include "binutils/lazy_instruction_graph.h"
+
+namespace redshow {
+
+bool LazyInstructionGraph::open(const std::string &file_path, SymbolVector &symbols) {
+  if (!_file.open(file_path)) {
+    return false;
+  }
+
+  if (!InstructionParser::index(_file.begin(), _file.end(), symbols, _ranges)) {
+    _ranges.clear();
+    _file.close();
+    return false;
+  }
+
+  for (size_t i = 0; i < _ranges.size(); ++i) {
+    auto function_index = _ranges[i].function_index;
+    if (function_index >= _function_ranges.size()) {
+      _function_ranges.resize(function_index + 1, _NO_RANGE);
+    }
+    // The first definition wins, same as a full parse that keeps the first node of each pc
+    if (_function_ranges[function_index] == _NO_RANGE) {
+      _function_ranges[function_index] = i;
+    }
+  }
+
+  _graphs.reset(new std::atomic<const InstructionGraph *>[_ranges.size()]);
+  for (size_t i = 0; i < _ranges.size(); ++i) {
+    _graphs[i].store(NULL, std::memory_order_relaxed);
+  }
+
+  return true;
+}
+
+const InstructionGraph *LazyInstructionGraph::function_graph(u32 function_index) {
+  if (function_index >= _function_ranges.size() ||
+      _function_ranges[function_index] == _NO_RANGE) {
+    return NULL;
+  }
+
+  auto pos = _function_ranges[function_index];
+  auto *graph = _graphs[pos].load(std::memory_order_acquire);
+  if (graph != NULL) {
+    return graph;
+  }
+
+  std::lock_guard<std::mutex> guard(_lock);
+  // Another thread might have analyzed it
+  graph = _graphs[pos].load(std::memory_order_acquire);
+  if (graph == NULL) {
+    auto &range = _ranges[pos];
+    std::unique_ptr<InstructionGraph> function_graph(new InstructionGraph());
+    if (!InstructionParser::parse_function(_file.begin() + range.begin, _file.begin() + range.end,
+                                           *function_graph)) {
+      // Fall back to the default access kinds
+      function_graph.reset(new InstructionGraph());
+      function_graph->freeze();
+    }
+    graph = function_graph.get();
+    _owned_graphs.emplace_back(std::move(function_graph));
+    _graphs[pos].store(graph, std::memory_order_release);
+    _num_analyzed.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  return graph;
+}
+
+}  // namespace redshow
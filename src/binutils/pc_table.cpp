@@ -0,0 +1,65 @@
+#include "binutils/pc_table.h"
+
+#include <limits>
+
+namespace redshow {
+
+void PCTable::build(const SymbolVector &symbols, const InstructionGraph &inst_graph) {
+  _base = 0;
+  _entries.clear();
+
+  if (inst_graph.size() == 0) {
+    return;
+  }
+
+  // Symbols are sorted by pc, non-function symbols have pc 0
+  const Symbol *first = NULL;
+  for (auto &symbol : symbols) {
+    if (symbol.pc != 0) {
+      first = &symbol;
+      break;
+    }
+  }
+  if (first == NULL) {
+    return;
+  }
+
+  // pcs after the last symbol resolve to it, up to its last instruction
+  auto &last = symbols.back();
+  u64 end = last.pc + INST_SIZE;
+  auto last_offset = inst_graph.index_at(inst_graph.size() - 1);
+  if (last_offset >= last.offset) {
+    end = last.pc + (last_offset - last.offset) + INST_SIZE;
+  }
+
+  auto slots = (end - first->pc + INST_SIZE - 1) / INST_SIZE;
+  if (slots > _SPARSITY * (inst_graph.size() + symbols.size())) {
+    // Too sparse, fall back to the slow path
+    return;
+  }
+
+  _base = first->pc;
+  _entries.resize(slots);
+  for (size_t i = 0; i < slots; ++i) {
+    auto ret = symbols.transform_pc(_base + i * INST_SIZE);
+    if (!ret.has_value()) {
+      continue;
+    }
+    auto &entry = _entries[i];
+    entry.flags = PCTableEntry::VALID;
+    entry.function_index = ret.value().function_index;
+
+    auto pos = inst_graph.position(ret.value().cubin_offset);
+    if (pos != InstructionGraph::npos) {
+      auto &inst = inst_graph.node_at(pos);
+      if (inst.access_kind.get() != NULL) {
+        entry.flags |= PCTableEntry::ACCESS_KIND;
+        entry.vec_size = inst.access_kind->vec_size;
+        entry.unit_size = inst.access_kind->unit_size;
+        entry.data_type = inst.access_kind->data_type;
+      }
+    }
+  }
+}
+
+}  // namespace redshow
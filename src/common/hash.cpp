@@ -179,4 +179,37 @@ std::string sha256(void *input, unsigned int length) {
   return std::string(buf);
 }
 
+// Single lane variant of xxHash64
+static const u64 HASH64_PRIME1 = 0x9E3779B185EBCA87ULL;
+static const u64 HASH64_PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const u64 HASH64_PRIME3 = 0x165667B19E3779F9ULL;
+static const u64 HASH64_PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const u64 HASH64_PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline u64 rotl64(u64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+u64 hash64(const void *input, size_t length, u64 seed) {
+  auto *p = reinterpret_cast<const unsigned char *>(input);
+  auto *end = p + length;
+  u64 h = seed + HASH64_PRIME5 + length;
+
+  for (; p + 8 <= end; p += 8) {
+    u64 w;
+    memcpy(&w, p, sizeof(w));
+    w = rotl64(w * HASH64_PRIME2, 31) * HASH64_PRIME1;
+    h = rotl64(h ^ w, 27) * HASH64_PRIME1 + HASH64_PRIME4;
+  }
+  for (; p < end; ++p) {
+    h ^= (*p) * HASH64_PRIME5;
+    h = rotl64(h, 11) * HASH64_PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= HASH64_PRIME2;
+  h ^= h >> 29;
+  h *= HASH64_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
 }  // namespace redshow
@@ -0,0 +1,49 @@
+#include "common/mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace redshow {
+
+bool MappedFile::open(const std::string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    ::close(fd);
+    return false;
+  }
+
+  if (st.st_size != 0) {
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    // Files are scanned front to back
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    _data = reinterpret_cast<const char *>(addr);
+    _size = st.st_size;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+  return true;
+}
+
+void MappedFile::close() {
+  if (_data != NULL) {
+    munmap(const_cast<char *>(_data), _size);
+  }
+  _data = NULL;
+  _size = 0;
+}
+
+}  // namespace redshow
@@ -0,0 +1,123 @@
+#include "common/segment_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <iterator>
+
+namespace redshow {
+
+bool SegmentFile::open(const std::string &path) {
+  close();
+
+  _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (_fd == -1) {
+    return false;
+  }
+  // Space is released when the descriptor is closed
+  unlink(path.c_str());
+  return true;
+}
+
+void SegmentFile::close() {
+  if (_fd != -1) {
+    ::close(_fd);
+  }
+  _fd = -1;
+  _size = 0;
+  _free.clear();
+}
+
+void SegmentFile::allocate(u64 size, Segment &segment) {
+  // First fit among freed ranges
+  segment = Segment(_size, size);
+  for (auto iter = _free.begin(); iter != _free.end(); ++iter) {
+    if (iter->second >= size) {
+      segment.offset = iter->first;
+      if (iter->second > size) {
+        _free[iter->first + size] = iter->second - size;
+      }
+      _free.erase(iter);
+      break;
+    }
+  }
+  _size = MAX2(_size, segment.offset + size);
+}
+
+bool SegmentFile::write(const Segment &segment, u64 offset, const char *data, size_t size) {
+  if (_fd == -1 || offset + size > segment.size) {
+    return false;
+  }
+
+  size_t written = 0;
+  while (written < size) {
+    auto bytes = pwrite(_fd, data + written, size - written, segment.offset + offset + written);
+    if (bytes <= 0) {
+      return false;
+    }
+    written += bytes;
+  }
+  return true;
+}
+
+const char *SegmentFile::map(const Segment &segment) {
+  if (_fd == -1 || segment.size == 0) {
+    return NULL;
+  }
+
+  // Mappings start at page boundaries
+  u64 page_size = sysconf(_SC_PAGESIZE);
+  u64 start = segment.offset - segment.offset % page_size;
+  u64 length = segment.offset - start + segment.size;
+  void *addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, _fd, start);
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+  // Segments are decoded front to back
+  madvise(addr, length, MADV_SEQUENTIAL);
+  return reinterpret_cast<const char *>(addr) + (segment.offset - start);
+}
+
+void SegmentFile::unmap(const Segment &segment, const char *data) {
+  if (data == NULL) {
+    return;
+  }
+
+  u64 page_size = sysconf(_SC_PAGESIZE);
+  u64 start = segment.offset - segment.offset % page_size;
+  u64 length = segment.offset - start + segment.size;
+  munmap(const_cast<char *>(data) - (segment.offset - start), length);
+}
+
+void SegmentFile::free(const Segment &segment) {
+  if (segment.size == 0) {
+    return;
+  }
+
+  auto iter = _free.emplace(segment.offset, segment.size).first;
+  auto next = std::next(iter);
+  if (next != _free.end() && iter->first + iter->second == next->first) {
+    iter->second += next->second;
+    _free.erase(next);
+  }
+  if (iter != _free.begin()) {
+    auto prev = std::prev(iter);
+    if (prev->first + prev->second == iter->first) {
+      prev->second += iter->second;
+      _free.erase(iter);
+    }
+  }
+
+  // Give a free tail back to the file system
+  auto last = std::prev(_free.end());
+  if (last->first + last->second == _size) {
+    _size = last->first;
+    _free.erase(last);
+    if (ftruncate(_fd, _size) == -1) {
+      // Bytes past the end are overwritten by later writes
+    }
+  }
+}
+
+}  // namespace redshow
@@ -0,0 +1,42 @@
+#include "common/thread_pool.h"
+
+namespace redshow {
+
+ThreadPool::ThreadPool(size_t num_threads) : _stop(false) {
+  if (num_threads == 0) {
+    num_threads = 1;
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    _threads.emplace_back(&ThreadPool::run, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _stop = true;
+  }
+  _cond.notify_all();
+  for (auto &thread : _threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::run() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> guard(_lock);
+      _cond.wait(guard, [this]() { return _stop || !_tasks.empty(); });
+      if (_tasks.empty()) {
+        // Stopped and drained
+        return;
+      }
+      task = std::move(_tasks.front());
+      _tasks.pop();
+    }
+    task();
+  }
+}
+
+}  // namespace redshow
@@ -1,6 +1,8 @@
 #include <redshow.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
@@ -18,10 +20,14 @@
 #include "analysis/value_pattern.h"
 #include "binutils/cubin.h"
 #include "binutils/instruction.h"
+#include "binutils/lazy_instruction_graph.h"
 #include "binutils/real_pc.h"
 #include "binutils/symbol.h"
+#include "common/hash.h"
 #include "common/map.h"
+#include "common/mapped_file.h"
 #include "common/set.h"
+#include "common/thread_pool.h"
 #include "common/utils.h"
 #include "common/vector.h"
 #include "operation/kernel.h"
@@ -68,8 +74,111 @@ static int decimal_degree_f64 = VALID_DOUBLE_DIGITS;
 
 static redshow_data_type_t default_data_type = REDSHOW_DATA_UNKNOWN;
 
-static redshow_result_t analyze_cubin(const char *path, SymbolVector &symbols,
-                                      InstructionGraph &inst_graph) {
+static redshow_cubin_analysis_mode_t cubin_analysis_mode = REDSHOW_CUBIN_ANALYSIS_EAGER;
+
+static redshow_cubin_async_policy_t cubin_async_policy = REDSHOW_CUBIN_ASYNC_WAIT;
+
+static uint32_t cubin_async_workers = 0;
+
+static redshow_trace_order_t trace_order = REDSHOW_TRACE_ORDER_WARP;
+
+static redshow_sampling_mode_t sampling_mode = REDSHOW_SAMPLING_NONE;
+
+static uint32_t sampling_period = 1;
+
+static double sampling_tolerance = 0.01;
+
+static uint32_t sampling_stable_invocations = 3;
+
+static redshow_value_pattern_mode_t value_pattern_mode = REDSHOW_VALUE_PATTERN_FULL;
+
+static uint64_t value_pattern_max_items = 0;
+
+static uint64_t value_pattern_max_values = 0;
+
+static uint64_t trace_budget = 0;
+
+static std::string trace_budget_dir = "./";
+
+static uint64_t kernel_flush_idle_ops = 0;
+
+static redshow_output_format_t output_format = REDSHOW_OUTPUT_CSV;
+
+// Invocations of a kernel on a cpu thread, results of a kernel are kept per thread
+struct ThreadSampling {
+  // Invocations are told apart by host_op_id, a trace may arrive in several buffers and buffers
+  // of invocations on different cpu threads may interleave
+  uint64_t host_op_id;
+  bool sample;
+  uint64_t invocations;
+  uint64_t sampled;
+
+  // Adaptive mode
+  // <analysis, <count, total_count>> after the last analyzed invocation
+  Map<redshow_analysis_type_t, std::pair<uint64_t, uint64_t>> counts;
+
+  ThreadSampling() : host_op_id(0), sample(true), invocations(0), sampled(0) {}
+};
+
+struct KernelSampling {
+  // <cpu_thread, ThreadSampling>
+  Map<uint32_t, ThreadSampling> threads;
+
+  // Adaptive mode
+  // <analysis, rate of the last analyzed invocation>
+  Map<redshow_analysis_type_t, double> rates;
+  uint32_t stable;
+  uint64_t skipped;
+  bool converged;
+
+  KernelSampling() : stable(0), skipped(0), converged(false) {}
+};
+
+// <kernel_id, KernelSampling>
+static LockableMap<int32_t, KernelSampling> kernel_samplings;
+
+struct KernelRecency {
+  // <kernel_id, host_op_id of its last launch>
+  Map<int32_t, uint64_t> host_op_ids;
+  // <host_op_id, kernel_id>, the least recently launched kernel first
+  Set<std::pair<uint64_t, int32_t>> kernels;
+};
+
+// <cpu_thread, KernelRecency>
+static LockableMap<uint32_t, KernelRecency> kernel_recencies;
+
+// Created on the first async registration, destroyed before cubin_map
+static std::unique_ptr<ThreadPool> cubin_workers;
+
+static std::mutex cubin_workers_lock;
+
+static ThreadPool &cubin_worker_pool() {
+  std::lock_guard<std::mutex> guard(cubin_workers_lock);
+  if (cubin_workers.get() == NULL) {
+    uint32_t num_workers = cubin_async_workers;
+    if (num_workers == 0) {
+      num_workers = MIN2(4u, MAX2(1u, std::thread::hardware_concurrency()));
+    }
+    cubin_workers.reset(new ThreadPool(num_workers));
+  }
+  return *cubin_workers;
+}
+
+static std::shared_ptr<InstructionGraph> analyze_instructions(const std::string &inst_path) {
+  auto inst_graph = std::make_shared<InstructionGraph>();
+  SymbolVector symbols;
+  if (!InstructionParser::parse(inst_path, symbols, *inst_graph)) {
+    // Fall back to default access kinds
+    inst_graph = std::make_shared<InstructionGraph>();
+    inst_graph->freeze();
+  }
+  return inst_graph;
+}
+
+static redshow_result_t analyze_cubin(
+    const char *path, SymbolVector &symbols, std::shared_ptr<InstructionGraph> &inst_graph,
+    std::shared_ptr<LazyInstructionGraph> &lazy_inst_graph,
+    std::shared_future<std::shared_ptr<InstructionGraph>> &inst_graph_future) {
   redshow_result_t result = REDSHOW_SUCCESS;
 
   std::string cubin_path = std::string(path);
@@ -91,7 +200,29 @@ static redshow_result_t analyze_cubin(const char *path, SymbolVector &symbols,
       result = REDSHOW_ERROR_NO_SUCH_FILE;
     } else {
       // instructions are analyzed before hpcrun
-      if (InstructionParser::parse(inst_path, symbols, inst_graph)) {
+      if (cubin_analysis_mode == REDSHOW_CUBIN_ANALYSIS_LAZY) {
+        // Only index functions, they are analyzed in trace_analyze
+        lazy_inst_graph = std::make_shared<LazyInstructionGraph>();
+        if (lazy_inst_graph->open(inst_path, symbols)) {
+          result = REDSHOW_SUCCESS;
+        } else {
+          lazy_inst_graph.reset();
+          result = REDSHOW_ERROR_FAILED_ANALYZE_CUBIN;
+        }
+      } else if (cubin_analysis_mode == REDSHOW_CUBIN_ANALYSIS_ASYNC) {
+        // Symbols are needed right away, the graph is built by a worker
+        MappedFile inst_file;
+        Vector<InstructionFunctionRange> ranges;
+        if (inst_file.open(inst_path) &&
+            InstructionParser::index(inst_file.begin(), inst_file.end(), symbols, ranges)) {
+          inst_graph_future = cubin_worker_pool().submit([inst_path]() {
+            return analyze_instructions(inst_path);
+          }).share();
+          result = REDSHOW_SUCCESS;
+        } else {
+          result = REDSHOW_ERROR_FAILED_ANALYZE_CUBIN;
+        }
+      } else if (InstructionParser::parse(inst_path, symbols, *inst_graph)) {
         result = REDSHOW_SUCCESS;
       } else {
         result = REDSHOW_ERROR_FAILED_ANALYZE_CUBIN;
@@ -223,17 +354,281 @@ static redshow_result_t trace_analyze_address_analysis(int32_t kernel_id, Memory
   return result;
 }
 
-static redshow_result_t trace_analyze_default(int32_t kernel_id, InstructionGraph *inst_graph,
-                                              SymbolVector *symbols, MemoryMap *memory_map,
+// Whether the current invocation of a kernel is analyzed
+static bool trace_sample_kernel(uint32_t cpu_thread, int32_t kernel_id, uint64_t host_op_id) {
+  kernel_samplings.lock();
+  auto &sampling = kernel_samplings[kernel_id];
+  auto &thread_sampling = sampling.threads[cpu_thread];
+  if (thread_sampling.invocations == 0 || thread_sampling.host_op_id != host_op_id) {
+    thread_sampling.host_op_id = host_op_id;
+    switch (sampling_mode) {
+      case REDSHOW_SAMPLING_KERNEL:
+        thread_sampling.sample = thread_sampling.invocations % sampling_period == 0;
+        break;
+      case REDSHOW_SAMPLING_ADAPTIVE:
+        // Converged kernels are rechecked once every period invocations
+        thread_sampling.sample = !sampling.converged || ++sampling.skipped >= sampling_period;
+        if (thread_sampling.sample) {
+          sampling.skipped = 0;
+        }
+        break;
+      default:
+        thread_sampling.sample = true;
+        break;
+    }
+    thread_sampling.invocations++;
+    if (thread_sampling.sample) {
+      thread_sampling.sampled++;
+    }
+  }
+  auto sample = thread_sampling.sample;
+  kernel_samplings.unlock();
+
+  return sample;
+}
+
+// Compare the results of an analyzed invocation with the previous one in adaptive mode
+static void trace_sample_update(uint32_t cpu_thread, int32_t kernel_id, uint64_t host_op_id) {
+  if (sampling_mode != REDSHOW_SAMPLING_ADAPTIVE) {
+    return;
+  }
+
+  bool analyzed = false;
+  kernel_samplings.lock();
+  if (kernel_samplings.has(kernel_id) && kernel_samplings.at(kernel_id).threads.has(cpu_thread)) {
+    auto &thread_sampling = kernel_samplings.at(kernel_id).threads.at(cpu_thread);
+    analyzed = thread_sampling.host_op_id == host_op_id && thread_sampling.sample;
+  }
+  kernel_samplings.unlock();
+
+  if (!analyzed) {
+    return;
+  }
+
+  // Summaries walk the kernel's results, don't hold the lock
+  Map<redshow_analysis_type_t, std::pair<uint64_t, uint64_t>> counts;
+  for (auto aiter : analysis_enabled) {
+    uint64_t count = 0;
+    uint64_t total_count = 0;
+    if (aiter.second->kernel_summary(cpu_thread, kernel_id, count, total_count)) {
+      counts[aiter.first] = std::make_pair(count, total_count);
+    }
+  }
+
+  kernel_samplings.lock();
+  auto &sampling = kernel_samplings.at(kernel_id);
+  auto &thread_counts = sampling.threads.at(cpu_thread).counts;
+  bool stable = !counts.empty();
+  for (auto &iter : counts) {
+    auto analysis_type = iter.first;
+    auto last_counts = std::make_pair<uint64_t, uint64_t>(0, 0);
+    if (thread_counts.has(analysis_type)) {
+      last_counts = thread_counts.at(analysis_type);
+    }
+    if (iter.second.second <= last_counts.second) {
+      // No accesses in this invocation
+      continue;
+    }
+
+    // Rate of this invocation alone
+    double rate = (static_cast<double>(iter.second.first) - last_counts.first) /
+                  (iter.second.second - last_counts.second);
+    if (!sampling.rates.has(analysis_type) ||
+        std::abs(rate - sampling.rates.at(analysis_type)) > sampling_tolerance) {
+      stable = false;
+    }
+    sampling.rates[analysis_type] = rate;
+    thread_counts[analysis_type] = iter.second;
+  }
+  sampling.stable = stable ? sampling.stable + 1 : 0;
+  sampling.converged = sampling.stable >= sampling_stable_invocations;
+  kernel_samplings.unlock();
+}
+
+// Report the results of a kernel early and drop its trace
+static void trace_flush_kernel(uint32_t cpu_thread, int32_t kernel_id) {
+  for (auto aiter : analysis_enabled) {
+    aiter.second->flush_kernel(cpu_thread, kernel_id, output_dir[aiter.first], cubin_map,
+                               record_data_callback);
+  }
+
+  // Results of later launches on the thread start from zero
+  kernel_samplings.lock();
+  if (kernel_samplings.has(kernel_id) && kernel_samplings.at(kernel_id).threads.has(cpu_thread)) {
+    kernel_samplings.at(kernel_id).threads.at(cpu_thread).counts.clear();
+  }
+  kernel_samplings.unlock();
+}
+
+// Flush kernels that have not been launched by the thread in the last kernel_flush_idle_ops ops
+static void trace_flush_idle(uint32_t cpu_thread, int32_t kernel_id, uint64_t host_op_id) {
+  if (kernel_flush_idle_ops == 0) {
+    return;
+  }
+
+  kernel_recencies.lock();
+  auto &recency = kernel_recencies[cpu_thread];
+  kernel_recencies.unlock();
+
+  if (recency.host_op_ids.has(kernel_id)) {
+    recency.kernels.erase(std::make_pair(recency.host_op_ids.at(kernel_id), kernel_id));
+  }
+  recency.host_op_ids[kernel_id] = host_op_id;
+  recency.kernels.emplace(host_op_id, kernel_id);
+
+  Vector<int32_t> idle_kernel_ids;
+  while (!recency.kernels.empty()) {
+    auto iter = recency.kernels.begin();
+    if (iter->first + kernel_flush_idle_ops >= host_op_id) {
+      break;
+    }
+    idle_kernel_ids.push_back(iter->second);
+    recency.host_op_ids.erase(iter->second);
+    recency.kernels.erase(iter);
+  }
+
+  for (auto idle_kernel_id : idle_kernel_ids) {
+    trace_flush_kernel(cpu_thread, idle_kernel_id);
+  }
+}
+
+// Whether a memory access record is analyzed, index is its position in the dispatch order
+static inline bool trace_sample_record(const gpu_patch_record_t *record, size_t index) {
+  switch (sampling_mode) {
+    case REDSHOW_SAMPLING_RECORD:
+      return index % sampling_period == 0;
+    case REDSHOW_SAMPLING_WARP: {
+      uint64_t warp_id = (static_cast<uint64_t>(record->flat_block_id) << 32) |
+                         (record->flat_thread_id / GPU_PATCH_WARP_SIZE);
+      return hash_mix64(warp_id) % sampling_period == 0;
+    }
+    case REDSHOW_SAMPLING_BLOCK:
+      return hash_mix64(record->flat_block_id) % sampling_period == 0;
+    default:
+      return true;
+  }
+}
+
+// Extract unit m of every lane, inactive lanes included so that the loop has no branches
+template <typename T>
+static inline void trace_extract_units(const gpu_patch_record_t *record, size_t m, uint64_t mask,
+                                       uint64_t *values) {
+  for (size_t j = 0; j < GPU_PATCH_WARP_SIZE; ++j) {
+    T unit;
+    memcpy(&unit, &record->value[j][m * sizeof(T)], sizeof(T));
+    values[j] = static_cast<uint64_t>(unit) & mask;
+  }
+}
+
+// Canonicalize the units of all lanes as AccessKind::value_to_basic_type does,
+// values are <unit, lane>
+static void trace_extract_values(const gpu_patch_record_t *record, uint32_t unit_size,
+                                 size_t num_units, uint64_t mask,
+                                 uint64_t (*values)[GPU_PATCH_WARP_SIZE]) {
+  for (size_t m = 0; m < num_units; ++m) {
+    switch (unit_size) {
+      case 8:
+        trace_extract_units<uint8_t>(record, m, mask, values[m]);
+        break;
+      case 16:
+        trace_extract_units<uint16_t>(record, m, mask, values[m]);
+        break;
+      case 32:
+        trace_extract_units<uint32_t>(record, m, mask, values[m]);
+        break;
+      case 64:
+        trace_extract_units<uint64_t>(record, m, mask, values[m]);
+        break;
+      default: {
+        uint32_t byte_size = unit_size >> 3u;
+        for (size_t j = 0; j < GPU_PATCH_WARP_SIZE; ++j) {
+          uint64_t value = 0;
+          memcpy(&value, &record->value[j][m * byte_size], byte_size);
+          values[m][j] = value & mask;
+        }
+        break;
+      }
+    }
+  }
+}
+
+struct TraceOrderKey {
+  uint64_t pc;
+  uint64_t address;
+  uint32_t index;
+
+  bool operator<(const TraceOrderKey &other) const {
+    if (this->pc == other.pc) {
+      if (this->address == other.address) {
+        return this->index < other.index;
+      }
+      return this->address < other.address;
+    }
+    return this->pc < other.pc;
+  }
+};
+
+// Order records by (pc, address of the first active thread), memory objects are contiguous
+// address ranges so records of a pc are also grouped by memory object
+static void trace_order_records(const gpu_patch_record_t *records, size_t size,
+                                Vector<uint32_t> &order) {
+  Vector<TraceOrderKey> keys;
+  keys.reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    auto *record = records + i;
+    if (record->size == 0) {
+      // Fast path, no thread active
+      continue;
+    }
+    uint64_t address = 0;
+    if (record->active != 0) {
+      address = record->address[__builtin_ctz(record->active)];
+    }
+    keys.push_back(TraceOrderKey{record->pc, address, static_cast<uint32_t>(i)});
+  }
+
+  std::sort(keys.begin(), keys.end());
+
+  order.resize(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    order[i] = keys[i].index;
+  }
+}
+
+static redshow_result_t trace_analyze_default(int32_t kernel_id,
+                                              const InstructionGraph *inst_graph,
+                                              LazyInstructionGraph *lazy_inst_graph,
+                                              const PCTable *pc_table, SymbolVector *symbols,
+                                              MemoryMap *memory_map,
                                               gpu_patch_buffer_t *trace_data) {
   redshow_result_t result = REDSHOW_SUCCESS;
 
+  // In lazy mode, the graph of the function seen by the last record
+  const InstructionGraph *function_graph = inst_graph;
+  uint32_t function_index = std::numeric_limits<uint32_t>::max();
+  // Records the pc table could not answer
+  RealPCCache real_pc_cache(*symbols);
+  uint64_t pc_table_hits = 0;
+
   size_t size = trace_data->head_index;
   gpu_patch_record_t *records = reinterpret_cast<gpu_patch_record_t *>(trace_data->records);
 
+  // <position, record index>, empty in warp order
+  Vector<uint32_t> order;
+  if (trace_order == REDSHOW_TRACE_ORDER_PC) {
+    bool order_sensitive = false;
+    for (auto aiter : analysis_enabled) {
+      order_sensitive |= aiter.second->order_sensitive();
+    }
+    if (!order_sensitive) {
+      trace_order_records(records, size, order);
+      size = order.size();
+    }
+  }
+
   for (size_t i = 0; i < size; ++i) {
     // Iterate over each record
-    gpu_patch_record_t *record = records + i;
+    gpu_patch_record_t *record = records + (order.empty() ? i : order[i]);
 
     if (record->size == 0) {
       // Fast path, no thread active
@@ -254,27 +649,47 @@ static redshow_result_t trace_analyze_default(int32_t kernel_id, InstructionGrap
           }
         }
       }
+    } else if (!trace_sample_record(record, i)) {
+      // Not sampled
     } else {
-      RealPC real_pc;
+      // record->size * 8, byte to bits
+      AccessKind access_kind;
 
-      auto ret = symbols->transform_pc(record->pc);
-      if (ret.has_value()) {
-        real_pc = ret.value();
+      const PCTableEntry *entry = pc_table != NULL ? pc_table->lookup(record->pc) : NULL;
+      if (entry != NULL) {
+        // Fast path, the pc has been resolved when the table was built
+        ++pc_table_hits;
+        if (entry->has_access_kind()) {
+          access_kind = entry->access_kind();
+        }
       } else {
-        result = REDSHOW_ERROR_FAILED_ANALYZE_CUBIN;
-        return result;
-      }
+        RealPC real_pc;
 
-      // record->size * 8, byte to bits
-      AccessKind access_kind;
+        auto ret = real_pc_cache.transform_pc(record->pc);
+        if (ret.has_value()) {
+          real_pc = ret.value();
+        } else {
+          result = REDSHOW_ERROR_FAILED_ANALYZE_CUBIN;
+          return result;
+        }
 
-      if (inst_graph->size() != 0) {
-        // Accurate mode, when we have instruction information
-        auto &inst = inst_graph->node(real_pc.cubin_offset);
-        if (inst.access_kind.get() != NULL) {
-          access_kind = *inst.access_kind;
+        if (lazy_inst_graph != NULL && real_pc.function_index != function_index) {
+          // Analyze the function on first use
+          function_index = real_pc.function_index;
+          function_graph = lazy_inst_graph->function_graph(function_index);
+        }
+
+        if (function_graph != NULL && function_graph->size() != 0) {
+          // Accurate mode, when we have instruction information
+          auto pos = function_graph->position(real_pc.cubin_offset);
+          if (pos != InstructionGraph::npos) {
+            auto &inst = function_graph->node_at(pos);
+            if (inst.access_kind.get() != NULL) {
+              access_kind = *inst.access_kind;
+            }
+          }
+          // Fall back to default mode if failed
         }
-        // Fall back to default mode if failed
       }
 
       if (access_kind.data_type == REDSHOW_DATA_UNKNOWN) {
@@ -289,7 +704,20 @@ static redshow_result_t trace_analyze_default(int32_t kernel_id, InstructionGrap
       // Reserved for debugging
       // std::cout << "function_index: " << real_pc.function_index << ", pc_offset: " <<
       //  real_pc.pc_offset << ", " << access_kind.to_string() << std::endl;
-      // TODO: accelerate by handling all threads in a warp together
+      // Units never span beyond a lane's value bytes
+      auto num_units = MIN2(access_kind.vec_size / access_kind.unit_size,
+                            MAX_ACCESS_SIZE * 8 / access_kind.unit_size);
+      AccessKind unit_access_kind = access_kind;
+      // We iterate through all the units such that every unit's vec_size = unit_size
+      unit_access_kind.vec_size = unit_access_kind.unit_size;
+
+      // The 7th digit in float number's decimal part is partial valid, so we set the deault
+      // approx level to REDSHOW_APPROX_MIN.
+      uint64_t value_mask = unit_access_kind.value_mask(decimal_degree_f32, decimal_degree_f64);
+      // <unit, lane>
+      uint64_t values[MAX_ACCESS_SIZE][GPU_PATCH_WARP_SIZE];
+      trace_extract_values(record, unit_access_kind.unit_size, num_units, value_mask, values);
+
       for (size_t j = 0; j < GPU_PATCH_WARP_SIZE; ++j) {
         if ((record->active & (0x1u << j)) == 0) {
           continue;
@@ -343,19 +771,9 @@ static redshow_result_t trace_analyze_default(int32_t kernel_id, InstructionGrap
         }
 
         Memory memory = Memory(memory_op_id, memory_id, memory_addr, memory_size);
-        auto num_units = access_kind.vec_size / access_kind.unit_size;
-        AccessKind unit_access_kind = access_kind;
-        // We iterate through all the units such that every unit's vec_size = unit_size
-        unit_access_kind.vec_size = unit_access_kind.unit_size;
 
         for (size_t m = 0; m < num_units; m++) {
-          uint64_t value = 0;
-          uint32_t byte_size = unit_access_kind.unit_size >> 3u;
-          memcpy(&value, &record->value[j][m * byte_size], byte_size);
-          // The 7th digit in float number's decimal part is partial valid, so we set the deault
-          // approx level to REDSHOW_APPROX_MIN.
-          value =
-              unit_access_kind.value_to_basic_type(value, decimal_degree_f32, decimal_degree_f64);
+          uint64_t value = values[m][j];
 
           // Reserved for debug
           // std::cout << "thread: " << j << ", value: " << value << std::endl;
@@ -370,6 +788,9 @@ static redshow_result_t trace_analyze_default(int32_t kernel_id, InstructionGrap
     }
   }
 
+  PRINT("\nredshow-> pc table hits: %lu, pc cache hits: %lu, pc cache misses: %lu\n",
+        pc_table_hits, real_pc_cache.hits(), real_pc_cache.misses());
+
   return result;
 }
 
@@ -378,8 +799,15 @@ static redshow_result_t trace_analyze(uint32_t cpu_thread, uint32_t cubin_id, ui
                                       gpu_patch_buffer_t *trace_data) {
   redshow_result_t result = REDSHOW_SUCCESS;
 
+  if (!trace_sample_kernel(cpu_thread, kernel_id, host_op_id)) {
+    // Skip this invocation
+    return result;
+  }
+
   SymbolVector *symbols = NULL;
-  InstructionGraph *inst_graph = NULL;
+  std::shared_ptr<InstructionGraph> inst_graph;
+  std::shared_ptr<LazyInstructionGraph> lazy_inst_graph;
+  std::shared_future<std::shared_ptr<InstructionGraph>> inst_graph_future;
   // Cubin path is added just for debugging purpose
   std::string cubin_path;
 
@@ -388,7 +816,9 @@ static redshow_result_t trace_analyze(uint32_t cpu_thread, uint32_t cubin_id, ui
     result = REDSHOW_ERROR_NOT_EXIST_ENTRY;
   } else {
     symbols = &(cubin_map.at(cubin_id).symbols.at(mod_id));
-    inst_graph = &(cubin_map.at(cubin_id).inst_graph);
+    inst_graph = cubin_map.at(cubin_id).inst_graph;
+    lazy_inst_graph = cubin_map.at(cubin_id).lazy_inst_graph;
+    inst_graph_future = cubin_map.at(cubin_id).inst_graph_future;
     cubin_path = cubin_map.at(cubin_id).path;
   }
   cubin_map.unlock();
@@ -431,7 +861,9 @@ static redshow_result_t trace_analyze(uint32_t cpu_thread, uint32_t cubin_id, ui
         } else {
           result = REDSHOW_SUCCESS;
           symbols = &(cubin.symbols.at(mod_id));
-          inst_graph = &(cubin.inst_graph);
+          inst_graph = cubin.inst_graph;
+          lazy_inst_graph = cubin.lazy_inst_graph;
+          inst_graph_future = cubin.inst_graph_future;
           cubin_path = cubin.path;
         }
       }
@@ -443,6 +875,48 @@ static redshow_result_t trace_analyze(uint32_t cpu_thread, uint32_t cubin_id, ui
     return result;
   }
 
+  if (inst_graph.get() == NULL && inst_graph_future.valid()) {
+    // Async mode, the graph is not published yet
+    if (cubin_async_policy == REDSHOW_CUBIN_ASYNC_WAIT ||
+        inst_graph_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      inst_graph = inst_graph_future.get();
+
+      cubin_map.lock();
+      if (cubin_map.has(cubin_id)) {
+        cubin_map.at(cubin_id).inst_graph = inst_graph;
+      }
+      cubin_map.unlock();
+    }
+    // Otherwise fall back to default access kinds for this trace
+  }
+
+  std::shared_ptr<PCTable> pc_table;
+  if (inst_graph.get() != NULL && inst_graph->size() != 0) {
+    cubin_map.lock();
+    if (cubin_map.has(cubin_id) && cubin_map.at(cubin_id).pc_tables.has(mod_id)) {
+      pc_table = cubin_map.at(cubin_id).pc_tables.at(mod_id);
+    }
+    cubin_map.unlock();
+
+    if (pc_table.get() == NULL) {
+      // Build outside the lock, the first table inserted wins
+      auto new_table = std::make_shared<PCTable>();
+      new_table->build(*symbols, *inst_graph);
+
+      cubin_map.lock();
+      if (cubin_map.has(cubin_id)) {
+        auto &pc_tables = cubin_map.at(cubin_id).pc_tables;
+        if (!pc_tables.has(mod_id)) {
+          pc_tables[mod_id] = new_table;
+        }
+        pc_table = pc_tables.at(mod_id);
+      } else {
+        pc_table = new_table;
+      }
+      cubin_map.unlock();
+    }
+  }
+
   MemoryMap *memory_map = NULL;
 
   memory_snapshot.lock();
@@ -460,12 +934,14 @@ static redshow_result_t trace_analyze(uint32_t cpu_thread, uint32_t cubin_id, ui
   }
 
   for (auto aiter : analysis_enabled) {
+    aiter.second->trace_begin(cpu_thread, kernel_id);
     aiter.second->analysis_begin(cpu_thread, kernel_id, cubin_id, mod_id,
                                  static_cast<GPUPatchType>(trace_data->type));
   }
 
   if (trace_data->type == GPU_PATCH_TYPE_DEFAULT) {
-    result = trace_analyze_default(kernel_id, inst_graph, symbols, memory_map, trace_data);
+    result = trace_analyze_default(kernel_id, inst_graph.get(), lazy_inst_graph.get(),
+                                   pc_table.get(), symbols, memory_map, trace_data);
   } else if (trace_data->type == GPU_PATCH_TYPE_ADDRESS_PATCH) {
     result = trace_analyze_address_patch(kernel_id, memory_map, trace_data);
   } else if (trace_data->type == GPU_PATCH_TYPE_ADDRESS_ANALYSIS) {
@@ -474,6 +950,7 @@ static redshow_result_t trace_analyze(uint32_t cpu_thread, uint32_t cubin_id, ui
 
   for (auto aiter : analysis_enabled) {
     aiter.second->analysis_end(cpu_thread, kernel_id);
+    aiter.second->trace_end(cpu_thread, kernel_id);
   }
 
   return result;
@@ -625,6 +1102,252 @@ redshow_result_t redshow_analysis_config(redshow_analysis_type_t analysis_type,
   return REDSHOW_SUCCESS;
 }
 
+redshow_result_t redshow_cubin_analysis_mode_config(redshow_cubin_analysis_mode_t mode) {
+  PRINT("\nredshow-> Enter redshow_cubin_analysis_mode_config\nmode: %u\n", mode);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  switch (mode) {
+    case REDSHOW_CUBIN_ANALYSIS_EAGER:
+    case REDSHOW_CUBIN_ANALYSIS_LAZY:
+    case REDSHOW_CUBIN_ANALYSIS_ASYNC:
+      cubin_analysis_mode = mode;
+      break;
+    default:
+      result = REDSHOW_ERROR_NOT_IMPL;
+      break;
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_cubin_async_config(redshow_cubin_async_policy_t policy,
+                                            uint32_t num_workers) {
+  PRINT("\nredshow-> Enter redshow_cubin_async_config\npolicy: %u\nnum_workers: %u\n", policy,
+        num_workers);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  switch (policy) {
+    case REDSHOW_CUBIN_ASYNC_WAIT:
+    case REDSHOW_CUBIN_ASYNC_FALLBACK:
+      cubin_async_policy = policy;
+      cubin_async_workers = num_workers;
+      break;
+    default:
+      result = REDSHOW_ERROR_NOT_IMPL;
+      break;
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_trace_order_config(redshow_trace_order_t order) {
+  PRINT("\nredshow-> Enter redshow_trace_order_config\norder: %u\n", order);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  switch (order) {
+    case REDSHOW_TRACE_ORDER_WARP:
+    case REDSHOW_TRACE_ORDER_PC:
+      trace_order = order;
+      break;
+    default:
+      result = REDSHOW_ERROR_NOT_IMPL;
+      break;
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_sampling_config(redshow_sampling_mode_t mode, uint32_t period) {
+  PRINT("\nredshow-> Enter redshow_sampling_config\nmode: %u\nperiod: %u\n", mode, period);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  if (period == 0) {
+    return REDSHOW_ERROR_NOT_IMPL;
+  }
+
+  switch (mode) {
+    case REDSHOW_SAMPLING_NONE:
+    case REDSHOW_SAMPLING_RECORD:
+    case REDSHOW_SAMPLING_WARP:
+    case REDSHOW_SAMPLING_BLOCK:
+    case REDSHOW_SAMPLING_KERNEL:
+    case REDSHOW_SAMPLING_ADAPTIVE:
+      sampling_mode = mode;
+      sampling_period = mode == REDSHOW_SAMPLING_NONE ? 1 : period;
+      break;
+    default:
+      result = REDSHOW_ERROR_NOT_IMPL;
+      break;
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_sampling_get(redshow_sampling_mode_t *mode, uint32_t *period) {
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  *mode = sampling_mode;
+  *period = sampling_period;
+
+  return result;
+}
+
+redshow_result_t redshow_sampling_adaptive_config(double tolerance,
+                                                  uint32_t stable_invocations) {
+  PRINT("\nredshow-> Enter redshow_sampling_adaptive_config\ntolerance: %f\n"
+        "stable_invocations: %u\n",
+        tolerance, stable_invocations);
+
+  if (tolerance < 0.0 || stable_invocations == 0) {
+    return REDSHOW_ERROR_NOT_IMPL;
+  }
+
+  sampling_tolerance = tolerance;
+  sampling_stable_invocations = stable_invocations;
+
+  return REDSHOW_SUCCESS;
+}
+
+redshow_result_t redshow_sampling_scale_get(uint32_t cpu_thread, int32_t kernel_id,
+                                            double *scale) {
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  *scale = 1.0;
+  if (sampling_mode == REDSHOW_SAMPLING_KERNEL || sampling_mode == REDSHOW_SAMPLING_ADAPTIVE) {
+    kernel_samplings.lock();
+    if (kernel_samplings.has(kernel_id) && kernel_samplings.at(kernel_id).threads.has(cpu_thread)) {
+      auto &thread_sampling = kernel_samplings.at(kernel_id).threads.at(cpu_thread);
+      if (thread_sampling.sampled != 0) {
+        *scale = static_cast<double>(thread_sampling.invocations) / thread_sampling.sampled;
+      }
+    } else {
+      result = REDSHOW_ERROR_NOT_EXIST_ENTRY;
+    }
+    kernel_samplings.unlock();
+  } else if (sampling_mode != REDSHOW_SAMPLING_NONE) {
+    *scale = sampling_period;
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_value_pattern_mode_config(redshow_value_pattern_mode_t mode) {
+  PRINT("\nredshow-> Enter redshow_value_pattern_mode_config\nmode: %u\n", mode);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  switch (mode) {
+    case REDSHOW_VALUE_PATTERN_FULL:
+    case REDSHOW_VALUE_PATTERN_ONLINE:
+      value_pattern_mode = mode;
+      break;
+    default:
+      result = REDSHOW_ERROR_NOT_IMPL;
+      break;
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_value_pattern_mode_get(redshow_value_pattern_mode_t *mode) {
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  *mode = value_pattern_mode;
+
+  return result;
+}
+
+redshow_result_t redshow_value_pattern_limit_config(uint64_t max_items, uint64_t max_values) {
+  PRINT("\nredshow-> Enter redshow_value_pattern_limit_config\nmax_items: %lu\nmax_values: %lu\n",
+        max_items, max_values);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  value_pattern_max_items = max_items;
+  value_pattern_max_values = max_values;
+
+  return result;
+}
+
+redshow_result_t redshow_value_pattern_limit_get(uint64_t *max_items, uint64_t *max_values) {
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  *max_items = value_pattern_max_items;
+  *max_values = value_pattern_max_values;
+
+  return result;
+}
+
+redshow_result_t redshow_trace_budget_config(uint64_t budget, const char *dir) {
+  PRINT("\nredshow-> Enter redshow_trace_budget_config\nbudget: %lu\ndir: %s\n", budget, dir);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  trace_budget = budget;
+  if (dir) {
+    trace_budget_dir = std::string(dir);
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_trace_budget_get(uint64_t *budget, const char **dir) {
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  *budget = trace_budget;
+  *dir = trace_budget_dir.c_str();
+
+  return result;
+}
+
+redshow_result_t redshow_kernel_flush_config(uint64_t idle_ops) {
+  PRINT("\nredshow-> Enter redshow_kernel_flush_config\nidle_ops: %lu\n", idle_ops);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  kernel_flush_idle_ops = idle_ops;
+
+  return result;
+}
+
+redshow_result_t redshow_kernel_flush_get(uint64_t *idle_ops) {
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  *idle_ops = kernel_flush_idle_ops;
+
+  return result;
+}
+
+redshow_result_t redshow_output_format_config(redshow_output_format_t format) {
+  PRINT("\nredshow-> Enter redshow_output_format_config\nformat: %u\n", format);
+
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  switch (format) {
+    case REDSHOW_OUTPUT_CSV:
+    case REDSHOW_OUTPUT_BINARY:
+      output_format = format;
+      break;
+    default:
+      result = REDSHOW_ERROR_NOT_IMPL;
+      break;
+  }
+
+  return result;
+}
+
+redshow_result_t redshow_output_format_get(redshow_output_format_t *format) {
+  redshow_result_t result = REDSHOW_SUCCESS;
+
+  *format = output_format;
+
+  return result;
+}
+
 redshow_result_t redshow_cubin_register(uint32_t cubin_id, uint32_t mod_id, uint32_t nsymbols,
                                         const uint64_t *symbol_pcs, const char *path) {
   PRINT("\nredshow-> Enter redshow_cubin_register\ncubin_id: %u\nmode_id: %u\npath: %s\n", cubin_id,
@@ -632,9 +1355,14 @@ redshow_result_t redshow_cubin_register(uint32_t cubin_id, uint32_t mod_id, uint
 
   redshow_result_t result = REDSHOW_SUCCESS;
 
-  InstructionGraph inst_graph;
+  std::shared_ptr<InstructionGraph> inst_graph;
+  std::shared_ptr<LazyInstructionGraph> lazy_inst_graph;
+  std::shared_future<std::shared_ptr<InstructionGraph>> inst_graph_future;
   SymbolVector symbols(nsymbols);
-  result = analyze_cubin(path, symbols, inst_graph);
+  if (cubin_analysis_mode == REDSHOW_CUBIN_ANALYSIS_EAGER) {
+    inst_graph = std::make_shared<InstructionGraph>();
+  }
+  result = analyze_cubin(path, symbols, inst_graph, lazy_inst_graph, inst_graph_future);
 
   if (result == REDSHOW_SUCCESS || result == REDSHOW_ERROR_NO_SUCH_FILE) {
     // We must have found an instruction file, no matter nvdisasm failed or not
@@ -651,7 +1379,10 @@ redshow_result_t redshow_cubin_register(uint32_t cubin_id, uint32_t mod_id, uint
     if (!cubin_map.has(cubin_id)) {
       cubin_map[cubin_id].cubin_id = cubin_id;
       cubin_map[cubin_id].path = path;
-      cubin_map[cubin_id].inst_graph = inst_graph;
+      // Graphs are shared, not copied
+      cubin_map[cubin_id].inst_graph = std::move(inst_graph);
+      cubin_map[cubin_id].lazy_inst_graph = std::move(lazy_inst_graph);
+      cubin_map[cubin_id].inst_graph_future = std::move(inst_graph_future);
       result = REDSHOW_SUCCESS;
     } else if (cubin_map[cubin_id].symbols.find(mod_id) == cubin_map[cubin_id].symbols.end()) {
       result = REDSHOW_SUCCESS;
@@ -710,6 +1441,7 @@ redshow_result_t redshow_cubin_unregister(uint32_t cubin_id, uint32_t mod_id) {
   cubin_map.lock();
   if (cubin_map.has(cubin_id)) {
     cubin_map.at(cubin_id).symbols.erase(mod_id);
+    cubin_map.at(cubin_id).pc_tables.erase(mod_id);
     if (cubin_map.at(cubin_id).symbols.size() == 0) {
       cubin_map.erase(cubin_id);
     }
@@ -998,6 +1730,10 @@ redshow_result_t redshow_kernel_end(uint32_t cpu_thread, int32_t kernel_id, uint
     aiter.second->op_callback(kernel);
   }
 
+  trace_sample_update(cpu_thread, kernel_id, host_op_id);
+
+  trace_flush_idle(cpu_thread, kernel_id, host_op_id);
+
   return REDSHOW_SUCCESS;
 }
 
@@ -1075,6 +1811,25 @@ redshow_result_t redshow_analysis_end() {
   return result;
 }
 
+redshow_result_t redshow_flush_kernel(uint32_t cpu_thread, int32_t kernel_id) {
+  PRINT("\nredshow-> Enter redshow_flush_kernel cpu_thread %u kernel_id %d\n", cpu_thread,
+        kernel_id);
+
+  kernel_recencies.lock();
+  if (kernel_recencies.has(cpu_thread)) {
+    auto &recency = kernel_recencies.at(cpu_thread);
+    if (recency.host_op_ids.has(kernel_id)) {
+      recency.kernels.erase(std::make_pair(recency.host_op_ids.at(kernel_id), kernel_id));
+      recency.host_op_ids.erase(kernel_id);
+    }
+  }
+  kernel_recencies.unlock();
+
+  trace_flush_kernel(cpu_thread, kernel_id);
+
+  return REDSHOW_SUCCESS;
+}
+
 redshow_result_t redshow_flush_thread(uint32_t cpu_thread) {
   PRINT("\nredshow-> Enter redshow_flush cpu_thread %u\n", cpu_thread);
 
@@ -1083,6 +1838,10 @@ redshow_result_t redshow_flush_thread(uint32_t cpu_thread) {
                                record_data_callback);
   }
 
+  kernel_recencies.lock();
+  kernel_recencies.erase(cpu_thread);
+  kernel_recencies.unlock();
+
   return REDSHOW_SUCCESS;
 }
 
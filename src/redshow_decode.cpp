@@ -0,0 +1,132 @@
+#include <cstring>
+#include <iostream>
+
+#include "analysis/record_file.h"
+
+// Print a block as CSV, access kinds are expanded and values are typed by them
+void output_records(const redshow::RecordReader &reader, const redshow::RecordTable &table,
+                    const std::string &records, uint64_t count) {
+  const redshow::RecordField *access_kind_field = NULL;
+  for (auto &field : table.fields) {
+    if (field.type == redshow::RECORD_FIELD_ACCESS_KIND) {
+      access_kind_field = &field;
+      break;
+    }
+  }
+
+  for (uint64_t i = 0; i < count; ++i) {
+    const char *record = records.data() + i * table.size;
+    redshow::AccessKind access_kind;
+    if (access_kind_field != NULL) {
+      uint32_t id = 0;
+      memcpy(&id, record + access_kind_field->offset, sizeof(id));
+      access_kind = reader.access_kind(id);
+    }
+
+    bool first = true;
+    for (auto &field : table.fields) {
+      if (!first) {
+        std::cout << ",";
+      }
+      first = false;
+
+      const char *data = record + field.offset;
+      switch (field.type) {
+        case redshow::RECORD_FIELD_U8: {
+          uint8_t value;
+          memcpy(&value, data, sizeof(value));
+          std::cout << static_cast<uint32_t>(value);
+          break;
+        }
+        case redshow::RECORD_FIELD_U32: {
+          uint32_t value;
+          memcpy(&value, data, sizeof(value));
+          std::cout << value;
+          break;
+        }
+        case redshow::RECORD_FIELD_I32: {
+          int32_t value;
+          memcpy(&value, data, sizeof(value));
+          std::cout << value;
+          break;
+        }
+        case redshow::RECORD_FIELD_U64: {
+          uint64_t value;
+          memcpy(&value, data, sizeof(value));
+          std::cout << value;
+          break;
+        }
+        case redshow::RECORD_FIELD_F64: {
+          double value;
+          memcpy(&value, data, sizeof(value));
+          std::cout << value;
+          break;
+        }
+        case redshow::RECORD_FIELD_ACCESS_KIND:
+          std::cout << access_kind.to_string();
+          break;
+        case redshow::RECORD_FIELD_VALUE: {
+          uint64_t value;
+          memcpy(&value, data, sizeof(value));
+          std::cout << access_kind.value_to_string(value, true);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+    std::cout << '\n';
+  }
+}
+
+void output_header(const redshow::RecordTable &table) {
+  std::cout << table.name << '\n';
+  bool first = true;
+  for (auto &field : table.fields) {
+    if (!first) {
+      std::cout << ",";
+    }
+    first = false;
+
+    if (field.type == redshow::RECORD_FIELD_ACCESS_KIND) {
+      std::cout << "data_type,vector_size,unit_size";
+    } else {
+      std::cout << field.name;
+    }
+  }
+  std::cout << '\n';
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    std::cerr << "./redshow_decode /path/to/result/file.bin" << std::endl;
+    exit(-1);
+  }
+
+  redshow::RecordReader reader;
+  if (!reader.open(argv[1])) {
+    std::cerr << "Not a redshow binary result file: " << argv[1] << std::endl;
+    exit(-1);
+  }
+
+  std::cout << "analysis," << reader.name() << '\n';
+
+  // Tables are printed as CSV, with a header whenever the table changes
+  uint32_t table = 0;
+  uint64_t count = 0;
+  std::string records;
+  uint32_t last_table = redshow::RECORD_TABLE_ACCESS_KIND;
+  while (reader.next(table, count, records)) {
+    if (table == redshow::RECORD_TABLE_ACCESS_KIND) {
+      continue;
+    }
+    auto &record_table = reader.tables()[table];
+    if (table != last_table) {
+      output_header(record_table);
+      last_table = table;
+    }
+    output_records(reader, record_table, records, count);
+  }
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "binutils/instruction.h"
+#include "binutils/symbol.h"
+
+// Opcodes seen in real .inst files, memory instructions are dense to stress access kind inference
+static const char *OPS[] = {
+    "INTEGER.IMAD.MOVE",      "FLOAT.FADD.32",        "FLOAT.DADD.64",
+    "MEMORY.LOAD.GLOBAL.64",  "MEMORY.STORE.GLOBAL.32", "MEMORY.LOAD.GLOBAL.128",
+    "CONVERT.I2F",            "CONVERT.F2I.64",       "MEMORY.LOAD.SHARED.32",
+    "MEMORY.STORE.SHARED",    "INTEGER.IADD",         "UNIFORM.UMOV",
+    "CONVERT._64_TO_32",      "MEMORY.LOAD.LOCAL.16", "MEMORY.STORE.GLOBAL.64",
+    "CONTROL.BRA",            "INTEGER.LOP3",         "FLOAT.FFMA",
+    "MEMORY.LOAD.GLOBAL.8",   "MOVE.MOV"};
+
+static const size_t NUM_OPS = sizeof(OPS) / sizeof(OPS[0]);
+
+static unsigned int next_random(unsigned long long &state) {
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return static_cast<unsigned int>(state >> 33);
+}
+
+static size_t generate_inst_file(const std::string &path, size_t num_functions, size_t num_insts) {
+  std::ofstream out(path);
+  unsigned long long state = 1;
+  size_t address = 0;
+
+  out << "[";
+  for (size_t f = 0; f < num_functions; ++f) {
+    if (f != 0) {
+      out << ",";
+    }
+    out << "{\"name\":\"f" << f << "\",\"index\":" << f << ",\"address\":" << address
+        << ",\"blocks\":[{\"id\":0,\"insts\":[";
+    for (size_t i = 0; i < num_insts; ++i) {
+      auto *op = OPS[next_random(state) % NUM_OPS];
+      bool memory = std::string(op).find("MEMORY") != std::string::npos;
+      size_t num_srcs = memory ? 3 : next_random(state) % 4;
+
+      out << (i == 0 ? "" : ",") << "{\"pc\":" << i * 16 << ",\"op\":\"" << op
+          << "\",\"pred\":-1,\"dsts\":[" << next_random(state) % 32 << "],\"srcs\":[";
+      for (size_t s = 0; s < num_srcs; ++s) {
+        out << (s == 0 ? "" : ",") << "{\"id\":" << next_random(state) % 32 << ",\"assign_pcs\":[";
+        if (i != 0) {
+          out << (i - 1 - next_random(state) % (i < 8 ? i : 8)) * 16;
+        }
+        out << "]}";
+      }
+      out << "],\"udsts\":[],\"usrcs\":[]}";
+    }
+    out << "]}]}";
+    address += num_insts * 16 + 256;
+  }
+  out << "]";
+
+  return num_functions * num_insts;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 4) {
+    std::cerr << "./redshow_inst_bench [num_functions] [num_iterations] [/path/to/instruction/file]"
+              << std::endl;
+    exit(-1);
+  }
+
+  size_t num_functions = argc > 1 ? std::stoul(argv[1]) : 4096;
+  size_t num_iterations = argc > 2 ? std::stoul(argv[2]) : 3;
+  std::string file_path = argc > 3 ? std::string(argv[3]) : std::string("redshow_inst_bench.inst");
+  const size_t num_insts = 256;
+
+  auto total_insts = generate_inst_file(file_path, num_functions, num_insts);
+  // The first iteration parses JSON and writes the binary cache, later ones hit the cache
+  auto cache_path = file_path + ".cache";
+  std::remove(cache_path.c_str());
+  std::ifstream in(file_path, std::ifstream::ate | std::ifstream::binary);
+  double mbytes = static_cast<double>(in.tellg()) / (1024 * 1024);
+
+  std::cout << "file: " << file_path << ", " << mbytes << " MB, " << total_insts
+            << " instructions" << std::endl;
+
+  for (size_t i = 0; i < num_iterations; ++i) {
+    redshow::InstructionGraph inst_graph;
+    redshow::SymbolVector symbol_vector;
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = redshow::InstructionParser::parse(file_path, symbol_vector, inst_graph);
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+
+    if (!ok || inst_graph.size() != total_insts) {
+      std::cerr << "parse failed" << std::endl;
+      exit(-1);
+    }
+    std::cout << "iteration " << i << (i == 0 ? " (json): " : " (cache): ") << seconds << " s, "
+              << mbytes / seconds << " MB/s, " << total_insts / seconds << " instructions/s"
+              << std::endl;
+  }
+
+  std::remove(file_path.c_str());
+  std::remove(cache_path.c_str());
+
+  return 0;
+}
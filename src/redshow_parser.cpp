@@ -9,9 +9,9 @@ void output_instructions(redshow::SymbolVector &symbol_vector,
   std::sort(symbol_vector.begin(), symbol_vector.end(),
             [](const redshow::Symbol &l, const redshow::Symbol &r) { return l.offset < r.offset; });
 
-  for (auto iter = inst_graph.nodes_begin(); iter != inst_graph.nodes_end(); ++iter) {
-    auto &inst = iter->second;
-    if (inst.access_kind.get() != NULL) {
+  for (size_t pos = 0; pos < inst_graph.size(); ++pos) {
+    auto &inst = inst_graph.node_at(pos);
+    if (inst.has(redshow::INST_MEMORY) && inst.access_kind.get() != NULL) {
       auto inst_sym = redshow::Symbol(0, inst.pc);
       auto iter = std::upper_bound(symbol_vector.begin(), symbol_vector.end(), inst_sym,
                                    [](const redshow::Symbol &l, const redshow::Symbol &r) -> bool {